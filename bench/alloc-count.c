@@ -0,0 +1,32 @@
+#include "alloc-count.h"
+
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static __thread guint64 n_allocs;
+
+void *
+malloc(size_t size) {
+    n_allocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size) {
+    n_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size) {
+    n_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+guint64
+alloc_count_get(void) {
+    return n_allocs;
+}
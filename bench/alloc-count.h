@@ -0,0 +1,9 @@
+#pragma once
+
+#include <glib.h>
+
+// Number of malloc(), calloc() and realloc() calls made by the
+// calling thread so far.  Linking alloc-count.c into a program
+// replaces the C library's allocator entry points with counting
+// wrappers, so this needs glibc.
+guint64 alloc_count_get(void);
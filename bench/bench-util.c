@@ -0,0 +1,61 @@
+#include "bench-util.h"
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+gint64
+bench_get_cpu_time(pid_t pid) {
+    g_autofree char *path = NULL;
+    g_autofree char *contents = NULL;
+    g_auto(GStrv) fields = NULL;
+    const char *rest;
+    gint64 ticks;
+
+    path = pid ? g_strdup_printf("/proc/%d/stat", (int)pid)
+               : g_strdup("/proc/self/stat");
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return -1;
+
+    // The command name may contain spaces, so start after it.
+    // utime and stime are then the 12th and 13th fields.
+    rest = strrchr(contents, ')');
+    if (rest == NULL)
+        return -1;
+    fields = g_strsplit(rest + 2, " ", 14);
+    if (g_strv_length(fields) < 14)
+        return -1;
+
+    ticks = g_ascii_strtoll(fields[11], NULL, 10) +
+        g_ascii_strtoll(fields[12], NULL, 10);
+    return ticks * G_USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+}
+
+gint64
+bench_get_rss(pid_t pid) {
+    g_autofree char *path = NULL;
+    g_autofree char *contents = NULL;
+    const char *line;
+
+    path = pid ? g_strdup_printf("/proc/%d/status", (int)pid)
+               : g_strdup("/proc/self/status");
+    if (!g_file_get_contents(path, &contents, NULL, NULL))
+        return -1;
+
+    line = strstr(contents, "\nVmRSS:");
+    if (line == NULL)
+        return -1;
+    return g_ascii_strtoll(line + strlen("\nVmRSS:"), NULL, 10);
+}
+
+void
+bench_json_number(GString *out, const char *key, double value) {
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (isfinite(value)) {
+        g_string_append_printf(out, "\"%s\": %s", key,
+                               g_ascii_formatd(buf, sizeof(buf), "%.3f", value));
+    } else {
+        g_string_append_printf(out, "\"%s\": null", key);
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glib.h>
+#include <sys/types.h>
+
+// Resource usage helpers for the benchmarks.  These read /proc, so
+// are Linux only.  A pid of 0 means the calling process.
+
+// User plus system CPU time, in microseconds
+gint64 bench_get_cpu_time(pid_t pid);
+// Resident set size, in kilobytes
+gint64 bench_get_rss(pid_t pid);
+
+// Append value to a JSON document as a number, or null if it isn't
+// finite.
+void bench_json_number(GString *out, const char *key, double value);
@@ -0,0 +1,399 @@
+// Runs rtsp-sender with N test pattern mounts and receives them all
+// over loopback with the plugin's receiver, for a series of N.
+// Results are written as JSON.
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench-util.h"
+#include "histogram.h"
+#include "receiver.h"
+
+#define DEFAULT_PORT 18554
+#define DEFAULT_STREAMS "1,2,4,8,16,32,64"
+#define DEFAULT_DURATION 10
+#define STARTUP_TIMEOUT (10 * G_USEC_PER_SEC)
+#define FIRST_FRAME_TIMEOUT (20 * G_USEC_PER_SEC)
+
+typedef struct {
+    const char *name;
+    const char *encoder;
+} Codec;
+
+static const Codec codecs[] = {
+    { "mjpeg", "jpegenc quality=85 ! rtpjpegpay name=pay0" },
+    { "h264", "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=30 "
+              "! rtph264pay name=pay0 config-interval=-1" },
+};
+
+static const struct {
+    int width, height;
+} resolutions[] = {
+    { 640, 360 },
+    { 1280, 720 },
+    { 1920, 1080 },
+};
+
+typedef struct {
+    char *sender;
+    int port;
+    char *streams;
+    int duration;
+    char *output;
+} Options;
+
+typedef struct {
+    GMutex lock;
+    Histogram *latency;
+    gint64 started;
+    gint64 first_frame;
+    guint64 frames;
+} Stream;
+
+typedef struct {
+    guint n_streams;
+    guint n_connected;
+    double ttff_p50_ms;
+    double ttff_max_ms;
+    double latency_p50_ms;
+    double latency_p95_ms;
+    double latency_p99_ms;
+    double fps_per_stream;
+    double sender_cpu_per_stream;
+    double receiver_cpu_per_stream;
+    double sender_rss_mb;
+    double receiver_rss_mb;
+} Result;
+
+static void
+stream_video(GstSample *sample, GstClockTime capture_time, void *user_data) {
+    Stream *stream = user_data;
+    GstClockTime now = receiver_get_ntp_time(NULL);
+
+    g_mutex_lock(&stream->lock);
+    if (stream->first_frame == 0) {
+        stream->first_frame = g_get_monotonic_time();
+    }
+    stream->frames++;
+    g_mutex_unlock(&stream->lock);
+
+    if (GST_CLOCK_TIME_IS_VALID(capture_time) && now > capture_time) {
+        histogram_add(stream->latency, (now - capture_time) / 1000);
+    }
+}
+
+static char *
+write_config(guint n_streams, GError **error) {
+    g_autoptr(GKeyFile) config = g_key_file_new();
+    g_autofree char *path = NULL;
+    int fd;
+    guint i;
+
+    for (i = 0; i < n_streams; i++) {
+        const Codec *codec = &codecs[i % G_N_ELEMENTS(codecs)];
+        int res = (i / G_N_ELEMENTS(codecs)) % G_N_ELEMENTS(resolutions);
+        g_autofree char *group = g_strdup_printf("/bench%u", i);
+        g_autofree char *pipeline = g_strdup_printf(
+            "videotestsrc is-live=true pattern=ball "
+            "! video/x-raw,width=%d,height=%d,framerate=30/1 ! %s",
+            resolutions[res].width, resolutions[res].height, codec->encoder);
+
+        g_key_file_set_string(config, group, "pipeline", pipeline);
+        g_key_file_set_boolean(config, group, "timestamps", TRUE);
+    }
+
+    fd = g_file_open_tmp("loopback-bench-XXXXXX.conf", &path, error);
+    if (fd < 0)
+        return NULL;
+    close(fd);
+    if (!g_key_file_save_to_file(config, path, error))
+        return NULL;
+    return g_steal_pointer(&path);
+}
+
+static gboolean
+wait_for_port(int port) {
+    g_autoptr(GSocketClient) client = g_socket_client_new();
+    gint64 deadline = g_get_monotonic_time() + STARTUP_TIMEOUT;
+
+    while (g_get_monotonic_time() < deadline) {
+        g_autoptr(GSocketConnection) conn = NULL;
+
+        conn = g_socket_client_connect_to_host(client, "127.0.0.1", port, NULL, NULL);
+        if (conn)
+            return TRUE;
+        g_usleep(100 * 1000);
+    }
+    return FALSE;
+}
+
+static int
+compare_double(gconstpointer a, gconstpointer b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Connect to a running sender and measure its streams
+static gboolean
+measure_streams(Options *opts, GSubprocess *sender, guint n_streams,
+                Result *result, GError **error) {
+    g_autoptr(Histogram) latency = histogram_new();
+    g_autofree Receiver **receivers = NULL;
+    g_autofree Stream *streams = NULL;
+    g_autoptr(GArray) ttff = g_array_new(FALSE, FALSE, sizeof(double));
+    gint64 deadline, start, start_cpu, start_sender_cpu, elapsed;
+    guint64 start_frames = 0, end_frames = 0;
+    pid_t sender_pid;
+    guint i;
+
+    sender_pid = atoi(g_subprocess_get_identifier(sender));
+
+    if (!wait_for_port(opts->port)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                    "rtsp-sender did not start listening on port %d", opts->port);
+        return FALSE;
+    }
+
+    // Connect everything at once, as OBS does when loading a scene
+    // collection.
+    receivers = g_new0(Receiver *, n_streams);
+    streams = g_new0(Stream, n_streams);
+    for (i = 0; i < n_streams; i++) {
+        g_autofree char *url = g_strdup_printf(
+            "rtsp://127.0.0.1:%d/bench%u", opts->port, i);
+
+        g_mutex_init(&streams[i].lock);
+        streams[i].latency = latency;
+        streams[i].started = g_get_monotonic_time();
+        receivers[i] = receiver_new(url, NULL, FALSE, 0, FALSE, 0, stream_video,
+                                    NULL, NULL, &streams[i]);
+    }
+
+    deadline = g_get_monotonic_time() + FIRST_FRAME_TIMEOUT;
+    while (g_get_monotonic_time() < deadline) {
+        guint n_connected = 0;
+
+        for (i = 0; i < n_streams; i++) {
+            g_mutex_lock(&streams[i].lock);
+            n_connected += streams[i].first_frame != 0;
+            g_mutex_unlock(&streams[i].lock);
+        }
+        if (n_connected == n_streams)
+            break;
+        g_usleep(10 * 1000);
+    }
+
+    // Steady state
+    histogram_reset(latency);
+    for (i = 0; i < n_streams; i++) {
+        g_mutex_lock(&streams[i].lock);
+        start_frames += streams[i].frames;
+        g_mutex_unlock(&streams[i].lock);
+    }
+    start = g_get_monotonic_time();
+    start_cpu = bench_get_cpu_time(0);
+    start_sender_cpu = bench_get_cpu_time(sender_pid);
+
+    g_usleep((gulong)opts->duration * G_USEC_PER_SEC);
+
+    elapsed = g_get_monotonic_time() - start;
+    result->receiver_cpu_per_stream =
+        100.0 * (bench_get_cpu_time(0) - start_cpu) / elapsed / n_streams;
+    result->sender_cpu_per_stream =
+        100.0 * (bench_get_cpu_time(sender_pid) - start_sender_cpu) / elapsed / n_streams;
+    result->sender_rss_mb = bench_get_rss(sender_pid) / 1024.0;
+    result->receiver_rss_mb = bench_get_rss(0) / 1024.0;
+
+    result->n_streams = n_streams;
+    result->n_connected = 0;
+    for (i = 0; i < n_streams; i++) {
+        g_mutex_lock(&streams[i].lock);
+        end_frames += streams[i].frames;
+        if (streams[i].first_frame != 0) {
+            double ms = (streams[i].first_frame - streams[i].started) / 1000.0;
+
+            g_array_append_val(ttff, ms);
+            result->n_connected++;
+        }
+        g_mutex_unlock(&streams[i].lock);
+    }
+    result->fps_per_stream =
+        (double)(end_frames - start_frames) * G_USEC_PER_SEC / elapsed / n_streams;
+
+    if (ttff->len > 0) {
+        g_array_sort(ttff, compare_double);
+        result->ttff_p50_ms = g_array_index(ttff, double, ttff->len / 2);
+        result->ttff_max_ms = g_array_index(ttff, double, ttff->len - 1);
+    } else {
+        result->ttff_p50_ms = result->ttff_max_ms = NAN;
+    }
+    if (histogram_get_count(latency) > 0) {
+        result->latency_p50_ms = histogram_get_percentile(latency, 0.50) / 1000.0;
+        result->latency_p95_ms = histogram_get_percentile(latency, 0.95) / 1000.0;
+        result->latency_p99_ms = histogram_get_percentile(latency, 0.99) / 1000.0;
+    } else {
+        result->latency_p50_ms = result->latency_p95_ms = result->latency_p99_ms = NAN;
+    }
+
+    for (i = 0; i < n_streams; i++) {
+        receiver_free(receivers[i]);
+        g_mutex_clear(&streams[i].lock);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+run_streams(Options *opts, guint n_streams, Result *result, GError **error) {
+    g_autofree char *config_path = NULL;
+    g_autofree char *port_str = NULL;
+    g_autoptr(GSubprocess) sender = NULL;
+    gboolean ok = FALSE;
+
+    config_path = write_config(n_streams, error);
+    if (config_path == NULL)
+        return FALSE;
+
+    port_str = g_strdup_printf("%d", opts->port);
+    sender = g_subprocess_new(
+        G_SUBPROCESS_FLAGS_STDOUT_SILENCE | G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+        error, opts->sender, "--port", port_str, "--config", config_path,
+        "--stats-interval", "0", NULL);
+    if (sender) {
+        ok = measure_streams(opts, sender, n_streams, result, error);
+
+        // Stop and reap the sender however the run went.  It may not
+        // have got as far as handling SIGTERM.
+        if (ok) {
+            g_subprocess_send_signal(sender, SIGTERM);
+        } else {
+            g_subprocess_force_exit(sender);
+        }
+        g_subprocess_wait(sender, NULL, NULL);
+    }
+    g_unlink(config_path);
+
+    return ok;
+}
+
+static void
+format_result(GString *out, Result *result) {
+    g_string_append_printf(out, "    {\"streams\": %u, \"connected\": %u, ",
+                           result->n_streams, result->n_connected);
+    bench_json_number(out, "ttff_p50_ms", result->ttff_p50_ms);
+    g_string_append(out, ", ");
+    bench_json_number(out, "ttff_max_ms", result->ttff_max_ms);
+    g_string_append(out, ", ");
+    bench_json_number(out, "latency_p50_ms", result->latency_p50_ms);
+    g_string_append(out, ", ");
+    bench_json_number(out, "latency_p95_ms", result->latency_p95_ms);
+    g_string_append(out, ", ");
+    bench_json_number(out, "latency_p99_ms", result->latency_p99_ms);
+    g_string_append(out, ", ");
+    bench_json_number(out, "fps_per_stream", result->fps_per_stream);
+    g_string_append(out, ", ");
+    bench_json_number(out, "sender_cpu_percent_per_stream", result->sender_cpu_per_stream);
+    g_string_append(out, ", ");
+    bench_json_number(out, "receiver_cpu_percent_per_stream", result->receiver_cpu_per_stream);
+    g_string_append(out, ", ");
+    bench_json_number(out, "sender_rss_mb", result->sender_rss_mb);
+    g_string_append(out, ", ");
+    bench_json_number(out, "receiver_rss_mb", result->receiver_rss_mb);
+    g_string_append(out, "}");
+}
+
+static gboolean
+parse_options(int *argc, char ***argv, Options *opts, GError **error) {
+    g_autoptr(GOptionContext) ctx = NULL;
+    GOptionEntry options[] = {
+        {"sender", 's', 0, G_OPTION_ARG_FILENAME, &opts->sender,
+         "Path to rtsp-sender", "PATH"},
+        {"port", 'p', 0, G_OPTION_ARG_INT, &opts->port,
+         "Port for rtsp-sender to listen on (default: " G_STRINGIFY(DEFAULT_PORT) ")", "PORT"},
+        {"streams", 'n', 0, G_OPTION_ARG_STRING, &opts->streams,
+         "Comma separated stream counts (default: " DEFAULT_STREAMS ")", "N,..."},
+        {"duration", 'd', 0, G_OPTION_ARG_INT, &opts->duration,
+         "Seconds to measure each stream count for (default: " G_STRINGIFY(DEFAULT_DURATION) ")", "SECONDS"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opts->output,
+         "Write results to a file rather than stdout", "FILE"},
+        {NULL}
+    };
+
+    opts->sender = NULL;
+    opts->port = DEFAULT_PORT;
+    opts->streams = g_strdup(DEFAULT_STREAMS);
+    opts->duration = DEFAULT_DURATION;
+    opts->output = NULL;
+    ctx = g_option_context_new(NULL);
+    g_option_context_add_main_entries(ctx, options, NULL);
+    g_option_context_add_group(ctx, gst_init_get_option_group());
+
+    if (!g_option_context_parse(ctx, argc, argv, error))
+        return FALSE;
+    if (opts->sender == NULL) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                    "--sender is required");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int
+main(int argc, char **argv) {
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GString) out = g_string_new(NULL);
+    g_auto(GStrv) counts = NULL;
+    Options opts;
+    gboolean first = TRUE;
+    int i;
+
+    if (!parse_options(&argc, &argv, &opts, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        return 1;
+    }
+    receiver_init();
+
+    g_string_append(out, "{\n  \"benchmark\": \"loopback\",\n");
+    g_string_append_printf(out, "  \"duration_s\": %d,\n  \"results\": [\n",
+                           opts.duration);
+
+    counts = g_strsplit(opts.streams, ",", -1);
+    for (i = 0; counts[i] != NULL; i++) {
+        guint n_streams = (guint)g_ascii_strtoull(counts[i], NULL, 10);
+        Result result = { 0 };
+
+        if (n_streams == 0)
+            continue;
+        g_printerr("Running %u streams\n", n_streams);
+        if (!run_streams(&opts, n_streams, &result, &error)) {
+            g_printerr("Error running %u streams: %s\n", n_streams, error->message);
+            receiver_deinit();
+            return 1;
+        }
+
+        if (!first) {
+            g_string_append(out, ",\n");
+        }
+        first = FALSE;
+        format_result(out, &result);
+    }
+    g_string_append(out, "\n  ]\n}\n");
+
+    receiver_deinit();
+
+    if (opts.output) {
+        if (!g_file_set_contents(opts.output, out->str, out->len, &error)) {
+            g_printerr("Error writing results: %s\n", error->message);
+            return 1;
+        }
+    } else {
+        g_print("%s", out->str);
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+// Simulates a large mDNS domain with services coming, going and
+// changing, while many sources poll the browser at frame rate as
+// remote_source_video_tick() does.  Results are written as JSON.
+
+#include <glib.h>
+#include <math.h>
+#include <time.h>
+
+#include "alloc-count.h"
+#include "bench-util.h"
+#include "histogram.h"
+#include "mdns-backend.h"
+#include "mdns-browse.h"
+
+#define DEFAULT_SERVICES 500
+#define DEFAULT_SOURCES 64
+#define DEFAULT_DURATION 10
+#define DEFAULT_CHURN 100
+#define DEFAULT_FPS 60
+
+typedef struct {
+    int n_services;
+    int n_sources;
+    int duration;
+    int churn;
+    int fps;
+    char *output;
+} Options;
+
+typedef struct {
+    char *name;
+    gint stamp;
+    char *uri;
+} Source;
+
+typedef struct {
+    Options *opts;
+    MdnsBrowser *browser;
+    volatile gint running;
+
+    // Churn state, shared with the polling thread
+    GMutex lock;
+    gboolean *present;
+    gint64 *changed_at;
+
+    // Results
+    Histogram *tick_time;
+    Histogram *available_time;
+    Histogram *notify_latency;
+    guint64 n_ticks;
+    guint64 tick_allocs;
+    guint64 max_tick_allocs;
+} Bench;
+
+static gint64
+get_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static char *
+service_name(int index) {
+    return g_strdup_printf("Camera-%04d", index);
+}
+
+static void
+add_service(Bench *bench, int index, guint generation) {
+    g_autofree char *name = service_name(index);
+    g_autofree char *host = g_strdup_printf("10.0.%d.%d", index / 250, index % 250 + 1);
+    g_autofree char *path = g_strdup_printf("/cam%d", index);
+
+    // Vary the port, so a changed service has a different URL
+    mdns_fake_backend_add(mdns_browser_get_backend(bench->browser), name, host,
+                          8554 + generation % 100, path);
+}
+
+static void *
+churn_thread(void *user_data) {
+    Bench *bench = user_data;
+    MdnsBackend *backend = mdns_browser_get_backend(bench->browser);
+    g_autoptr(GRand) rand = g_rand_new_with_seed(42);
+    gulong interval = G_USEC_PER_SEC / bench->opts->churn;
+    guint generation = 1;
+
+    while (g_atomic_int_get(&bench->running)) {
+        int index = g_rand_int_range(rand, 0, bench->opts->n_services);
+        g_autofree char *name = service_name(index);
+        gboolean was_present, present;
+
+        g_mutex_lock(&bench->lock);
+        was_present = bench->present[index];
+        present = !was_present || g_rand_boolean(rand);
+        bench->present[index] = present;
+        bench->changed_at[index] = get_time_ns();
+        g_mutex_unlock(&bench->lock);
+
+        if (was_present) {
+            mdns_fake_backend_remove(backend, name);
+        }
+        // Either it appeared, or it changed
+        if (present) {
+            add_service(bench, index, generation++);
+        }
+
+        g_usleep(interval);
+    }
+
+    return NULL;
+}
+
+static void
+source_tick(Bench *bench, Source *source, int index) {
+    g_autofree char *uri = NULL;
+    gint64 changed_at;
+
+    if (mdns_browser_get_stamp(bench->browser) == source->stamp)
+        return;
+
+    uri = mdns_browser_get_uri(bench->browser, source->name, &source->stamp);
+    if (g_strcmp0(uri, source->uri) == 0)
+        return;
+
+    g_mutex_lock(&bench->lock);
+    changed_at = bench->changed_at[index];
+    g_mutex_unlock(&bench->lock);
+    if (changed_at != 0) {
+        histogram_add(bench->notify_latency, (get_time_ns() - changed_at) / 1000);
+    }
+
+    g_free(source->uri);
+    source->uri = g_steal_pointer(&uri);
+}
+
+static void *
+render_thread(void *user_data) {
+    Bench *bench = user_data;
+    int n_sources = bench->opts->n_sources;
+    g_autofree Source *sources = g_new0(Source, n_sources);
+    gint64 frame = G_USEC_PER_SEC / bench->opts->fps;
+    gint64 next = g_get_monotonic_time();
+    int i;
+
+    for (i = 0; i < n_sources; i++) {
+        sources[i].name = service_name(i);
+        sources[i].uri = mdns_browser_get_uri(bench->browser, sources[i].name,
+                                              &sources[i].stamp);
+    }
+
+    while (g_atomic_int_get(&bench->running)) {
+        gint64 start = get_time_ns();
+        guint64 allocs = alloc_count_get();
+
+        // All sources tick on the one graphics thread
+        for (i = 0; i < n_sources; i++) {
+            source_tick(bench, &sources[i], i);
+        }
+
+        histogram_add(bench->tick_time, (get_time_ns() - start) / 1000);
+        allocs = alloc_count_get() - allocs;
+        bench->n_ticks++;
+        bench->tick_allocs += allocs;
+        bench->max_tick_allocs = MAX(bench->max_tick_allocs, allocs);
+
+        next += frame;
+        if (next > g_get_monotonic_time()) {
+            g_usleep(next - g_get_monotonic_time());
+        }
+    }
+
+    for (i = 0; i < n_sources; i++) {
+        g_free(sources[i].name);
+        g_free(sources[i].uri);
+    }
+    return NULL;
+}
+
+static void *
+properties_thread(void *user_data) {
+    Bench *bench = user_data;
+    gulong frame = G_USEC_PER_SEC / bench->opts->fps;
+
+    // A properties dialog listing every service
+    while (g_atomic_int_get(&bench->running)) {
+        gint64 start = get_time_ns();
+        g_auto(GStrv) names = mdns_browser_get_available(bench->browser);
+
+        histogram_add(bench->available_time, (get_time_ns() - start) / 1000);
+        g_usleep(frame);
+    }
+    return NULL;
+}
+
+static void
+format_percentiles(GString *out, const char *key, Histogram *hist, double scale) {
+    g_string_append_printf(out, "  \"%s\": {", key);
+    bench_json_number(out, "p50", histogram_get_percentile(hist, 0.50) / scale);
+    g_string_append(out, ", ");
+    bench_json_number(out, "p99", histogram_get_percentile(hist, 0.99) / scale);
+    g_string_append(out, ", ");
+    bench_json_number(out, "max", histogram_get_percentile(hist, 1.0) / scale);
+    g_string_append_printf(out, ", \"count\": %" G_GUINT64_FORMAT "},\n",
+                           histogram_get_count(hist));
+}
+
+static gboolean
+parse_options(int *argc, char ***argv, Options *opts, GError **error) {
+    g_autoptr(GOptionContext) ctx = NULL;
+    GOptionEntry options[] = {
+        {"services", 0, 0, G_OPTION_ARG_INT, &opts->n_services,
+         "Number of services in the domain (default: " G_STRINGIFY(DEFAULT_SERVICES) ")", "N"},
+        {"sources", 0, 0, G_OPTION_ARG_INT, &opts->n_sources,
+         "Number of polling sources (default: " G_STRINGIFY(DEFAULT_SOURCES) ")", "N"},
+        {"duration", 'd', 0, G_OPTION_ARG_INT, &opts->duration,
+         "Seconds to run for (default: " G_STRINGIFY(DEFAULT_DURATION) ")", "SECONDS"},
+        {"churn", 0, 0, G_OPTION_ARG_INT, &opts->churn,
+         "Service changes per second (default: " G_STRINGIFY(DEFAULT_CHURN) ")", "N"},
+        {"fps", 0, 0, G_OPTION_ARG_INT, &opts->fps,
+         "Frame rate sources poll at (default: " G_STRINGIFY(DEFAULT_FPS) ")", "N"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opts->output,
+         "Write results to a file rather than stdout", "FILE"},
+        {NULL}
+    };
+
+    opts->n_services = DEFAULT_SERVICES;
+    opts->n_sources = DEFAULT_SOURCES;
+    opts->duration = DEFAULT_DURATION;
+    opts->churn = DEFAULT_CHURN;
+    opts->fps = DEFAULT_FPS;
+    opts->output = NULL;
+    ctx = g_option_context_new(NULL);
+    g_option_context_add_main_entries(ctx, options, NULL);
+
+    if (!g_option_context_parse(ctx, argc, argv, error))
+        return FALSE;
+    if (opts->n_services <= 0 || opts->churn <= 0 || opts->fps <= 0 ||
+        opts->n_sources < 0 || opts->n_sources > opts->n_services) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                    "Invalid service, source, churn or frame rate count");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int
+main(int argc, char **argv) {
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GString) out = g_string_new(NULL);
+    g_autoptr(MdnsBrowser) browser = NULL;
+    GThread *churn, *render, *properties;
+    Options opts;
+    Bench bench = { 0 };
+    int i;
+
+    if (!parse_options(&argc, &argv, &opts, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        return 1;
+    }
+
+    browser = mdns_browser_new_full(NULL, mdns_fake_backend_new, &error);
+    if (!browser) {
+        g_printerr("Error creating browser: %s\n", error->message);
+        return 1;
+    }
+
+    bench.opts = &opts;
+    bench.browser = browser;
+    bench.running = TRUE;
+    g_mutex_init(&bench.lock);
+    bench.present = g_new0(gboolean, opts.n_services);
+    bench.changed_at = g_new0(gint64, opts.n_services);
+    bench.tick_time = histogram_new();
+    bench.available_time = histogram_new();
+    bench.notify_latency = histogram_new();
+
+    // The initial browse
+    for (i = 0; i < opts.n_services; i++) {
+        add_service(&bench, i, 0);
+        bench.present[i] = TRUE;
+    }
+    mdns_fake_backend_all_for_now(mdns_browser_get_backend(browser));
+    mdns_fake_backend_flush(mdns_browser_get_backend(browser));
+    histogram_reset(mdns_browser_get_lock_stats(browser));
+
+    render = g_thread_new("render", render_thread, &bench);
+    properties = g_thread_new("properties", properties_thread, &bench);
+    churn = g_thread_new("churn", churn_thread, &bench);
+
+    g_usleep((gulong)opts.duration * G_USEC_PER_SEC);
+
+    g_atomic_int_set(&bench.running, FALSE);
+    g_thread_join(churn);
+    g_thread_join(render);
+    g_thread_join(properties);
+
+    g_string_append(out, "{\n  \"benchmark\": \"mdns-churn\",\n");
+    g_string_append_printf(
+        out, "  \"services\": %d,\n  \"sources\": %d,\n  \"churn_per_s\": %d,\n"
+        "  \"fps\": %d,\n  \"duration_s\": %d,\n",
+        opts.n_services, opts.n_sources, opts.churn, opts.fps, opts.duration);
+    format_percentiles(out, "lock_hold_us", mdns_browser_get_lock_stats(browser), 1000.0);
+    format_percentiles(out, "tick_us", bench.tick_time, 1.0);
+    format_percentiles(out, "get_available_us", bench.available_time, 1.0);
+    format_percentiles(out, "notify_latency_ms", bench.notify_latency, 1000.0);
+    g_string_append(out, "  ");
+    bench_json_number(out, "allocs_per_tick",
+                      bench.n_ticks ? (double)bench.tick_allocs / bench.n_ticks : NAN);
+    g_string_append_printf(out, ",\n  \"max_allocs_per_tick\": %" G_GUINT64_FORMAT "\n}\n",
+                           bench.max_tick_allocs);
+
+    g_clear_pointer(&bench.tick_time, histogram_free);
+    g_clear_pointer(&bench.available_time, histogram_free);
+    g_clear_pointer(&bench.notify_latency, histogram_free);
+    g_free(bench.present);
+    g_free(bench.changed_at);
+    g_mutex_clear(&bench.lock);
+
+    if (opts.output) {
+        if (!g_file_set_contents(opts.output, out->str, out->len, &error)) {
+            g_printerr("Error writing results: %s\n", error->message);
+            return 1;
+        }
+    } else {
+        g_print("%s", out->str);
+    }
+    return 0;
+}
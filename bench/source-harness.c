@@ -0,0 +1,393 @@
+// Drives many remote_source instances against a stub libobs, at the
+// rates OBS would call them, and reports the CPU time and heap
+// allocations of each callback.  The receiver child sources are
+// simulated, and services come from the fake mDNS backend.
+
+#include <glib.h>
+#include <math.h>
+#include <time.h>
+
+#include "active-notify.h"
+#include "alloc-count.h"
+#include "bench-util.h"
+#include "histogram.h"
+#include "mdns-backend.h"
+#include "mdns-browse.h"
+#include "receiver.h"
+#include "receiver-source.h"
+#include "source.h"
+#include "stub-obs.h"
+
+#include <obs/util/platform.h>
+
+#define DEFAULT_INSTANCES 64
+#define DEFAULT_DURATION 10
+#define DEFAULT_FPS 60
+#define CAMERA_FPS 30
+#define SCENE_SWITCH_INTERVAL 5
+#define UPDATE_INTERVAL 1
+#define SERVICE_CHANGE_INTERVAL 2
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+
+MdnsBrowser *mdns_browser = NULL;
+ActiveNotify *active_notify = NULL;
+
+typedef enum {
+    OP_CREATE,
+    OP_UPDATE,
+    OP_VIDEO_TICK,
+    OP_VIDEO_RENDER,
+    OP_ACTIVATE,
+    OP_DEACTIVATE,
+    OP_DESTROY,
+    N_OPS,
+} Op;
+
+static const char *op_names[N_OPS] = {
+    "create", "update", "video_tick", "video_render",
+    "activate", "deactivate", "destroy",
+};
+
+typedef struct {
+    guint64 calls;
+    guint64 cpu_ns;
+    guint64 allocs;
+    Histogram *cpu_hist;
+} OpStats;
+
+typedef struct {
+    int n_instances;
+    int duration;
+    int fps;
+    char *output;
+} Options;
+
+typedef struct {
+    obs_source_t *source;
+    obs_data_t *settings;
+    GPtrArray *children;
+} Instance;
+
+static OpStats stats[N_OPS];
+
+// Simulated rtsp_receiver_source
+
+void
+receiver_source_get_last_frame(obs_source_t *source, uint64_t *frame_id,
+                               uint64_t *capture_time) {
+    *frame_id = source->frame_id;
+    *capture_time = receiver_get_ntp_time(NULL) - 50 * GST_MSECOND;
+}
+
+void
+receiver_source_set_standby(obs_source_t *source, bool standby) {
+}
+
+bool
+receiver_source_get_region(obs_source_t *source, ViewRegion *region) {
+    return false;
+}
+
+void
+receiver_source_set_view(obs_source_t *source, const char *view) {
+}
+
+void
+receiver_source_set_audio_target(obs_source_t *source, obs_source_t *target) {
+}
+
+bool
+receiver_source_is_healthy(obs_source_t *source) {
+    return source->healthy;
+}
+
+bool
+receiver_source_get_playout_stats(obs_source_t *source, PlayoutStats *playout) {
+    *playout = (PlayoutStats){
+        .target_ms = 20, .delay_ms = 20, .depth_frames = 1, .depth_ms = 33,
+    };
+    return true;
+}
+
+GstClockTime
+receiver_get_ntp_time(const char *clock_uri) {
+    return (g_get_real_time() + NTP_UNIX_OFFSET * G_USEC_PER_SEC) * 1000;
+}
+
+static gint64
+get_cpu_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+#define MEASURE(op, call) G_STMT_START {                        \
+        gint64 start_ = get_cpu_time_ns();                      \
+        guint64 allocs_ = alloc_count_get();                    \
+        call;                                                   \
+        record(op, get_cpu_time_ns() - start_,                  \
+               alloc_count_get() - allocs_);                    \
+    } G_STMT_END
+
+static void
+record(Op op, gint64 cpu_ns, guint64 allocs) {
+    stats[op].calls++;
+    stats[op].cpu_ns += cpu_ns;
+    stats[op].allocs += allocs;
+    histogram_add(stats[op].cpu_hist, cpu_ns);
+}
+
+static void
+collect_child(obs_source_t *parent, obs_source_t *child, void *param) {
+    g_ptr_array_add(param, child);
+}
+
+static void
+instance_init(Instance *instance, int index) {
+    g_autofree char *service = g_strdup_printf("Camera-%04d", index);
+    g_autofree char *backup = g_strdup_printf("Camera-%04d-b", index);
+
+    instance->settings = obs_data_create();
+    obs_data_set_string(instance->settings, "service_name", service);
+    // A mix of the features that add per-tick work
+    if (index % 4 == 0) {
+        obs_data_set_string(instance->settings, "backup_service_name", backup);
+    }
+    obs_data_set_bool(instance->settings, "measure_latency", index % 2 == 0);
+
+    MEASURE(OP_CREATE, instance->source = stub_source_new(&remote_source,
+                                                          instance->settings));
+
+    // Every other camera is a picture-in-picture
+    stub_scene_add(instance->source, index % 2 ? 0.25f : 1.0f);
+
+    instance->children = g_ptr_array_new();
+    remote_source.enum_all_sources(instance->source->data, collect_child,
+                                   instance->children);
+}
+
+static void
+instance_clear(Instance *instance) {
+    stub_scene_remove(instance->source);
+    MEASURE(OP_DESTROY, stub_source_destroy(instance->source));
+    g_ptr_array_unref(instance->children);
+    obs_data_release(instance->settings);
+}
+
+static void
+instance_set_active(Instance *instance, gboolean active) {
+    if (active == instance->source->active)
+        return;
+
+    instance->source->active = active;
+    if (active) {
+        MEASURE(OP_ACTIVATE, remote_source.activate(instance->source->data));
+    } else {
+        MEASURE(OP_DEACTIVATE, remote_source.deactivate(instance->source->data));
+    }
+}
+
+static void
+add_services(MdnsBackend *backend, int index) {
+    g_autofree char *service = g_strdup_printf("Camera-%04d", index);
+    g_autofree char *backup = g_strdup_printf("Camera-%04d-b", index);
+    g_autofree char *path = g_strdup_printf("/cam%d", index);
+
+    // Nothing listens on the discard port, so tally notifications
+    // fail quickly.
+    mdns_fake_backend_add(backend, service, "127.0.0.1", 9, path);
+    mdns_fake_backend_add(backend, backup, "127.0.0.1", 9, path);
+}
+
+static void
+run(Options *opts) {
+    MdnsBackend *backend = mdns_browser_get_backend(mdns_browser);
+    g_autofree Instance *instances = g_new0(Instance, opts->n_instances);
+    gint64 frame = G_USEC_PER_SEC / opts->fps;
+    guint64 camera_interval = MAX(opts->fps / CAMERA_FPS, 1);
+    gint64 start, next;
+    guint64 n_frames, total_frames;
+    int i, scene = 0;
+
+    for (i = 0; i < opts->n_instances; i++) {
+        add_services(backend, i);
+    }
+    mdns_fake_backend_all_for_now(backend);
+    mdns_fake_backend_flush(backend);
+
+    for (i = 0; i < opts->n_instances; i++) {
+        instance_init(&instances[i], i);
+        // Half the sources are in the first scene
+        instance_set_active(&instances[i], i % 2 == 0);
+    }
+
+    total_frames = (guint64)opts->duration * opts->fps;
+    start = next = g_get_monotonic_time();
+    for (n_frames = 0; n_frames < total_frames; n_frames++) {
+        gboolean camera_frame = n_frames % camera_interval == 0;
+        gint64 now;
+
+        for (i = 0; i < opts->n_instances; i++) {
+            Instance *instance = &instances[i];
+            guint j;
+
+            if (camera_frame) {
+                for (j = 0; j < instance->children->len; j++) {
+                    ((obs_source_t *)g_ptr_array_index(instance->children, j))->frame_id++;
+                }
+            }
+            MEASURE(OP_VIDEO_TICK,
+                    remote_source.video_tick(instance->source->data, 1.0f / opts->fps));
+            if (obs_source_active(instance->source)) {
+                MEASURE(OP_VIDEO_RENDER,
+                        remote_source.video_render(instance->source->data, NULL));
+            }
+        }
+
+        // Settings applied from a properties dialog
+        if (n_frames % (opts->fps * UPDATE_INTERVAL) == 0) {
+            Instance *instance = &instances[(n_frames / opts->fps) % opts->n_instances];
+
+            MEASURE(OP_UPDATE, remote_source.update(instance->source->data,
+                                                    instance->settings));
+        }
+
+        // A camera restarting elsewhere on the network
+        if (n_frames % (opts->fps * SERVICE_CHANGE_INTERVAL) == 0) {
+            int index = (n_frames / opts->fps) % opts->n_instances;
+            g_autofree char *service = g_strdup_printf("Camera-%04d", index);
+
+            mdns_fake_backend_remove(backend, service);
+            add_services(backend, index);
+        }
+
+        if (n_frames % (opts->fps * SCENE_SWITCH_INTERVAL) == 0 && n_frames > 0) {
+            scene = !scene;
+            for (i = 0; i < opts->n_instances; i++) {
+                instance_set_active(&instances[i], i % 2 == scene);
+            }
+        }
+
+        next += frame;
+        now = g_get_monotonic_time();
+        if (next > now) {
+            g_usleep(next - now);
+        }
+    }
+    g_printerr("Ran %" G_GUINT64_FORMAT " frames in %.1f s\n", n_frames,
+               (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+
+    for (i = 0; i < opts->n_instances; i++) {
+        instance_set_active(&instances[i], FALSE);
+        instance_clear(&instances[i]);
+    }
+}
+
+static void
+format_results(GString *out, Options *opts) {
+    int op;
+
+    g_string_append(out, "{\n  \"benchmark\": \"source-harness\",\n");
+    g_string_append_printf(out, "  \"instances\": %d,\n  \"fps\": %d,\n"
+                           "  \"duration_s\": %d,\n  \"calls\": {\n",
+                           opts->n_instances, opts->fps, opts->duration);
+    for (op = 0; op < N_OPS; op++) {
+        OpStats *s = &stats[op];
+        double calls = s->calls ? (double)s->calls : NAN;
+
+        g_string_append_printf(out, "    \"%s\": {\"calls\": %" G_GUINT64_FORMAT ", ",
+                               op_names[op], s->calls);
+        bench_json_number(out, "cpu_ns_mean", s->cpu_ns / calls);
+        g_string_append(out, ", ");
+        bench_json_number(out, "cpu_ns_p99",
+                          s->calls ? (double)histogram_get_percentile(s->cpu_hist, 0.99) : NAN);
+        g_string_append(out, ", ");
+        bench_json_number(out, "allocs_per_call", s->allocs / calls);
+        g_string_append_printf(out, "}%s\n", op + 1 < N_OPS ? "," : "");
+    }
+    g_string_append(out, "  }\n}\n");
+}
+
+static void
+discard_log(const char *domain, GLogLevelFlags level, const char *message,
+            void *user_data) {
+}
+
+static gboolean
+parse_options(int *argc, char ***argv, Options *opts, GError **error) {
+    g_autoptr(GOptionContext) ctx = NULL;
+    GOptionEntry options[] = {
+        {"instances", 'n', 0, G_OPTION_ARG_INT, &opts->n_instances,
+         "Number of remote sources (default: " G_STRINGIFY(DEFAULT_INSTANCES) ")", "N"},
+        {"duration", 'd', 0, G_OPTION_ARG_INT, &opts->duration,
+         "Seconds to run for (default: " G_STRINGIFY(DEFAULT_DURATION) ")", "SECONDS"},
+        {"fps", 0, 0, G_OPTION_ARG_INT, &opts->fps,
+         "Render frame rate (default: " G_STRINGIFY(DEFAULT_FPS) ")", "N"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opts->output,
+         "Write results to a file rather than stdout", "FILE"},
+        {NULL}
+    };
+
+    opts->n_instances = DEFAULT_INSTANCES;
+    opts->duration = DEFAULT_DURATION;
+    opts->fps = DEFAULT_FPS;
+    opts->output = NULL;
+    ctx = g_option_context_new(NULL);
+    g_option_context_add_main_entries(ctx, options, NULL);
+
+    if (!g_option_context_parse(ctx, argc, argv, error))
+        return FALSE;
+    if (opts->n_instances <= 0 || opts->fps <= 0 || opts->duration <= 0) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                    "Instances, frame rate and duration must be positive");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int
+main(int argc, char **argv) {
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GString) out = g_string_new(NULL);
+    Options opts;
+    int op;
+
+    if (!parse_options(&argc, &argv, &opts, &error)) {
+        g_printerr("Error parsing options: %s\n", error->message);
+        return 1;
+    }
+    // The plugin logs every URL change and failed tally notification
+    g_log_set_handler(NULL, G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_WARNING | G_LOG_LEVEL_INFO,
+                      discard_log, NULL);
+
+    for (op = 0; op < N_OPS; op++) {
+        stats[op].cpu_hist = histogram_new();
+    }
+    mdns_browser = mdns_browser_new_full(NULL, mdns_fake_backend_new, &error);
+    if (!mdns_browser) {
+        g_printerr("Error creating browser: %s\n", error->message);
+        return 1;
+    }
+    active_notify = active_notify_new();
+
+    run(&opts);
+
+    g_clear_pointer(&active_notify, active_notify_free);
+    g_clear_pointer(&mdns_browser, mdns_browser_free);
+
+    format_results(out, &opts);
+    for (op = 0; op < N_OPS; op++) {
+        g_clear_pointer(&stats[op].cpu_hist, histogram_free);
+    }
+
+    if (opts.output) {
+        if (!g_file_set_contents(opts.output, out->str, out->len, &error)) {
+            g_printerr("Error writing results: %s\n", error->message);
+            return 1;
+        }
+    } else {
+        g_print("%s", out->str);
+    }
+    return 0;
+}
@@ -0,0 +1,461 @@
+#include "stub-obs.h"
+
+#include <obs/util/platform.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+    VALUE_STRING,
+    VALUE_INT,
+    VALUE_BOOL,
+} ValueType;
+
+typedef struct {
+    ValueType type;
+    char *string;
+    long long integer;
+} Value;
+
+struct obs_data {
+    gint ref_count;
+    GHashTable *values;
+};
+
+struct obs_property {
+    char *name;
+    GPtrArray *items;
+};
+
+struct obs_properties {
+    guint32 flags;
+    GPtrArray *props;
+};
+
+struct obs_scene {
+    GPtrArray *items;
+};
+
+struct obs_scene_item {
+    obs_source_t *source;
+    float scale;
+};
+
+static obs_source_t scene_source;
+static obs_scene_t stub_scene;
+
+static void
+value_free(Value *value) {
+    g_free(value->string);
+    g_free(value);
+}
+
+obs_data_t *
+obs_data_create(void) {
+    obs_data_t *data = g_new0(obs_data_t, 1);
+
+    data->ref_count = 1;
+    data->values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)value_free);
+    return data;
+}
+
+obs_data_t *
+stub_data_ref(obs_data_t *data) {
+    g_atomic_int_inc(&data->ref_count);
+    return data;
+}
+
+void
+obs_data_release(obs_data_t *data) {
+    if (data == NULL || !g_atomic_int_dec_and_test(&data->ref_count))
+        return;
+    g_hash_table_destroy(data->values);
+    g_free(data);
+}
+
+static void
+data_set(obs_data_t *data, const char *name, ValueType type,
+         const char *string, long long integer) {
+    Value *value = g_new0(Value, 1);
+
+    value->type = type;
+    value->string = g_strdup(string);
+    value->integer = integer;
+    g_hash_table_insert(data->values, g_strdup(name), value);
+}
+
+const char *
+obs_data_get_string(obs_data_t *data, const char *name) {
+    Value *value = g_hash_table_lookup(data->values, name);
+
+    return value && value->string ? value->string : "";
+}
+
+long long
+obs_data_get_int(obs_data_t *data, const char *name) {
+    Value *value = g_hash_table_lookup(data->values, name);
+
+    return value ? value->integer : 0;
+}
+
+bool
+obs_data_get_bool(obs_data_t *data, const char *name) {
+    return obs_data_get_int(data, name) != 0;
+}
+
+void
+obs_data_set_string(obs_data_t *data, const char *name, const char *val) {
+    data_set(data, name, VALUE_STRING, val, 0);
+}
+
+void
+obs_data_set_int(obs_data_t *data, const char *name, long long val) {
+    data_set(data, name, VALUE_INT, NULL, val);
+}
+
+void
+obs_data_set_bool(obs_data_t *data, const char *name, bool val) {
+    data_set(data, name, VALUE_BOOL, NULL, val);
+}
+
+void
+obs_data_set_default_string(obs_data_t *data, const char *name, const char *val) {
+    if (!g_hash_table_contains(data->values, name)) {
+        obs_data_set_string(data, name, val);
+    }
+}
+
+void
+obs_data_set_default_bool(obs_data_t *data, const char *name, bool val) {
+    if (!g_hash_table_contains(data->values, name)) {
+        obs_data_set_bool(data, name, val);
+    }
+}
+
+void
+obs_data_set_default_int(obs_data_t *data, const char *name, long long val) {
+    if (!g_hash_table_contains(data->values, name)) {
+        obs_data_set_int(data, name, val);
+    }
+}
+
+static void
+property_free(obs_property_t *p) {
+    g_free(p->name);
+    g_ptr_array_unref(p->items);
+    g_free(p);
+}
+
+obs_properties_t *
+obs_properties_create(void) {
+    obs_properties_t *props = g_new0(obs_properties_t, 1);
+
+    props->props = g_ptr_array_new_with_free_func((GDestroyNotify)property_free);
+    return props;
+}
+
+void
+obs_properties_destroy(obs_properties_t *props) {
+    if (props == NULL) return;
+    g_ptr_array_unref(props->props);
+    g_free(props);
+}
+
+void
+obs_properties_set_flags(obs_properties_t *props, uint32_t flags) {
+    props->flags = flags;
+}
+
+obs_property_t *
+obs_properties_get(obs_properties_t *props, const char *property) {
+    guint i;
+
+    for (i = 0; i < props->props->len; i++) {
+        obs_property_t *p = g_ptr_array_index(props->props, i);
+
+        if (!strcmp(p->name, property))
+            return p;
+    }
+    return NULL;
+}
+
+static obs_property_t *
+properties_add(obs_properties_t *props, const char *name) {
+    obs_property_t *p = g_new0(obs_property_t, 1);
+
+    p->name = g_strdup(name);
+    p->items = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(props->props, p);
+    return p;
+}
+
+obs_property_t *
+obs_properties_add_bool(obs_properties_t *props, const char *name,
+                        const char *description) {
+    return properties_add(props, name);
+}
+
+obs_property_t *
+obs_properties_add_int(obs_properties_t *props, const char *name,
+                       const char *description, int min, int max, int step) {
+    return properties_add(props, name);
+}
+
+obs_property_t *
+obs_properties_add_text(obs_properties_t *props, const char *name,
+                        const char *description, enum obs_text_type type) {
+    return properties_add(props, name);
+}
+
+obs_property_t *
+obs_properties_add_list(obs_properties_t *props, const char *name,
+                        const char *description, enum obs_combo_type type,
+                        enum obs_combo_format format) {
+    return properties_add(props, name);
+}
+
+size_t
+obs_property_list_add_string(obs_property_t *p, const char *name,
+                             const char *val) {
+    g_ptr_array_add(p->items, g_strdup(val));
+    return p->items->len - 1;
+}
+
+void
+obs_property_list_item_disable(obs_property_t *p, size_t idx, bool disabled) {
+}
+
+void
+obs_property_int_set_suffix(obs_property_t *p, const char *suffix) {
+}
+
+void
+obs_property_set_long_description(obs_property_t *p, const char *long_description) {
+}
+
+obs_source_t *
+stub_source_new(const struct obs_source_info *info, obs_data_t *settings) {
+    obs_source_t *source = g_new0(obs_source_t, 1);
+
+    source->info = info;
+    source->settings = settings ? stub_data_ref(settings) : obs_data_create();
+    source->healthy = TRUE;
+    if (info) {
+        if (info->get_defaults) {
+            info->get_defaults(source->settings);
+        }
+        source->data = info->create(source->settings, source);
+    }
+    return source;
+}
+
+void
+stub_source_destroy(obs_source_t *source) {
+    if (source->info) {
+        source->info->destroy(source->data);
+    }
+    obs_data_release(source->settings);
+    g_free(source);
+}
+
+obs_source_t *
+obs_source_create_private(const char *id, const char *name, obs_data_t *settings) {
+    // Only rtsp_receiver_source is created this way, and it is
+    // simulated by the harness.
+    return stub_source_new(NULL, settings);
+}
+
+void
+obs_source_release(obs_source_t *source) {
+    if (source) {
+        stub_source_destroy(source);
+    }
+}
+
+void
+obs_source_remove(obs_source_t *source) {
+}
+
+void
+obs_source_update(obs_source_t *source, obs_data_t *settings) {
+    source->n_updates++;
+    if (source->info && source->info->update) {
+        source->info->update(source->data, settings);
+    }
+}
+
+void
+obs_source_update_properties(obs_source_t *source) {
+}
+
+bool
+obs_source_active(const obs_source_t *source) {
+    return source->active || source->active_children > 0;
+}
+
+bool
+obs_source_add_active_child(obs_source_t *parent, obs_source_t *child) {
+    child->active_children++;
+    return true;
+}
+
+void
+obs_source_remove_active_child(obs_source_t *parent, obs_source_t *child) {
+    child->active_children--;
+}
+
+uint32_t
+obs_source_get_width(obs_source_t *source) {
+    return 1920;
+}
+
+uint32_t
+obs_source_get_height(obs_source_t *source) {
+    return 1080;
+}
+
+void
+obs_source_video_render(obs_source_t *source) {
+}
+
+void *
+obs_obj_get_data(void *obj) {
+    return ((obs_source_t *)obj)->data;
+}
+
+uint64_t
+os_gettime_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool
+obs_source_enabled(const obs_source_t *source) {
+    return true;
+}
+
+const char *
+obs_source_get_unversioned_id(const obs_source_t *source) {
+    return source->info ? source->info->id : NULL;
+}
+
+obs_data_t *
+obs_source_get_settings(const obs_source_t *source) {
+    return stub_data_ref(source->settings);
+}
+
+void
+obs_source_enum_filters(obs_source_t *source,
+                        obs_source_enum_proc_t callback, void *param) {
+}
+
+bool
+obs_get_video_info(struct obs_video_info *ovi) {
+    memset(ovi, 0, sizeof(*ovi));
+    ovi->fps_num = 60;
+    ovi->fps_den = 1;
+    ovi->base_width = ovi->output_width = 1920;
+    ovi->base_height = ovi->output_height = 1080;
+    return true;
+}
+
+void
+stub_scene_add(obs_source_t *source, float scale) {
+    obs_sceneitem_t *item = g_new0(obs_sceneitem_t, 1);
+
+    if (stub_scene.items == NULL) {
+        stub_scene.items = g_ptr_array_new_with_free_func(g_free);
+    }
+    item->source = source;
+    item->scale = scale;
+    g_ptr_array_add(stub_scene.items, item);
+}
+
+void
+stub_scene_remove(obs_source_t *source) {
+    guint i;
+
+    for (i = 0; stub_scene.items && i < stub_scene.items->len; i++) {
+        obs_sceneitem_t *item = g_ptr_array_index(stub_scene.items, i);
+
+        if (item->source == source) {
+            g_ptr_array_remove_index(stub_scene.items, i);
+            break;
+        }
+    }
+}
+
+void
+obs_enum_scenes(bool (*enum_proc)(void *, obs_source_t *), void *param) {
+    enum_proc(param, &scene_source);
+}
+
+obs_scene_t *
+obs_scene_from_source(const obs_source_t *source) {
+    return source == &scene_source ? &stub_scene : NULL;
+}
+
+void
+obs_scene_enum_items(obs_scene_t *scene, obs_scene_enum_proc_t callback,
+                     void *param) {
+    guint i;
+
+    for (i = 0; scene->items && i < scene->items->len; i++) {
+        if (!callback(scene, g_ptr_array_index(scene->items, i), param))
+            break;
+    }
+}
+
+bool
+obs_sceneitem_visible(const obs_sceneitem_t *item) {
+    return true;
+}
+
+bool
+obs_sceneitem_is_group(obs_sceneitem_t *item) {
+    return false;
+}
+
+void
+obs_sceneitem_group_enum_items(obs_sceneitem_t *group,
+                               obs_scene_enum_proc_t callback, void *param) {
+}
+
+obs_source_t *
+obs_sceneitem_get_source(const obs_sceneitem_t *item) {
+    return item->source;
+}
+
+void
+obs_sceneitem_get_crop(const obs_sceneitem_t *item,
+                       struct obs_sceneitem_crop *crop) {
+    memset(crop, 0, sizeof(*crop));
+}
+
+void
+obs_sceneitem_get_draw_transform(const obs_sceneitem_t *item,
+                                 struct matrix4 *transform) {
+    memset(transform, 0, sizeof(*transform));
+    transform->x.x = item->scale;
+    transform->y.y = item->scale;
+    transform->z.z = 1.0f;
+    transform->t.w = 1.0f;
+}
+
+void
+gs_matrix_push(void) {
+}
+
+void
+gs_matrix_pop(void) {
+}
+
+void
+gs_matrix_translate3f(float x, float y, float z) {
+}
+
+void
+gs_matrix_scale3f(float x, float y, float z) {
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glib.h>
+#include <obs/obs.h>
+
+// Internals of the stub libobs, for the source harness to drive
+
+struct obs_source {
+    const struct obs_source_info *info;
+    void *data;
+    obs_data_t *settings;
+    gboolean active;
+    int active_children;
+
+    // Private children stand in for rtsp_receiver_source
+    guint64 frame_id;
+    gboolean healthy;
+    guint64 n_updates;
+};
+
+// Create a source of the given type, as obs_source_create() would
+obs_source_t *stub_source_new(const struct obs_source_info *info,
+                              obs_data_t *settings);
+void stub_source_destroy(obs_source_t *source);
+
+obs_data_t *stub_data_ref(obs_data_t *data);
+
+// The one scene, holding sources scaled by the given factor
+void stub_scene_add(obs_source_t *source, float scale);
+void stub_scene_remove(obs_source_t *source);
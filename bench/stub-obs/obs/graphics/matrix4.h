@@ -0,0 +1,9 @@
+#pragma once
+
+struct vec4 {
+    float x, y, z, w;
+};
+
+struct matrix4 {
+    struct vec4 x, y, z, t;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+// The subset of libobs used by source.c, for the source harness.
+// Declarations match libobs; behaviour is only as much as the
+// plugin needs.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graphics/matrix4.h"
+
+#define OBS_SOURCE_VIDEO (1 << 0)
+#define OBS_SOURCE_AUDIO (1 << 1)
+#define OBS_SOURCE_ASYNC (1 << 2)
+#define OBS_SOURCE_ASYNC_VIDEO (OBS_SOURCE_ASYNC | OBS_SOURCE_VIDEO)
+#define OBS_SOURCE_DO_NOT_DUPLICATE (1 << 7)
+#define OBS_SOURCE_CAP_DISABLED (1 << 10)
+
+#define OBS_PROPERTIES_DEFER_UPDATE (1 << 0)
+
+typedef struct obs_source obs_source_t;
+typedef struct obs_data obs_data_t;
+typedef struct obs_properties obs_properties_t;
+typedef struct obs_property obs_property_t;
+typedef struct gs_effect gs_effect_t;
+typedef struct obs_scene obs_scene_t;
+typedef struct obs_scene_item obs_sceneitem_t;
+
+enum obs_source_type {
+    OBS_SOURCE_TYPE_INPUT,
+    OBS_SOURCE_TYPE_FILTER,
+    OBS_SOURCE_TYPE_TRANSITION,
+    OBS_SOURCE_TYPE_SCENE,
+};
+
+enum obs_icon_type {
+    OBS_ICON_TYPE_UNKNOWN,
+    OBS_ICON_TYPE_MEDIA = 13,
+};
+
+enum obs_combo_type {
+    OBS_COMBO_TYPE_INVALID,
+    OBS_COMBO_TYPE_EDITABLE,
+    OBS_COMBO_TYPE_LIST,
+};
+
+enum obs_combo_format {
+    OBS_COMBO_FORMAT_INVALID,
+    OBS_COMBO_FORMAT_INT,
+    OBS_COMBO_FORMAT_FLOAT,
+    OBS_COMBO_FORMAT_STRING,
+};
+
+enum obs_text_type {
+    OBS_TEXT_DEFAULT,
+    OBS_TEXT_PASSWORD,
+    OBS_TEXT_MULTILINE,
+    OBS_TEXT_INFO,
+};
+
+struct obs_video_info {
+    const char *graphics_module;
+    uint32_t fps_num;
+    uint32_t fps_den;
+    uint32_t base_width;
+    uint32_t base_height;
+    uint32_t output_width;
+    uint32_t output_height;
+};
+
+struct obs_sceneitem_crop {
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+typedef bool (*obs_scene_enum_proc_t)(obs_scene_t *scene,
+                                      obs_sceneitem_t *item, void *param);
+
+typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
+                                       obs_source_t *child, void *param);
+
+struct obs_source_info {
+    const char *id;
+    enum obs_source_type type;
+    uint32_t output_flags;
+
+    const char *(*get_name)(void *type_data);
+    void *(*create)(obs_data_t *settings, obs_source_t *source);
+    void (*destroy)(void *data);
+    uint32_t (*get_width)(void *data);
+    uint32_t (*get_height)(void *data);
+    void (*get_defaults)(obs_data_t *settings);
+    obs_properties_t *(*get_properties)(void *data);
+    void (*update)(void *data, obs_data_t *settings);
+    void (*activate)(void *data);
+    void (*deactivate)(void *data);
+    void (*video_tick)(void *data, float seconds);
+    void (*video_render)(void *data, gs_effect_t *effect);
+    void (*enum_active_sources)(void *data, obs_source_enum_proc_t enum_callback,
+                                void *param);
+    void (*enum_all_sources)(void *data, obs_source_enum_proc_t enum_callback,
+                             void *param);
+    enum obs_icon_type icon_type;
+};
+
+obs_data_t *obs_data_create(void);
+void obs_data_release(obs_data_t *data);
+const char *obs_data_get_string(obs_data_t *data, const char *name);
+long long obs_data_get_int(obs_data_t *data, const char *name);
+bool obs_data_get_bool(obs_data_t *data, const char *name);
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val);
+void obs_data_set_int(obs_data_t *data, const char *name, long long val);
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val);
+void obs_data_set_default_string(obs_data_t *data, const char *name, const char *val);
+void obs_data_set_default_int(obs_data_t *data, const char *name, long long val);
+void obs_data_set_default_bool(obs_data_t *data, const char *name, bool val);
+
+obs_properties_t *obs_properties_create(void);
+void obs_properties_destroy(obs_properties_t *props);
+void obs_properties_set_flags(obs_properties_t *props, uint32_t flags);
+obs_property_t *obs_properties_get(obs_properties_t *props, const char *property);
+obs_property_t *obs_properties_add_bool(obs_properties_t *props, const char *name,
+                                        const char *description);
+obs_property_t *obs_properties_add_int(obs_properties_t *props, const char *name,
+                                       const char *description, int min, int max,
+                                       int step);
+obs_property_t *obs_properties_add_text(obs_properties_t *props, const char *name,
+                                        const char *description,
+                                        enum obs_text_type type);
+obs_property_t *obs_properties_add_list(obs_properties_t *props, const char *name,
+                                        const char *description,
+                                        enum obs_combo_type type,
+                                        enum obs_combo_format format);
+size_t obs_property_list_add_string(obs_property_t *p, const char *name,
+                                    const char *val);
+void obs_property_list_item_disable(obs_property_t *p, size_t idx, bool disabled);
+void obs_property_int_set_suffix(obs_property_t *p, const char *suffix);
+void obs_property_set_long_description(obs_property_t *p, const char *long_description);
+
+obs_source_t *obs_source_create_private(const char *id, const char *name,
+                                        obs_data_t *settings);
+void obs_source_release(obs_source_t *source);
+void obs_source_remove(obs_source_t *source);
+void obs_source_update(obs_source_t *source, obs_data_t *settings);
+void obs_source_update_properties(obs_source_t *source);
+bool obs_source_active(const obs_source_t *source);
+bool obs_source_add_active_child(obs_source_t *parent, obs_source_t *child);
+void obs_source_remove_active_child(obs_source_t *parent, obs_source_t *child);
+uint32_t obs_source_get_width(obs_source_t *source);
+uint32_t obs_source_get_height(obs_source_t *source);
+void obs_source_video_render(obs_source_t *source);
+void *obs_obj_get_data(void *obj);
+bool obs_source_enabled(const obs_source_t *source);
+const char *obs_source_get_unversioned_id(const obs_source_t *source);
+obs_data_t *obs_source_get_settings(const obs_source_t *source);
+void obs_source_enum_filters(obs_source_t *source,
+                             obs_source_enum_proc_t callback, void *param);
+
+bool obs_get_video_info(struct obs_video_info *ovi);
+void obs_enum_scenes(bool (*enum_proc)(void *, obs_source_t *), void *param);
+obs_scene_t *obs_scene_from_source(const obs_source_t *source);
+void obs_scene_enum_items(obs_scene_t *scene, obs_scene_enum_proc_t callback,
+                          void *param);
+bool obs_sceneitem_visible(const obs_sceneitem_t *item);
+bool obs_sceneitem_is_group(obs_sceneitem_t *item);
+void obs_sceneitem_group_enum_items(obs_sceneitem_t *group,
+                                    obs_scene_enum_proc_t callback, void *param);
+obs_source_t *obs_sceneitem_get_source(const obs_sceneitem_t *item);
+void obs_sceneitem_get_crop(const obs_sceneitem_t *item,
+                            struct obs_sceneitem_crop *crop);
+void obs_sceneitem_get_draw_transform(const obs_sceneitem_t *item,
+                                      struct matrix4 *transform);
+
+void gs_matrix_push(void);
+void gs_matrix_pop(void);
+void gs_matrix_translate3f(float x, float y, float z);
+void gs_matrix_scale3f(float x, float y, float z);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint64_t os_gettime_ns(void);
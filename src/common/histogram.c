@@ -0,0 +1,151 @@
+#include "histogram.h"
+
+#include <string.h>
+
+// Values below 2^SUB_BITS get their own bucket.  Above that, each
+// power of two range is split into 2^SUB_BITS buckets.
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_BITS 40
+#define N_BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+struct _Histogram {
+    GMutex lock;
+    guint64 count;
+    guint64 buckets[N_BUCKETS];
+};
+
+static guint
+bucket_index(gint64 value) {
+    guint msb, shift, index;
+
+    if (value < 0) value = 0;
+    if (value < SUB_COUNT) return value;
+
+    msb = g_bit_storage(value) - 1;
+    shift = msb - SUB_BITS;
+    index = (shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1));
+
+    return MIN(index, N_BUCKETS - 1);
+}
+
+static gint64
+bucket_midpoint(guint index) {
+    guint shift, sub;
+
+    if (index < SUB_COUNT) return index;
+
+    shift = index / SUB_COUNT - 1;
+    sub = index % SUB_COUNT;
+    return ((gint64)(SUB_COUNT + sub) << shift) + ((G_GINT64_CONSTANT(1) << shift) / 2);
+}
+
+Histogram *
+histogram_new(void) {
+    Histogram *hist = g_new0(Histogram, 1);
+
+    g_mutex_init(&hist->lock);
+
+    return hist;
+}
+
+void
+histogram_free(Histogram *hist) {
+    if (hist == NULL) return;
+
+    g_mutex_clear(&hist->lock);
+    g_free(hist);
+}
+
+void
+histogram_add(Histogram *hist, gint64 value) {
+    guint index = bucket_index(value);
+
+    g_mutex_lock(&hist->lock);
+    hist->buckets[index]++;
+    hist->count++;
+    g_mutex_unlock(&hist->lock);
+}
+
+void
+histogram_reset(Histogram *hist) {
+    g_mutex_lock(&hist->lock);
+    memset(hist->buckets, 0, sizeof(hist->buckets));
+    hist->count = 0;
+    g_mutex_unlock(&hist->lock);
+}
+
+guint64
+histogram_get_count(Histogram *hist) {
+    guint64 count;
+
+    g_mutex_lock(&hist->lock);
+    count = hist->count;
+    g_mutex_unlock(&hist->lock);
+
+    return count;
+}
+
+gint64
+histogram_get_percentile(Histogram *hist, double percentile) {
+    guint64 target, seen = 0;
+    gint64 value = 0;
+    guint i;
+
+    g_mutex_lock(&hist->lock);
+    if (hist->count == 0) goto out;
+
+    target = (guint64)(percentile * hist->count);
+    if (target == 0) target = 1;
+    if (target > hist->count) target = hist->count;
+
+    for (i = 0; i < N_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            value = bucket_midpoint(i);
+            break;
+        }
+    }
+
+out:
+    g_mutex_unlock(&hist->lock);
+    return value;
+}
+
+void
+histogram_format_bars(Histogram *hist, GString *out, guint n_rows,
+                      double scale) {
+    g_autofree guint64 *rows = g_new0(guint64, n_rows);
+    gint64 max_value;
+    guint64 max_count = 0, count;
+    guint i;
+
+    max_value = histogram_get_percentile(hist, 0.99);
+    if (max_value <= 0) return;
+
+    g_mutex_lock(&hist->lock);
+    count = hist->count;
+    for (i = 0; i < N_BUCKETS; i++) {
+        guint row;
+
+        if (hist->buckets[i] == 0) continue;
+        row = MIN(bucket_midpoint(i) * n_rows / (max_value + 1), n_rows - 1);
+        rows[row] += hist->buckets[i];
+    }
+    g_mutex_unlock(&hist->lock);
+
+    for (i = 0; i < n_rows; i++) {
+        max_count = MAX(max_count, rows[i]);
+    }
+
+    for (i = 0; i < n_rows; i++) {
+        guint width = max_count ? rows[i] * 40 / max_count : 0;
+        g_autofree char *bar = g_strnfill(width, '#');
+
+        g_string_append_printf(
+            out, "%7.1f-%-7.1f %5.1f%% %s\n",
+            (double)(max_value + 1) * i / n_rows / scale,
+            (double)(max_value + 1) * (i + 1) / n_rows / scale,
+            100.0 * rows[i] / count, bar);
+    }
+}
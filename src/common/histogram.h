@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glib.h>
+
+typedef struct _Histogram Histogram;
+
+// A thread safe log-linear histogram of non-negative values
+// (typically latencies in microseconds).  Buckets have roughly 6%
+// relative precision, which is plenty for percentile reporting.
+Histogram *histogram_new(void);
+void histogram_free(Histogram *hist);
+
+void histogram_add(Histogram *hist, gint64 value);
+void histogram_reset(Histogram *hist);
+
+guint64 histogram_get_count(Histogram *hist);
+gint64 histogram_get_percentile(Histogram *hist, double percentile);
+
+// Append a text bar chart of the distribution up to the 99th
+// percentile, with values divided by scale (e.g. 1000 for ms).
+void histogram_format_bars(Histogram *hist, GString *out, guint n_rows,
+                           double scale);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Histogram, histogram_free);
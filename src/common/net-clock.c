@@ -0,0 +1,82 @@
+#include "net-clock.h"
+
+#include <gst/net/net.h>
+#include <gio/gio.h>
+
+#include "ntp-time.h"
+
+#define DEFAULT_NTP_PORT 123
+
+// TAI was ahead of UTC by this many seconds as of 2017
+#define TAI_UTC_OFFSET 37
+
+static void
+clock_synced(GstClock *clock, gboolean synced, void *user_data) {
+    if (synced) {
+        g_message("Clock '%s' synchronised", GST_OBJECT_NAME(clock));
+    } else {
+        g_warning("Clock '%s' lost synchronisation", GST_OBJECT_NAME(clock));
+    }
+}
+
+GstClock *
+net_clock_new(const char *uri, GError **error) {
+    g_autoptr(GstClock) clock = NULL;
+    g_autofree char *scheme = NULL;
+    g_autofree char *host = NULL;
+    int port = -1;
+
+    if (uri == NULL || !g_strcmp0(uri, "system")) {
+        clock = g_object_new(GST_TYPE_SYSTEM_CLOCK,
+                             "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
+        return gst_object_ref_sink(g_steal_pointer(&clock));
+    }
+
+    if (!g_uri_split_network(uri, G_URI_FLAGS_NONE, &scheme, &host, &port, error))
+        return NULL;
+
+    if (!g_strcmp0(scheme, "ntp")) {
+        clock = gst_ntp_clock_new("ntp-clock", host,
+                                  port > 0 ? port : DEFAULT_NTP_PORT, 0);
+    } else if (!g_strcmp0(scheme, "ptp")) {
+        guint64 domain = g_ascii_strtoull(host, NULL, 10);
+
+        if (!gst_ptp_init(GST_PTP_CLOCK_ID_NONE, NULL)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                        "could not initialise PTP");
+            return NULL;
+        }
+        clock = gst_ptp_clock_new("ptp-clock", (guint)domain);
+    } else {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "unknown clock type '%s'", uri);
+        return NULL;
+    }
+
+    if (clock == NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "could not create clock for '%s'", uri);
+        return NULL;
+    }
+
+    // Don't hold up start up waiting for the first exchange
+    g_signal_connect(clock, "synced", G_CALLBACK(clock_synced), NULL);
+    if (!gst_clock_is_synced(clock)) {
+        g_message("Clock '%s' not synchronised yet, running unsynchronised until it is", uri);
+    }
+
+    return g_steal_pointer(&clock);
+}
+
+GstClockTime
+net_clock_to_ntp(GstClock *clock, GstClockTime time) {
+    if (GST_IS_NTP_CLOCK(clock)) {
+        // Already counts from the NTP epoch
+        return time;
+    } else if (GST_IS_PTP_CLOCK(clock)) {
+        // TAI since the Unix epoch
+        return time + (NTP_UNIX_OFFSET - TAI_UTC_OFFSET) * GST_SECOND;
+    } else {
+        return time + NTP_UNIX_OFFSET * GST_SECOND;
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Create the clock media pipelines are synchronised against.  uri
+// may be "system" (the real time system clock, which should be NTP
+// disciplined), "ntp://HOST[:PORT]" or "ptp://DOMAIN".  Network
+// clocks are returned at once and run unsynchronised until the first
+// exchange with their server completes.
+GstClock *net_clock_new(const char *uri, GError **error);
+
+// Convert a time on a clock created by net_clock_new() to
+// nanoseconds since the NTP epoch.
+GstClockTime net_clock_to_ntp(GstClock *clock, GstClockTime time);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <glib.h>
+
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+
+// Wall clock time in nanoseconds since the NTP epoch, as carried in
+// "timestamp/x-ntp" reference timestamp metas.
+static inline guint64
+ntp_time_now(void) {
+    return (guint64)g_get_real_time() * 1000 + NTP_UNIX_OFFSET * G_GUINT64_CONSTANT(1000000000);
+}
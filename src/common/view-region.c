@@ -0,0 +1,166 @@
+#include "view-region.h"
+
+#define META_NAME "ViewRegionMeta"
+#define WIRE_SIZE 12
+
+// An RTP header extension carrying a frame's ViewRegion as six
+// big-endian 16-bit values, so receivers can put scaled or cropped
+// frames back in place.
+typedef struct {
+    GstRTPHeaderExtension parent;
+} ViewRegionExt;
+
+typedef struct {
+    GstRTPHeaderExtensionClass parent_class;
+} ViewRegionExtClass;
+
+GType view_region_ext_get_type(void);
+G_DEFINE_TYPE(ViewRegionExt, view_region_ext, GST_TYPE_RTP_HEADER_EXTENSION);
+
+static GstRTPHeaderExtensionFlags
+view_region_ext_get_supported_flags(GstRTPHeaderExtension *ext) {
+    return GST_RTP_HEADER_EXTENSION_ONE_BYTE | GST_RTP_HEADER_EXTENSION_TWO_BYTE;
+}
+
+static gsize
+view_region_ext_get_max_size(GstRTPHeaderExtension *ext,
+                             const GstBuffer *input_meta) {
+    return WIRE_SIZE;
+}
+
+static gssize
+view_region_ext_write(GstRTPHeaderExtension *ext, const GstBuffer *input_meta,
+                      GstRTPHeaderExtensionFlags write_flags,
+                      GstBuffer *output, guint8 *data, gsize size) {
+    ViewRegion region;
+
+    // Frames outside an adapted pipeline carry nothing
+    if (!view_region_get_meta((GstBuffer *)input_meta, &region))
+        return 0;
+    g_return_val_if_fail(size >= WIRE_SIZE, -1);
+
+    GST_WRITE_UINT16_BE(data, region.full_width);
+    GST_WRITE_UINT16_BE(data + 2, region.full_height);
+    GST_WRITE_UINT16_BE(data + 4, region.x);
+    GST_WRITE_UINT16_BE(data + 6, region.y);
+    GST_WRITE_UINT16_BE(data + 8, region.width);
+    GST_WRITE_UINT16_BE(data + 10, region.height);
+    return WIRE_SIZE;
+}
+
+static gboolean
+view_region_ext_read(GstRTPHeaderExtension *ext,
+                     GstRTPHeaderExtensionFlags read_flags,
+                     const guint8 *data, gsize size, GstBuffer *buffer) {
+    ViewRegion region;
+
+    if (size < WIRE_SIZE)
+        return FALSE;
+
+    region.full_width = GST_READ_UINT16_BE(data);
+    region.full_height = GST_READ_UINT16_BE(data + 2);
+    region.x = GST_READ_UINT16_BE(data + 4);
+    region.y = GST_READ_UINT16_BE(data + 6);
+    region.width = GST_READ_UINT16_BE(data + 8);
+    region.height = GST_READ_UINT16_BE(data + 10);
+    if (region.width == 0 || region.height == 0 ||
+        region.x + region.width > region.full_width ||
+        region.y + region.height > region.full_height)
+        return FALSE;
+
+    view_region_add_meta(buffer, &region);
+    return TRUE;
+}
+
+static void
+view_region_ext_class_init(ViewRegionExtClass *klass) {
+    GstRTPHeaderExtensionClass *ext_class = GST_RTP_HEADER_EXTENSION_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+
+    ext_class->get_supported_flags = view_region_ext_get_supported_flags;
+    ext_class->get_max_size = view_region_ext_get_max_size;
+    ext_class->write = view_region_ext_write;
+    ext_class->read = view_region_ext_read;
+
+    gst_element_class_set_static_metadata(
+        element_class, "View region RTP header extension",
+        GST_RTP_HDREXT_ELEMENT_CLASS,
+        "Region of the camera's picture carried by each frame",
+        "obs-rtsp-source");
+    gst_rtp_header_extension_class_set_uri(ext_class, VIEW_REGION_URI);
+}
+
+static void
+view_region_ext_init(ViewRegionExt *ext) {
+}
+
+void
+view_region_init(void) {
+    static gsize initialised = 0;
+
+    if (g_once_init_enter(&initialised)) {
+        static const char *tags[] = { NULL };
+
+        gst_meta_register_custom(META_NAME, tags, NULL, NULL, NULL);
+        gst_element_register(NULL, "rtphdrextviewregion", GST_RANK_MARGINAL,
+                             view_region_ext_get_type());
+        g_once_init_leave(&initialised, 1);
+    }
+}
+
+GstRTPHeaderExtension *
+view_region_ext_new(void) {
+    GstRTPHeaderExtension *ext;
+
+    view_region_init();
+    ext = g_object_new(view_region_ext_get_type(), NULL);
+    gst_rtp_header_extension_set_id(ext, VIEW_REGION_ID);
+    return gst_object_ref_sink(ext);
+}
+
+void
+view_region_add_meta(GstBuffer *buffer, const ViewRegion *region) {
+    GstCustomMeta *meta = gst_buffer_add_custom_meta(buffer, META_NAME);
+
+    gst_structure_set(gst_custom_meta_get_structure(meta),
+                      "full-width", G_TYPE_UINT, region->full_width,
+                      "full-height", G_TYPE_UINT, region->full_height,
+                      "x", G_TYPE_UINT, region->x,
+                      "y", G_TYPE_UINT, region->y,
+                      "width", G_TYPE_UINT, region->width,
+                      "height", G_TYPE_UINT, region->height,
+                      NULL);
+}
+
+gboolean
+view_region_get_meta(GstBuffer *buffer, ViewRegion *region) {
+    GstCustomMeta *meta = gst_buffer_get_custom_meta(buffer, META_NAME);
+
+    if (meta == NULL)
+        return FALSE;
+    return view_region_from_structure(gst_custom_meta_get_structure(meta), region);
+}
+
+GstStructure *
+view_region_to_structure(const ViewRegion *region) {
+    return gst_structure_new("view-region",
+                             "full-width", G_TYPE_UINT, region->full_width,
+                             "full-height", G_TYPE_UINT, region->full_height,
+                             "x", G_TYPE_UINT, region->x,
+                             "y", G_TYPE_UINT, region->y,
+                             "width", G_TYPE_UINT, region->width,
+                             "height", G_TYPE_UINT, region->height,
+                             NULL);
+}
+
+gboolean
+view_region_from_structure(const GstStructure *s, ViewRegion *region) {
+    return gst_structure_get(s,
+                             "full-width", G_TYPE_UINT, &region->full_width,
+                             "full-height", G_TYPE_UINT, &region->full_height,
+                             "x", G_TYPE_UINT, &region->x,
+                             "y", G_TYPE_UINT, &region->y,
+                             "width", G_TYPE_UINT, &region->width,
+                             "height", G_TYPE_UINT, &region->height,
+                             NULL);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/rtp/rtp.h>
+
+#define VIEW_REGION_URI "urn:x-obs-rtsp-source:rtp-hdrext:view-region"
+#define VIEW_REGION_ID 2
+
+// The part of the camera's picture a frame carries, in the camera's
+// own pixels.  The frame itself may have been scaled down from
+// width x height.
+typedef struct {
+    guint full_width;
+    guint full_height;
+    guint x;
+    guint y;
+    guint width;
+    guint height;
+} ViewRegion;
+
+// Register the RTP header extension, so depayloaders pick it up from
+// the stream's extmap.
+void view_region_init(void);
+
+GstRTPHeaderExtension *view_region_ext_new(void);
+
+void view_region_add_meta(GstBuffer *buffer, const ViewRegion *region);
+gboolean view_region_get_meta(GstBuffer *buffer, ViewRegion *region);
+
+GstStructure *view_region_to_structure(const ViewRegion *region);
+gboolean view_region_from_structure(const GstStructure *s, ViewRegion *region);
@@ -0,0 +1,170 @@
+#include "mdns-backend.h"
+
+#include <avahi-client/client.h>
+#include <avahi-client/lookup.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/thread-watch.h>
+#include <avahi-common/error.h>
+
+#define MDNS_ERROR mdns_error_quark()
+G_DEFINE_QUARK(mdns-error-quark, mdns_error);
+
+typedef struct {
+    MdnsBackend parent;
+    MdnsBrowser *browser;
+
+    AvahiThreadedPoll *poll;
+    AvahiClient *client;
+    AvahiServiceBrowser *service_browser;
+} AvahiBackend;
+
+static void
+resolve_callback(AvahiServiceResolver *r,
+                 AvahiIfIndex interface, AvahiProtocol protocol,
+                 AvahiResolverEvent event, const char *name, const char *type,
+                 const char *domain, const char *host_name,
+                 const AvahiAddress *address, uint16_t port,
+                 AvahiStringList *txt, AvahiLookupResultFlags flags,
+                 void *user_data) {
+    AvahiBackend *backend = user_data;
+    char address_str[AVAHI_ADDRESS_STR_MAX];
+    const char *host = address_str;
+    AvahiStringList *path_entry;
+    char *path = NULL;
+
+    switch (event) {
+    case AVAHI_RESOLVER_FAILURE:
+        g_warning("Failed to resolve service '%s' of type '%s' in domain '%s': %s", name, type, domain, avahi_strerror(avahi_client_errno(backend->client)));
+        mdns_browser_service_failed(backend->browser, name);
+        break;
+
+    case AVAHI_RESOLVER_FOUND:
+        // Extract path from TXT data
+        path_entry = avahi_string_list_find(txt, "path");
+        if (path_entry) {
+            avahi_string_list_get_pair(path_entry, NULL, &path, NULL);
+        }
+        avahi_address_snprint(address_str, sizeof(address_str), address);
+        if (address->proto == AVAHI_PROTO_INET6 &&
+            address->data.ipv6.address[0] == 0xfe &&
+            (address->data.ipv6.address[1] & 0xc0) == 0x80) {
+            // Link-local addresses aren't usable without a scope
+            host = host_name;
+        }
+        mdns_browser_service_resolved(backend->browser, name, host, port,
+                                      path ? path : "/");
+        if (path) avahi_free(path);
+        break;
+    }
+    avahi_service_resolver_free(r);
+}
+
+static void
+browse_callback(AvahiServiceBrowser *b,
+                AvahiIfIndex interface, AvahiProtocol protocol,
+                AvahiBrowserEvent event, const char *name, const char *type,
+                const char *domain, AvahiLookupResultFlags flags,
+                void *user_data) {
+    AvahiBackend *backend = user_data;
+
+    switch (event) {
+    case AVAHI_BROWSER_FAILURE:
+        g_warning("Browser failure %s", avahi_strerror(avahi_client_errno(backend->client)));
+        avahi_threaded_poll_quit(backend->poll);
+        break;
+
+    case AVAHI_BROWSER_NEW:
+        if (mdns_browser_service_new(backend->browser, name)) {
+            AvahiServiceResolver *resolver = avahi_service_resolver_new(
+                backend->client, interface, protocol, name, type, domain,
+                AVAHI_PROTO_UNSPEC, 0, resolve_callback, backend);
+            if (resolver == NULL) {
+                g_warning("Failed to resolve service '%s': %s\n", name, avahi_strerror(avahi_client_errno(backend->client)));
+            }
+        }
+        break;
+
+    case AVAHI_BROWSER_REMOVE:
+        mdns_browser_service_removed(backend->browser, name);
+        break;
+
+    case AVAHI_BROWSER_ALL_FOR_NOW:
+        mdns_browser_all_for_now(backend->browser);
+        break;
+
+    case AVAHI_BROWSER_CACHE_EXHAUSTED:
+        // nothing
+        break;
+    }
+}
+
+static void
+client_callback(AvahiClient *c, AvahiClientState state, void *user_data) {
+    AvahiBackend *backend = user_data;
+
+    switch (state) {
+    case AVAHI_CLIENT_S_RUNNING:
+        g_clear_pointer(&backend->service_browser, avahi_service_browser_free);
+        backend->service_browser = avahi_service_browser_new(
+            c, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+            "_obs-source._sub._rtsp._tcp", NULL, 0, browse_callback, backend);
+        if (backend->service_browser == NULL) {
+            g_warning("could not create service browser: %s",
+                      avahi_strerror(avahi_client_errno(c)));
+            avahi_threaded_poll_quit(backend->poll);
+        }
+        break;
+
+    case AVAHI_CLIENT_FAILURE:
+        g_warning("Server connection failure: %s",
+                  avahi_strerror(avahi_client_errno(c)));
+        avahi_threaded_poll_quit(backend->poll);
+        break;
+
+    case AVAHI_CLIENT_S_REGISTERING:
+    case AVAHI_CLIENT_S_COLLISION:
+    case AVAHI_CLIENT_CONNECTING:
+        // nothing
+        break;
+    }
+}
+
+static void
+avahi_backend_free(MdnsBackend *parent) {
+    AvahiBackend *backend = (AvahiBackend *)parent;
+
+    if (backend->poll) {
+        avahi_threaded_poll_stop(backend->poll);
+    }
+    g_clear_pointer(&backend->service_browser, avahi_service_browser_free);
+    g_clear_pointer(&backend->client, avahi_client_free);
+    g_clear_pointer(&backend->poll, avahi_threaded_poll_free);
+    g_free(backend);
+}
+
+MdnsBackend *
+mdns_avahi_backend_new(MdnsBrowser *browser, GError **error) {
+    AvahiBackend *backend = g_new0(AvahiBackend, 1);
+    int avahi_error = 0;
+
+    backend->parent.free = avahi_backend_free;
+    backend->browser = browser;
+
+    backend->poll = avahi_threaded_poll_new();
+    backend->client = avahi_client_new(
+        avahi_threaded_poll_get(backend->poll),
+        AVAHI_CLIENT_NO_FAIL,
+        client_callback, backend,
+        &avahi_error);
+    if (backend->client == NULL) {
+        g_set_error(
+            error, MDNS_ERROR, 0,
+            "could not create Avahi client: %s", avahi_strerror(avahi_error));
+        avahi_backend_free(&backend->parent);
+        return NULL;
+    }
+
+    avahi_threaded_poll_start(backend->poll);
+
+    return &backend->parent;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glib.h>
+
+#include "mdns-browse.h"
+
+// A source of service announcements for MdnsBrowser.  Backends run
+// their own thread, and report what they see with the functions
+// below.
+struct _MdnsBackend {
+    void (*free)(MdnsBackend *backend);
+};
+
+// A service was announced.  Returns TRUE if it needs resolving.
+gboolean mdns_browser_service_new(MdnsBrowser *browser, const char *name);
+// host is a numeric address, or a host name if there is no usable one
+void mdns_browser_service_resolved(MdnsBrowser *browser, const char *name,
+                                   const char *host, guint16 port,
+                                   const char *path);
+// A service announced as needing resolving could not be resolved
+void mdns_browser_service_failed(MdnsBrowser *browser, const char *name);
+void mdns_browser_service_removed(MdnsBrowser *browser, const char *name);
+// The initial set of services has been announced
+void mdns_browser_all_for_now(MdnsBrowser *browser);
+
+MdnsBackend *mdns_avahi_backend_new(MdnsBrowser *browser, GError **error);
+
+// An in-process backend driven by the caller, for benchmarks.
+// Events are delivered in order from the backend's own thread.
+MdnsBackend *mdns_fake_backend_new(MdnsBrowser *browser, GError **error);
+void mdns_fake_backend_add(MdnsBackend *backend, const char *name,
+                           const char *host, guint16 port, const char *path);
+void mdns_fake_backend_remove(MdnsBackend *backend, const char *name);
+void mdns_fake_backend_all_for_now(MdnsBackend *backend);
+// Wait until all events so far have been delivered
+void mdns_fake_backend_flush(MdnsBackend *backend);
@@ -1,154 +1,340 @@
 #include "mdns-browse.h"
 
 #include <glib.h>
-#include <avahi-client/client.h>
-#include <avahi-client/lookup.h>
-#include <avahi-common/malloc.h>
-#include <avahi-common/thread-watch.h>
-#include <avahi-common/error.h>
-
-#define MDNS_ERROR mdns_error_quark()
-G_DEFINE_QUARK(mdns-error-quark, mdns_error);
+#include <string.h>
+#ifdef MDNS_BROWSER_STATS
+#include <time.h>
+#endif
+
+#include "mdns-backend.h"
+
+// Changes are written to the cache file once they have settled for
+// this long, in microseconds.
+#define SAVE_DELAY (2 * G_USEC_PER_SEC)
+// Cached services not resolved for this long, in seconds, are dropped
+#define CACHE_TTL (7 * 24 * 60 * 60)
+
+typedef struct {
+    char *address;
+    guint16 port;
+    char *path;
+    char *rtsp_uri;
+    // Wall clock seconds when last resolved on the network
+    gint64 seen;
+    // Loaded from the cache and not yet resolved on the network
+    gboolean stale;
+    gboolean announced;
+} Service;
 
 struct _MdnsBrowser {
-    AvahiThreadedPoll *poll;
-    AvahiClient *client;
-    AvahiServiceBrowser *service_browser;
+    MdnsBackend *backend;
 
+    GMutex lock;
     volatile gint stamp;
     GHashTable *services;
+
+    // Writes changes back to the cache file
+    char *cache_file;
+    GThread *save_thread;
+    GMutex save_lock;
+    GCond save_cond;
+    gboolean dirty;
+    gboolean quitting;
+
+#ifdef MDNS_BROWSER_STATS
+    Histogram *lock_hold;
+    gint64 locked_at;
+#endif
 };
 
+#ifdef MDNS_BROWSER_STATS
+static gint64
+get_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+#endif
+
 static void
-resolve_callback(AvahiServiceResolver *r,
-                 AvahiIfIndex interface, AvahiProtocol protocol,
-                 AvahiResolverEvent event, const char *name, const char *type,
-                 const char *domain, const char *host_name,
-                 const AvahiAddress *address, uint16_t port,
-                 AvahiStringList *txt, AvahiLookupResultFlags flags,
-                 void *user_data) {
-    MdnsBrowser *browser = user_data;
+mdns_browser_lock(MdnsBrowser *browser) {
+    g_mutex_lock(&browser->lock);
+#ifdef MDNS_BROWSER_STATS
+    browser->locked_at = get_time_ns();
+#endif
+}
 
-    switch (event) {
-    case AVAHI_RESOLVER_FAILURE:
-        g_warning("Failed to resolve service '%s' of type '%s' in domain '%s': %s", name, type, domain, avahi_strerror(avahi_client_errno(browser->client)));
-        break;
-
-    case AVAHI_RESOLVER_FOUND:
-        if (!g_hash_table_lookup(browser->services, name)) {
-            AvahiStringList *path_entry;
-            char *path = NULL;
-            char *rtsp_uri;
-
-            // Extract path from TXT data
-            path_entry = avahi_string_list_find(txt, "path");
-            if (path_entry) {
-                avahi_string_list_get_pair(path_entry, NULL, &path, NULL);
-            }
-            rtsp_uri = g_strdup_printf("rtsp://%s:%u%s", host_name, port,
-                                       path ? path : "/");
-            if (path) avahi_free(path);
-
-            g_hash_table_insert(browser->services, g_strdup(name), rtsp_uri);
-            g_atomic_int_inc(&browser->stamp);
-        }
-        break;
+static void
+mdns_browser_unlock(MdnsBrowser *browser) {
+#ifdef MDNS_BROWSER_STATS
+    histogram_add(browser->lock_hold, get_time_ns() - browser->locked_at);
+#endif
+    g_mutex_unlock(&browser->lock);
+}
+
+static Service *
+service_new(const char *address, guint16 port, const char *path) {
+    Service *service = g_new0(Service, 1);
+
+    service->address = g_strdup(address);
+    service->port = port;
+    service->path = g_strdup(path);
+    service->seen = g_get_real_time() / G_USEC_PER_SEC;
+    // A numeric address saves a host name lookup when connecting
+    if (strchr(address, ':')) {
+        service->rtsp_uri = g_strdup_printf("rtsp://[%s]:%u%s", address, port, path);
+    } else {
+        service->rtsp_uri = g_strdup_printf("rtsp://%s:%u%s", address, port, path);
     }
-    avahi_service_resolver_free(r);
+    return service;
 }
 
 static void
-browse_callback(AvahiServiceBrowser *b,
-                AvahiIfIndex interface, AvahiProtocol protocol,
-                AvahiBrowserEvent event, const char *name, const char *type,
-                const char *domain, AvahiLookupResultFlags flags,
-                void *user_data) {
-    MdnsBrowser *browser = user_data;
+service_free(Service *service) {
+    g_free(service->address);
+    g_free(service->path);
+    g_free(service->rtsp_uri);
+    g_free(service);
+}
 
-    switch (event) {
-    case AVAHI_BROWSER_FAILURE:
-        g_warning("Browser failure %s", avahi_strerror(avahi_client_errno(browser->client)));
-        avahi_threaded_poll_quit(browser->poll);
-        break;
-
-    case AVAHI_BROWSER_NEW:
-        if (!g_hash_table_lookup(browser->services, name)) {
-            AvahiServiceResolver *resolver = avahi_service_resolver_new(
-                browser->client, interface, protocol, name, type, domain,
-                AVAHI_PROTO_UNSPEC, 0, resolve_callback, browser);
-            if (resolver == NULL) {
-                g_warning("Failed to resolve service '%s': %s\n", name, avahi_strerror(avahi_client_errno(browser->client)));
-            }
+static void
+mdns_browser_load_cache(MdnsBrowser *browser, const char *cache_file) {
+    g_autoptr(GKeyFile) cache = g_key_file_new();
+    g_autoptr(GError) error = NULL;
+    g_auto(GStrv) names = NULL;
+    gint64 now;
+    int i;
+
+    if (!g_key_file_load_from_file(cache, cache_file, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_warning("Could not load %s: %s", cache_file, error->message);
         }
-        break;
+        return;
+    }
 
-    case AVAHI_BROWSER_REMOVE:
-        if (g_hash_table_lookup(browser->services, name)) {
-            g_hash_table_remove(browser->services, name);
-            g_atomic_int_inc(&browser->stamp);
+    now = g_get_real_time() / G_USEC_PER_SEC;
+    names = g_key_file_get_groups(cache, NULL);
+    for (i = 0; names[i] != NULL; i++) {
+        g_autofree char *address = g_key_file_get_string(cache, names[i], "address", NULL);
+        g_autofree char *path = g_key_file_get_string(cache, names[i], "path", NULL);
+        int port = g_key_file_get_integer(cache, names[i], "port", NULL);
+        gint64 seen = g_key_file_get_int64(cache, names[i], "seen", NULL);
+        Service *service;
+
+        if (address == NULL || path == NULL || port <= 0 || port > G_MAXUINT16)
+            continue;
+        // Entries from before "seen" was recorded count as expired
+        if (now - seen > CACHE_TTL)
+            continue;
+        service = service_new(address, port, path);
+        service->seen = seen;
+        service->stale = TRUE;
+        g_hash_table_insert(browser->services, g_strdup(names[i]), service);
+    }
+    g_message("Loaded %u cached services", g_hash_table_size(browser->services));
+}
+
+static gboolean
+mdns_browser_write_cache(MdnsBrowser *browser, GError **error) {
+    g_autoptr(GKeyFile) cache = g_key_file_new();
+    g_autofree char *dir = NULL;
+    GHashTableIter iter;
+    const char *name;
+    Service *service;
+
+    mdns_browser_lock(browser);
+    g_hash_table_iter_init(&iter, browser->services);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&name, (gpointer *)&service)) {
+        // Not representable as a group name
+        if (strpbrk(name, "[]\n") != NULL)
+            continue;
+        g_key_file_set_string(cache, name, "address", service->address);
+        g_key_file_set_integer(cache, name, "port", service->port);
+        g_key_file_set_string(cache, name, "path", service->path);
+        g_key_file_set_int64(cache, name, "seen", service->seen);
+    }
+    mdns_browser_unlock(browser);
+
+    dir = g_path_get_dirname(browser->cache_file);
+    g_mkdir_with_parents(dir, 0755);
+    return g_key_file_save_to_file(cache, browser->cache_file, error);
+}
+
+static void *
+mdns_browser_save_thread(void *user_data) {
+    MdnsBrowser *browser = user_data;
+    gint64 deadline;
+
+    g_mutex_lock(&browser->save_lock);
+    while (!browser->quitting || browser->dirty) {
+        g_autoptr(GError) error = NULL;
+
+        if (!browser->dirty) {
+            g_cond_wait(&browser->save_cond, &browser->save_lock);
+            continue;
         }
-        break;
 
-    case AVAHI_BROWSER_CACHE_EXHAUSTED:
-    case AVAHI_BROWSER_ALL_FOR_NOW:
-        // nothing
-        break;
+        // Let a burst of announcements settle first
+        deadline = g_get_monotonic_time() + SAVE_DELAY;
+        while (!browser->quitting &&
+               g_cond_wait_until(&browser->save_cond, &browser->save_lock, deadline));
+        browser->dirty = FALSE;
+
+        g_mutex_unlock(&browser->save_lock);
+        if (!mdns_browser_write_cache(browser, &error)) {
+            g_warning("Could not save discovered services: %s", error->message);
+        }
+        g_mutex_lock(&browser->save_lock);
     }
+    g_mutex_unlock(&browser->save_lock);
+
+    return NULL;
 }
 
+// Schedule the cache file to be rewritten
 static void
-client_callback(AvahiClient *c, AvahiClientState state, void *user_data) {
-    MdnsBrowser *browser = user_data;
+mdns_browser_changed(MdnsBrowser *browser) {
+    if (browser->save_thread == NULL) return;
+
+    g_mutex_lock(&browser->save_lock);
+    browser->dirty = TRUE;
+    g_cond_signal(&browser->save_cond);
+    g_mutex_unlock(&browser->save_lock);
+}
+
+gboolean
+mdns_browser_service_new(MdnsBrowser *browser, const char *name) {
+    Service *service;
+    gboolean resolve;
+
+    mdns_browser_lock(browser);
+    service = g_hash_table_lookup(browser->services, name);
+    if (service) {
+        service->announced = TRUE;
+    }
+    resolve = service == NULL || service->stale;
+    mdns_browser_unlock(browser);
 
-    switch (state) {
-    case AVAHI_CLIENT_S_RUNNING:
-        g_clear_pointer(&browser->service_browser, avahi_service_browser_free);
-        browser->service_browser = avahi_service_browser_new(
-            c, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-            "_obs-source._sub._rtsp._tcp", NULL, 0, browse_callback, browser);
-        if (browser->service_browser == NULL) {
-            g_warning("could not create service browser: %s",
-                      avahi_strerror(avahi_client_errno(c)));
-            avahi_threaded_poll_quit(browser->poll);
+    return resolve;
+}
+
+void
+mdns_browser_service_resolved(MdnsBrowser *browser, const char *name,
+                              const char *host, guint16 port,
+                              const char *path) {
+    Service *service, *old;
+    gboolean changed = FALSE;
+
+    // Build the entry before taking the lock
+    service = service_new(host, port, path);
+
+    mdns_browser_lock(browser);
+    old = g_hash_table_lookup(browser->services, name);
+    if (old == NULL || old->stale) {
+        // A confirmed cache entry needs no reconnection
+        if (old == NULL || g_strcmp0(old->rtsp_uri, service->rtsp_uri) != 0) {
+            g_atomic_int_inc(&browser->stamp);
         }
-        break;
+        g_hash_table_insert(browser->services, g_strdup(name),
+                            g_steal_pointer(&service));
+        changed = TRUE;
+    }
+    mdns_browser_unlock(browser);
+
+    g_clear_pointer(&service, service_free);
+    if (changed) {
+        mdns_browser_changed(browser);
+    }
+}
+
+void
+mdns_browser_service_failed(MdnsBrowser *browser, const char *name) {
+    Service *service;
+    gboolean removed = FALSE;
+
+    // A cached address that can't be confirmed is likely out of date
+    mdns_browser_lock(browser);
+    service = g_hash_table_lookup(browser->services, name);
+    if (service && service->stale) {
+        g_hash_table_remove(browser->services, name);
+        g_atomic_int_inc(&browser->stamp);
+        removed = TRUE;
+    }
+    mdns_browser_unlock(browser);
+
+    if (removed) {
+        mdns_browser_changed(browser);
+    }
+}
+
+void
+mdns_browser_service_removed(MdnsBrowser *browser, const char *name) {
+    gboolean removed;
 
-    case AVAHI_CLIENT_FAILURE:
-        g_warning("Server connection failure: %s",
-                  avahi_strerror(avahi_client_errno(c)));
-        avahi_threaded_poll_quit(browser->poll);
-        break;
+    mdns_browser_lock(browser);
+    removed = g_hash_table_remove(browser->services, name);
+    if (removed) {
+        g_atomic_int_inc(&browser->stamp);
+    }
+    mdns_browser_unlock(browser);
 
-    case AVAHI_CLIENT_S_REGISTERING:
-    case AVAHI_CLIENT_S_COLLISION:
-    case AVAHI_CLIENT_CONNECTING:
-        // nothing
-        break;
+    if (removed) {
+        mdns_browser_changed(browser);
+    }
+}
+
+void
+mdns_browser_all_for_now(MdnsBrowser *browser) {
+    GHashTableIter iter;
+    Service *service;
+    gboolean removed = FALSE;
+
+    // Cached services that weren't announced have gone
+    mdns_browser_lock(browser);
+    g_hash_table_iter_init(&iter, browser->services);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&service)) {
+        if (service->stale && !service->announced) {
+            g_hash_table_iter_remove(&iter);
+            g_atomic_int_inc(&browser->stamp);
+            removed = TRUE;
+        }
+    }
+    mdns_browser_unlock(browser);
+
+    if (removed) {
+        mdns_browser_changed(browser);
     }
 }
 
 MdnsBrowser *
-mdns_browser_new(GError **error) {
+mdns_browser_new(const char *cache_file, GError **error) {
+    return mdns_browser_new_full(cache_file, mdns_avahi_backend_new, error);
+}
+
+MdnsBrowser *
+mdns_browser_new_full(const char *cache_file, MdnsBackendNew backend_new,
+                      GError **error) {
     g_autoptr(MdnsBrowser) browser = g_new0(MdnsBrowser, 1);
-    int avahi_error = 0;
 
+    g_mutex_init(&browser->lock);
+    g_mutex_init(&browser->save_lock);
+    g_cond_init(&browser->save_cond);
     browser->services = g_hash_table_new_full(
-        g_str_hash, g_str_equal, g_free, g_free);
-
-    browser->poll = avahi_threaded_poll_new();
-    browser->client = avahi_client_new(
-        avahi_threaded_poll_get(browser->poll),
-        AVAHI_CLIENT_NO_FAIL,
-        client_callback, browser,
-        &avahi_error);
-    if (browser->client == NULL) {
-        g_set_error(
-            error, MDNS_ERROR, 0,
-            "could not create Avahi client: %s", avahi_strerror(avahi_error));
-        return NULL;
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify)service_free);
+#ifdef MDNS_BROWSER_STATS
+    browser->lock_hold = histogram_new();
+#endif
+    if (cache_file) {
+        browser->cache_file = g_strdup(cache_file);
+        mdns_browser_load_cache(browser, cache_file);
+        browser->save_thread = g_thread_new(
+            "mdns-cache", mdns_browser_save_thread, browser);
     }
 
-    avahi_threaded_poll_start(browser->poll);
+    browser->backend = backend_new(browser, error);
+    if (browser->backend == NULL)
+        return NULL;
 
     return g_steal_pointer(&browser);
 }
@@ -157,16 +343,41 @@ void
 mdns_browser_free(MdnsBrowser *browser) {
     if (browser == NULL) return;
 
-    if (browser->poll) {
-        avahi_threaded_poll_stop(browser->poll);
+    // Stop the backend's thread first, so no more events arrive
+    if (browser->backend) {
+        browser->backend->free(browser->backend);
     }
+    // Then write out any changes still waiting
+    if (browser->save_thread) {
+        g_mutex_lock(&browser->save_lock);
+        browser->quitting = TRUE;
+        g_cond_signal(&browser->save_cond);
+        g_mutex_unlock(&browser->save_lock);
+        g_thread_join(browser->save_thread);
+    }
+    g_clear_pointer(&browser->cache_file, g_free);
     g_clear_pointer(&browser->services, g_hash_table_destroy);
-    g_clear_pointer(&browser->service_browser, avahi_service_browser_free);
-    g_clear_pointer(&browser->client, avahi_client_free);
-    g_clear_pointer(&browser->poll, avahi_threaded_poll_free);
+#ifdef MDNS_BROWSER_STATS
+    g_clear_pointer(&browser->lock_hold, histogram_free);
+#endif
+    g_cond_clear(&browser->save_cond);
+    g_mutex_clear(&browser->save_lock);
+    g_mutex_clear(&browser->lock);
     g_free(browser);
 }
 
+MdnsBackend *
+mdns_browser_get_backend(MdnsBrowser *browser) {
+    return browser->backend;
+}
+
+#ifdef MDNS_BROWSER_STATS
+Histogram *
+mdns_browser_get_lock_stats(MdnsBrowser *browser) {
+    return browser->lock_hold;
+}
+#endif
+
 gint
 mdns_browser_get_stamp(MdnsBrowser *browser) {
     return g_atomic_int_get(&browser->stamp);
@@ -174,14 +385,18 @@ mdns_browser_get_stamp(MdnsBrowser *browser) {
 
 char *
 mdns_browser_get_uri(MdnsBrowser *browser, const char *name, gint *stamp) {
+    Service *service;
     char *rtsp_uri = NULL;
 
-    avahi_threaded_poll_lock(browser->poll);
-    rtsp_uri = g_strdup(g_hash_table_lookup(browser->services, name));
+    mdns_browser_lock(browser);
+    service = g_hash_table_lookup(browser->services, name);
+    if (service) {
+        rtsp_uri = g_strdup(service->rtsp_uri);
+    }
     if (stamp) {
         *stamp = g_atomic_int_get(&browser->stamp);
     }
-    avahi_threaded_poll_unlock(browser->poll);
+    mdns_browser_unlock(browser);
 
     return rtsp_uri;
 }
@@ -201,14 +416,14 @@ mdns_browser_get_available(MdnsBrowser *browser) {
     int i = 0;
     const char *name;
 
-    avahi_threaded_poll_lock(browser->poll);
+    mdns_browser_lock(browser);
     // Copy hash table keys to NULL terminated array
     names = g_new0(char *, g_hash_table_size(browser->services) + 1);
     g_hash_table_iter_init(&iter, browser->services);
     while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL)) {
         names[i++] = g_strdup(name);
     }
-    avahi_threaded_poll_unlock(browser->poll);
+    mdns_browser_unlock(browser);
 
     g_qsort_with_data(names, i, sizeof(char *), name_compare, NULL);
 
@@ -2,15 +2,39 @@
 
 #include <glib.h>
 
+#ifdef MDNS_BROWSER_STATS
+#include "histogram.h"
+#endif
+
 typedef struct _MdnsBrowser MdnsBrowser;
+typedef struct _MdnsBackend MdnsBackend;
+
+typedef MdnsBackend *(*MdnsBackendNew)(MdnsBrowser *browser, GError **error);
 
-MdnsBrowser *mdns_browser_new(GError **error);
+// The browser starts out with the services recorded in cache_file,
+// if given, so streams can be connected before they are announced.
+// Cached services that aren't announced in the first full browse, or
+// fail to resolve, are dropped again, as are any not seen for a week.
+// The file is rewritten shortly after services are resolved or go
+// away, and when the browser is freed.
+MdnsBrowser *mdns_browser_new(const char *cache_file, GError **error);
+// As above, with services announced by a backend other than Avahi
+MdnsBrowser *mdns_browser_new_full(const char *cache_file,
+                                   MdnsBackendNew backend_new,
+                                   GError **error);
 void mdns_browser_free(MdnsBrowser *browser);
 
+MdnsBackend *mdns_browser_get_backend(MdnsBrowser *browser);
+
 // stamp is incremented whenever the browser state changes.  This
 // gives a quick way to quickly check if anything has changed.
 gint mdns_browser_get_stamp(MdnsBrowser *browser);
 char *mdns_browser_get_uri(MdnsBrowser *browser, const char *name, gint *stamp);
 GStrv mdns_browser_get_available(MdnsBrowser *browser);
 
+#ifdef MDNS_BROWSER_STATS
+// How long the lock has been held each time, in nanoseconds
+Histogram *mdns_browser_get_lock_stats(MdnsBrowser *browser);
+#endif
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(MdnsBrowser, mdns_browser_free);
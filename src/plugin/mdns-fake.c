@@ -0,0 +1,154 @@
+#include "mdns-backend.h"
+
+typedef enum {
+    EVENT_ADD,
+    EVENT_REMOVE,
+    EVENT_ALL_FOR_NOW,
+    EVENT_FLUSH,
+    EVENT_QUIT,
+} EventType;
+
+typedef struct {
+    EventType type;
+    char *name;
+    char *host;
+    guint16 port;
+    char *path;
+} Event;
+
+typedef struct {
+    MdnsBackend parent;
+    MdnsBrowser *browser;
+
+    GThread *thread;
+    GAsyncQueue *events;
+
+    GMutex flush_lock;
+    GCond flush_cond;
+    guint64 n_flushed;
+} FakeBackend;
+
+static void
+event_free(Event *event) {
+    g_free(event->name);
+    g_free(event->host);
+    g_free(event->path);
+    g_free(event);
+}
+
+static void
+fake_backend_push(FakeBackend *backend, EventType type, const char *name,
+                  const char *host, guint16 port, const char *path) {
+    Event *event = g_new0(Event, 1);
+
+    event->type = type;
+    event->name = g_strdup(name);
+    event->host = g_strdup(host);
+    event->port = port;
+    event->path = g_strdup(path);
+    g_async_queue_push(backend->events, event);
+}
+
+static void *
+fake_backend_thread(void *user_data) {
+    FakeBackend *backend = user_data;
+    gboolean running = TRUE;
+
+    while (running) {
+        Event *event = g_async_queue_pop(backend->events);
+
+        switch (event->type) {
+        case EVENT_ADD:
+            // Resolving happens straight away, as if the TXT and
+            // address records came with the announcement.
+            if (mdns_browser_service_new(backend->browser, event->name)) {
+                mdns_browser_service_resolved(backend->browser, event->name,
+                                              event->host, event->port,
+                                              event->path);
+            }
+            break;
+
+        case EVENT_REMOVE:
+            mdns_browser_service_removed(backend->browser, event->name);
+            break;
+
+        case EVENT_ALL_FOR_NOW:
+            mdns_browser_all_for_now(backend->browser);
+            break;
+
+        case EVENT_FLUSH:
+            g_mutex_lock(&backend->flush_lock);
+            backend->n_flushed++;
+            g_cond_broadcast(&backend->flush_cond);
+            g_mutex_unlock(&backend->flush_lock);
+            break;
+
+        case EVENT_QUIT:
+            running = FALSE;
+            break;
+        }
+        event_free(event);
+    }
+
+    return NULL;
+}
+
+static void
+fake_backend_free(MdnsBackend *parent) {
+    FakeBackend *backend = (FakeBackend *)parent;
+
+    fake_backend_push(backend, EVENT_QUIT, NULL, NULL, 0, NULL);
+    g_thread_join(backend->thread);
+    g_async_queue_unref(backend->events);
+    g_mutex_clear(&backend->flush_lock);
+    g_cond_clear(&backend->flush_cond);
+    g_free(backend);
+}
+
+MdnsBackend *
+mdns_fake_backend_new(MdnsBrowser *browser, GError **error) {
+    FakeBackend *backend = g_new0(FakeBackend, 1);
+
+    backend->parent.free = fake_backend_free;
+    backend->browser = browser;
+    backend->events = g_async_queue_new_full((GDestroyNotify)event_free);
+    g_mutex_init(&backend->flush_lock);
+    g_cond_init(&backend->flush_cond);
+    backend->thread = g_thread_new("mdns-fake", fake_backend_thread, backend);
+
+    return &backend->parent;
+}
+
+void
+mdns_fake_backend_add(MdnsBackend *backend, const char *name,
+                      const char *host, guint16 port, const char *path) {
+    fake_backend_push((FakeBackend *)backend, EVENT_ADD, name, host, port, path);
+}
+
+void
+mdns_fake_backend_remove(MdnsBackend *backend, const char *name) {
+    fake_backend_push((FakeBackend *)backend, EVENT_REMOVE, name, NULL, 0, NULL);
+}
+
+void
+mdns_fake_backend_all_for_now(MdnsBackend *backend) {
+    fake_backend_push((FakeBackend *)backend, EVENT_ALL_FOR_NOW, NULL, NULL, 0, NULL);
+}
+
+void
+mdns_fake_backend_flush(MdnsBackend *parent) {
+    FakeBackend *backend = (FakeBackend *)parent;
+    guint64 target;
+
+    g_mutex_lock(&backend->flush_lock);
+    target = backend->n_flushed + 1;
+    g_mutex_unlock(&backend->flush_lock);
+
+    fake_backend_push(backend, EVENT_FLUSH, NULL, NULL, 0, NULL);
+
+    g_mutex_lock(&backend->flush_lock);
+    while (backend->n_flushed < target) {
+        g_cond_wait(&backend->flush_cond, &backend->flush_lock);
+    }
+    g_mutex_unlock(&backend->flush_lock);
+}
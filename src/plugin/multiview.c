@@ -0,0 +1,420 @@
+#include "multiview.h"
+#include <glib.h>
+#include <math.h>
+
+#include "mdns-browse.h"
+#include "receiver-source.h"
+
+extern MdnsBrowser *mdns_browser;
+
+struct multiview_tile {
+    char *name;
+    char *rtsp_url;
+    obs_source_t *source;
+};
+
+struct multiview_source {
+    obs_source_t *source;
+
+    // Settings
+    int width;
+    int height;
+    int columns;
+    int tile_fps;
+    bool hw_decode;
+    gint last_stamp;
+
+    bool active;
+    bool showing;
+    // One per discovered service, in name order
+    GPtrArray *tiles;
+};
+
+static void
+multiview_tile_free(struct multiview_tile *tile) {
+    obs_source_remove(tile->source);
+    obs_source_release(tile->source);
+    g_free(tile->name);
+    g_free(tile->rtsp_url);
+    g_free(tile);
+}
+
+static const char *
+multiview_source_get_name(void *user_data) {
+    return "Remote Multiview";
+}
+
+static void
+multiview_source_get_grid(struct multiview_source *mv, guint *columns,
+                          guint *rows) {
+    guint count = MAX(mv->tiles->len, 1);
+
+    *columns = mv->columns > 0 ? (guint)mv->columns : (guint)ceil(sqrt(count));
+    *rows = (count + *columns - 1) / *columns;
+}
+
+static void
+multiview_source_update_tile(struct multiview_source *mv,
+                             struct multiview_tile *tile) {
+    obs_data_t *settings;
+
+    settings = obs_data_create();
+    obs_data_set_string(settings, "rtsp_url", tile->rtsp_url ? tile->rtsp_url : "");
+    obs_data_set_bool(settings, "hw_decode", mv->hw_decode);
+    obs_data_set_int(settings, "max_fps", mv->tile_fps);
+
+    obs_source_update(tile->source, settings);
+
+    obs_data_release(settings);
+}
+
+// Ask each sender for the cheapest rendition that fills a tile: the
+// whole picture, scaled down to the tile and at the tile's frame rate.
+// Senders without adapt-view send their full stream, which the
+// receiver then thins out.
+static void
+multiview_source_update_views(struct multiview_source *mv) {
+    g_autofree char *view = NULL;
+    guint columns, rows, i;
+
+    multiview_source_get_grid(mv, &columns, &rows);
+    view = g_strdup_printf("size=%ux%u fps=%d/1", mv->width / columns,
+                           mv->height / rows, mv->tile_fps);
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        receiver_source_set_view(tile->source, view);
+    }
+}
+
+static struct multiview_tile *
+multiview_source_add_tile(struct multiview_source *mv, const char *name) {
+    struct multiview_tile *tile = g_new0(struct multiview_tile, 1);
+
+    tile->name = g_strdup(name);
+    tile->source = obs_source_create_private("rtsp_receiver_source", name, NULL);
+    // Nothing is decoded while the multiview isn't on screen
+    receiver_source_set_standby(tile->source, !mv->showing);
+    if (mv->active) {
+        obs_source_add_active_child(mv->source, tile->source);
+    }
+    return tile;
+}
+
+static void
+multiview_source_update_tiles(struct multiview_source *mv) {
+    g_auto(GStrv) names = NULL;
+    GPtrArray *tiles;
+    bool changed = false;
+    guint i, j;
+
+    // Read the stamp first, so later changes are picked up next tick
+    mv->last_stamp = mdns_browser_get_stamp(mdns_browser);
+    names = mdns_browser_get_available(mdns_browser);
+
+    tiles = g_ptr_array_new_with_free_func((GDestroyNotify)multiview_tile_free);
+    for (i = 0; names[i] != NULL; i++) {
+        struct multiview_tile *tile = NULL;
+        g_autofree char *rtsp_url = NULL;
+        bool added = false;
+
+        for (j = 0; j < mv->tiles->len; j++) {
+            struct multiview_tile *old = g_ptr_array_index(mv->tiles, j);
+
+            if (!g_strcmp0(old->name, names[i])) {
+                tile = g_ptr_array_steal_index(mv->tiles, j);
+                break;
+            }
+        }
+        if (tile == NULL) {
+            tile = multiview_source_add_tile(mv, names[i]);
+            added = changed = true;
+        }
+
+        rtsp_url = mdns_browser_get_uri(mdns_browser, names[i], NULL);
+        if (g_strcmp0(rtsp_url, tile->rtsp_url) != 0 || added) {
+            g_free(tile->rtsp_url);
+            tile->rtsp_url = g_steal_pointer(&rtsp_url);
+            multiview_source_update_tile(mv, tile);
+        }
+        g_ptr_array_add(tiles, tile);
+    }
+
+    // Whatever is left has gone from the network
+    for (j = 0; j < mv->tiles->len; j++) {
+        struct multiview_tile *old = g_ptr_array_index(mv->tiles, j);
+
+        if (mv->active) {
+            obs_source_remove_active_child(mv->source, old->source);
+        }
+        changed = true;
+    }
+    g_ptr_array_unref(mv->tiles);
+    mv->tiles = tiles;
+
+    if (changed) {
+        multiview_source_update_views(mv);
+    }
+}
+
+static void
+multiview_source_update(void *user_data, obs_data_t *settings) {
+    struct multiview_source *mv = user_data;
+    bool hw_decode = obs_data_get_bool(settings, "hw_decode");
+    int tile_fps = (int)obs_data_get_int(settings, "tile_fps");
+    guint i;
+
+    mv->width = (int)obs_data_get_int(settings, "width");
+    mv->height = (int)obs_data_get_int(settings, "height");
+    mv->columns = (int)obs_data_get_int(settings, "columns");
+
+    if (hw_decode != mv->hw_decode || tile_fps != mv->tile_fps) {
+        mv->hw_decode = hw_decode;
+        mv->tile_fps = tile_fps;
+        for (i = 0; i < mv->tiles->len; i++) {
+            multiview_source_update_tile(mv, g_ptr_array_index(mv->tiles, i));
+        }
+    }
+    multiview_source_update_views(mv);
+}
+
+static void *
+multiview_source_create(obs_data_t *settings, obs_source_t *source) {
+    struct multiview_source *mv = g_new0(struct multiview_source, 1);
+
+    mv->source = source;
+    mv->tiles = g_ptr_array_new_with_free_func((GDestroyNotify)multiview_tile_free);
+    multiview_source_update(mv, settings);
+    if (mdns_browser) {
+        multiview_source_update_tiles(mv);
+    }
+
+    return mv;
+}
+
+static void
+multiview_source_destroy(void *user_data) {
+    struct multiview_source *mv = user_data;
+
+    g_clear_pointer(&mv->tiles, g_ptr_array_unref);
+
+    g_free(mv);
+}
+
+static void
+multiview_source_get_defaults(obs_data_t *settings) {
+    obs_data_set_default_int(settings, "width", 1920);
+    obs_data_set_default_int(settings, "height", 1080);
+    obs_data_set_default_int(settings, "columns", 0);
+    obs_data_set_default_int(settings, "tile_fps", 10);
+}
+
+static obs_properties_t *
+multiview_source_get_properties(void *user_data) {
+    struct multiview_source *mv = user_data;
+    obs_properties_t *props;
+    obs_property_t *prop;
+    g_autofree char *status = NULL;
+
+    props = obs_properties_create();
+    obs_properties_set_flags(props, OBS_PROPERTIES_DEFER_UPDATE);
+
+    obs_properties_add_int(props, "width", "Width", 16, 7680, 2);
+    obs_properties_add_int(props, "height", "Height", 16, 4320, 2);
+
+    prop = obs_properties_add_int(props, "columns", "Columns", 0, 16, 1);
+    obs_property_set_long_description(
+        prop, "0 picks a square grid for the number of cameras.");
+
+    prop = obs_properties_add_int(props, "tile_fps", "Tile frame rate", 1, 60, 1);
+    obs_property_int_set_suffix(prop, " fps");
+    obs_property_set_long_description(
+        prop, "Senders with adapt-view scale their stream down to the tile "
+        "at this rate.  Other streams are decoded in full, but only this "
+        "many frames a second are converted and shown.");
+
+    obs_properties_add_bool(props, "hw_decode",
+                            "Use hardware decoding when available");
+
+    status = g_strdup_printf("Showing %u cameras", mv->tiles->len);
+    obs_properties_add_text(props, "tile_status", status, OBS_TEXT_INFO);
+
+    return props;
+}
+
+static uint32_t
+multiview_source_get_width(void *user_data) {
+    struct multiview_source *mv = user_data;
+
+    return (uint32_t)mv->width;
+}
+
+static uint32_t
+multiview_source_get_height(void *user_data) {
+    struct multiview_source *mv = user_data;
+
+    return (uint32_t)mv->height;
+}
+
+static void
+multiview_source_activate(void *user_data) {
+    struct multiview_source *mv = user_data;
+    guint i;
+
+    mv->active = true;
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        obs_source_add_active_child(mv->source, tile->source);
+    }
+}
+
+static void
+multiview_source_deactivate(void *user_data) {
+    struct multiview_source *mv = user_data;
+    guint i;
+
+    mv->active = false;
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        obs_source_remove_active_child(mv->source, tile->source);
+    }
+}
+
+static void
+multiview_source_set_showing(struct multiview_source *mv, bool showing) {
+    guint i;
+
+    mv->showing = showing;
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        receiver_source_set_standby(tile->source, !showing);
+    }
+}
+
+static void
+multiview_source_show(void *user_data) {
+    multiview_source_set_showing(user_data, true);
+}
+
+static void
+multiview_source_hide(void *user_data) {
+    multiview_source_set_showing(user_data, false);
+}
+
+static void
+multiview_source_video_tick(void *user_data, float seconds) {
+    struct multiview_source *mv = user_data;
+
+    if (mdns_browser && mdns_browser_get_stamp(mdns_browser) != mv->last_stamp) {
+        multiview_source_update_tiles(mv);
+        obs_source_update_properties(mv->source);
+    }
+}
+
+static void
+multiview_source_enum_active_sources(void *user_data,
+                                     obs_source_enum_proc_t enum_callback,
+                                     void *param) {
+    struct multiview_source *mv = user_data;
+    guint i;
+
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        if (obs_source_active(tile->source))
+            enum_callback(mv->source, tile->source, param);
+    }
+}
+
+static void
+multiview_source_enum_all_sources(void *user_data,
+                                  obs_source_enum_proc_t enum_callback,
+                                  void *param) {
+    struct multiview_source *mv = user_data;
+    guint i;
+
+    for (i = 0; i < mv->tiles->len; i++) {
+        struct multiview_tile *tile = g_ptr_array_index(mv->tiles, i);
+
+        enum_callback(mv->source, tile->source, param);
+    }
+}
+
+// Fit the camera's full picture in the cell, keeping its aspect ratio,
+// and put a cropped or scaled frame back in its place within it.
+static void
+multiview_render_tile(struct multiview_tile *tile, float x, float y,
+                      float cell_width, float cell_height) {
+    uint32_t width = obs_source_get_width(tile->source);
+    uint32_t height = obs_source_get_height(tile->source);
+    ViewRegion region;
+    float scale;
+
+    if (width == 0 || height == 0)
+        return;
+    if (!receiver_source_get_region(tile->source, &region)) {
+        region.full_width = region.width = width;
+        region.full_height = region.height = height;
+        region.x = region.y = 0;
+    }
+
+    scale = fminf(cell_width / region.full_width, cell_height / region.full_height);
+    x += (cell_width - region.full_width * scale) / 2 + region.x * scale;
+    y += (cell_height - region.full_height * scale) / 2 + region.y * scale;
+
+    gs_matrix_push();
+    gs_matrix_translate3f(x, y, 0.0f);
+    gs_matrix_scale3f(region.width * scale / width,
+                      region.height * scale / height, 1.0f);
+    obs_source_video_render(tile->source);
+    gs_matrix_pop();
+}
+
+static void
+multiview_source_video_render(void *user_data, gs_effect_t *effect) {
+    struct multiview_source *mv = user_data;
+    float cell_width, cell_height;
+    guint columns, rows, i;
+
+    multiview_source_get_grid(mv, &columns, &rows);
+    cell_width = (float)mv->width / columns;
+    cell_height = (float)mv->height / rows;
+    for (i = 0; i < mv->tiles->len; i++) {
+        multiview_render_tile(g_ptr_array_index(mv->tiles, i),
+                              (i % columns) * cell_width,
+                              (i / columns) * cell_height,
+                              cell_width, cell_height);
+    }
+}
+
+struct obs_source_info multiview_source = {
+    .id = "rtsp_multiview_source",
+    .type = OBS_SOURCE_TYPE_INPUT,
+    .icon_type = OBS_ICON_TYPE_MEDIA,
+    .output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_DO_NOT_DUPLICATE,
+
+    .get_name = multiview_source_get_name,
+    .create = multiview_source_create,
+    .destroy = multiview_source_destroy,
+
+    .get_defaults = multiview_source_get_defaults,
+    .get_properties = multiview_source_get_properties,
+    .update = multiview_source_update,
+
+    .get_width = multiview_source_get_width,
+    .get_height = multiview_source_get_height,
+
+    .activate = multiview_source_activate,
+    .deactivate = multiview_source_deactivate,
+    .show = multiview_source_show,
+    .hide = multiview_source_hide,
+
+    .video_tick = multiview_source_video_tick,
+
+    .enum_active_sources = multiview_source_enum_active_sources,
+    .enum_all_sources = multiview_source_enum_all_sources,
+    .video_render = multiview_source_video_render,
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <obs/obs.h>
+
+// Tiles every discovered camera into one picture, from low-cost
+// previews of their streams.
+extern struct obs_source_info multiview_source;
@@ -0,0 +1,280 @@
+#include "playout.h"
+
+#define MAX_QUEUED 30
+
+// Anything further than this from the expected arrival time is a
+// discontinuity (e.g. a reconnect) rather than jitter.
+#define RESYNC_THRESHOLD (1 * GST_SECOND)
+
+// Skew is measured between the lowest-delay arrivals of successive
+// windows of this length.
+#define SKEW_WINDOW (2 * GST_SECOND)
+#define MAX_SKEW 0.001
+
+#define MIN_TARGET (5 * GST_MSECOND)
+#define MAX_TARGET (200 * GST_MSECOND)
+#define DEFAULT_TARGET (20 * GST_MSECOND)
+
+// Fraction of each frame interval the delay may change by: playback
+// is at most 0.5% fast or slow while the buffer adapts.
+#define MAX_SLEW 0.005
+
+typedef struct {
+    GstSample *sample;
+    GstClockTime capture_time;
+    gint64 due;
+} Frame;
+
+struct _Playout {
+    GMutex lock;
+    GCond cond;
+    gboolean flushing;
+    GQueue frames;
+    guint64 dropped;
+
+    // Expected arrival time, relative to pts, is
+    //   baseline + skew * (pts - base_pts)
+    gboolean have_base;
+    GstClockTime base_pts;
+    double baseline;
+    double skew;
+
+    GstClockTime last_pts;
+    gint64 last_due;
+
+    // Lowest (arrival - pts) seen in the current window, and in the
+    // previous one.
+    GstClockTime window_start;
+    double window_min;
+    GstClockTime window_min_pts;
+    gboolean have_last_window;
+    double last_window_min;
+    GstClockTime last_window_min_pts;
+    // Lowest lateness against the baseline in the current window
+    double window_min_late;
+
+    double jitter;
+    double target;
+    double delay;
+};
+
+static void
+frame_free(Frame *frame) {
+    gst_sample_unref(frame->sample);
+    g_free(frame);
+}
+
+Playout *
+playout_new(void) {
+    Playout *playout = g_new0(Playout, 1);
+
+    g_mutex_init(&playout->lock);
+    g_cond_init(&playout->cond);
+    g_queue_init(&playout->frames);
+
+    return playout;
+}
+
+void
+playout_free(Playout *playout) {
+    if (playout == NULL) return;
+
+    g_queue_clear_full(&playout->frames, (GDestroyNotify)frame_free);
+    g_cond_clear(&playout->cond);
+    g_mutex_clear(&playout->lock);
+    g_free(playout);
+}
+
+static double
+expected_offset(Playout *playout, GstClockTime pts) {
+    return playout->baseline + playout->skew * ((double)pts - (double)playout->base_pts);
+}
+
+static void
+playout_resync(Playout *playout, GstClockTime pts, double offset) {
+    playout->have_base = TRUE;
+    playout->base_pts = pts;
+    playout->baseline = offset;
+    playout->skew = 0;
+    playout->last_pts = pts;
+    playout->window_start = pts;
+    playout->window_min = offset;
+    playout->window_min_pts = pts;
+    playout->window_min_late = 0;
+    playout->have_last_window = FALSE;
+    playout->jitter = 0;
+    playout->target = DEFAULT_TARGET;
+    playout->delay = DEFAULT_TARGET;
+}
+
+static void
+playout_end_window(Playout *playout, GstClockTime pts) {
+    if (playout->have_last_window &&
+        playout->window_min_pts > playout->last_window_min_pts) {
+        double slope = (playout->window_min - playout->last_window_min) /
+            ((double)playout->window_min_pts - (double)playout->last_window_min_pts);
+
+        // Re-anchor the baseline before changing the skew, so the
+        // expected arrival time doesn't jump.
+        playout->baseline = expected_offset(playout, pts);
+        playout->base_pts = pts;
+        playout->skew += (CLAMP(slope, -MAX_SKEW, MAX_SKEW) - playout->skew) * 0.2;
+    }
+
+    // If every frame in the window was late, the path delay has
+    // grown: move the baseline part of the way towards it.
+    if (playout->window_min_late > 0) {
+        playout->baseline += playout->window_min_late / 2;
+    }
+
+    playout->have_last_window = TRUE;
+    playout->last_window_min = playout->window_min;
+    playout->last_window_min_pts = playout->window_min_pts;
+    playout->window_start = pts;
+    playout->window_min = G_MAXDOUBLE;
+    playout->window_min_late = G_MAXDOUBLE;
+}
+
+void
+playout_push(Playout *playout, GstSample *sample, GstClockTime capture_time,
+             GstClockTime pts, gint64 arrival) {
+    Frame *frame;
+    double offset, late, max_change;
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return;
+
+    offset = (double)arrival - (double)pts;
+
+    g_mutex_lock(&playout->lock);
+    if (playout->flushing)
+        goto out;
+
+    if (!playout->have_base ||
+        ABS(offset - expected_offset(playout, pts)) > RESYNC_THRESHOLD) {
+        playout_resync(playout, pts, offset);
+    }
+
+    if (pts > playout->window_start && pts - playout->window_start >= SKEW_WINDOW) {
+        playout_end_window(playout, pts);
+    }
+    if (offset < playout->window_min) {
+        playout->window_min = offset;
+        playout->window_min_pts = pts;
+    }
+
+    late = offset - expected_offset(playout, pts);
+    playout->window_min_late = MIN(playout->window_min_late, late);
+    if (late < 0) {
+        // Earlier than ever: the path got faster
+        playout->baseline += late;
+        late = 0;
+    }
+
+    // Mean deviation as in RFC 3550, with the target a few
+    // deviations above the best case.
+    playout->jitter += (late - playout->jitter) / 16;
+    playout->target = CLAMP(3 * playout->jitter + MIN_TARGET, MIN_TARGET, MAX_TARGET);
+
+    if (pts > playout->last_pts) {
+        max_change = MAX_SLEW * (pts - playout->last_pts);
+        playout->delay += CLAMP(playout->target - playout->delay, -max_change, max_change);
+        playout->last_pts = pts;
+    }
+
+    frame = g_new0(Frame, 1);
+    frame->sample = gst_sample_ref(sample);
+    frame->capture_time = capture_time;
+    frame->due = (gint64)((double)pts + expected_offset(playout, pts) + playout->delay);
+    frame->due = MAX(frame->due, playout->last_due);
+    playout->last_due = frame->due;
+
+    g_queue_push_tail(&playout->frames, frame);
+    while (g_queue_get_length(&playout->frames) > MAX_QUEUED) {
+        frame_free(g_queue_pop_head(&playout->frames));
+        playout->dropped++;
+    }
+    g_cond_signal(&playout->cond);
+
+out:
+    g_mutex_unlock(&playout->lock);
+}
+
+gboolean
+playout_wait(Playout *playout, GstSample **sample, GstClockTime *capture_time) {
+    Frame *frame = NULL;
+    gint64 now;
+
+    g_mutex_lock(&playout->lock);
+    for (;;) {
+        Frame *head;
+
+        if (playout->flushing) {
+            g_mutex_unlock(&playout->lock);
+            return FALSE;
+        }
+
+        head = g_queue_peek_head(&playout->frames);
+        if (head == NULL) {
+            g_cond_wait(&playout->cond, &playout->lock);
+            continue;
+        }
+
+        now = g_get_monotonic_time() * 1000;
+        if (head->due > now) {
+            g_cond_wait_until(&playout->cond, &playout->lock, head->due / 1000);
+            continue;
+        }
+
+        // Skip to the newest overdue frame
+        while ((head = g_queue_peek_head(&playout->frames)) && head->due <= now) {
+            if (frame) {
+                frame_free(frame);
+                playout->dropped++;
+            }
+            frame = g_queue_pop_head(&playout->frames);
+        }
+        break;
+    }
+    g_mutex_unlock(&playout->lock);
+
+    *sample = frame->sample;
+    *capture_time = frame->capture_time;
+    g_free(frame);
+
+    return TRUE;
+}
+
+void
+playout_reset(Playout *playout) {
+    g_mutex_lock(&playout->lock);
+    g_queue_clear_full(&playout->frames, (GDestroyNotify)frame_free);
+    g_queue_init(&playout->frames);
+    playout->have_base = FALSE;
+    playout->last_due = 0;
+    g_mutex_unlock(&playout->lock);
+}
+
+void
+playout_set_flushing(Playout *playout, gboolean flushing) {
+    g_mutex_lock(&playout->lock);
+    playout->flushing = flushing;
+    g_cond_broadcast(&playout->cond);
+    g_mutex_unlock(&playout->lock);
+}
+
+void
+playout_get_stats(Playout *playout, PlayoutStats *stats) {
+    Frame *tail;
+    gint64 now = g_get_monotonic_time() * 1000;
+
+    g_mutex_lock(&playout->lock);
+    stats->target_ms = playout->target / GST_MSECOND;
+    stats->delay_ms = playout->delay / GST_MSECOND;
+    stats->depth_frames = g_queue_get_length(&playout->frames);
+    tail = g_queue_peek_tail(&playout->frames);
+    stats->depth_ms = tail && tail->due > now ? (double)(tail->due - now) / GST_MSECOND : 0;
+    stats->skew_ppm = playout->skew * 1e6;
+    stats->dropped = playout->dropped;
+    g_mutex_unlock(&playout->lock);
+}
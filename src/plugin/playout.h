@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+
+typedef struct _Playout Playout;
+
+typedef struct {
+    double target_ms;
+    double delay_ms;
+    guint depth_frames;
+    double depth_ms;
+    double skew_ppm;
+    guint64 dropped;
+} PlayoutStats;
+
+// A playout buffer that schedules frames by their RTP timestamps.
+// The sender's clock skew against the local clock is estimated from
+// the lowest-delay arrivals, and the buffer target follows the
+// observed jitter.  Changes to the delay are spread over many frames
+// by playing very slightly fast or slow, rather than by repeating or
+// dropping frames.
+Playout *playout_new(void);
+void playout_free(Playout *playout);
+
+// pts is the frame's RTP derived timestamp, arrival the local
+// monotonic time in nanoseconds.
+void playout_push(Playout *playout, GstSample *sample,
+                  GstClockTime capture_time, GstClockTime pts, gint64 arrival);
+
+// Wait until a frame is due and return it, or FALSE once flushing.
+// If several frames are overdue, only the newest is returned.
+gboolean playout_wait(Playout *playout, GstSample **sample,
+                      GstClockTime *capture_time);
+
+// Drop queued frames and start estimating from scratch
+void playout_reset(Playout *playout);
+void playout_set_flushing(Playout *playout, gboolean flushing);
+
+void playout_get_stats(Playout *playout, PlayoutStats *stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Playout, playout_free);
@@ -1,26 +1,43 @@
 #include <obs/obs-module.h>
+#include <gst/gst.h>
 
 #include "mdns-browse.h"
 #include "active-notify.h"
+#include "multiview.h"
+#include "receiver.h"
+#include "receiver-source.h"
 #include "source.h"
 
 OBS_DECLARE_MODULE();
 
+#define CACHE_FILE "discovery-cache.ini"
+
 MdnsBrowser *mdns_browser = NULL;
 ActiveNotify *active_notify = NULL;
 
 bool
 obs_module_load(void) {
     g_autoptr(GError) error = NULL;
+    char *cache_file;
+
+    if (!gst_init_check(NULL, NULL, &error)) {
+        g_warning("Could not initialise GStreamer: %s", error->message);
+        return false;
+    }
+    receiver_init();
 
-    mdns_browser = mdns_browser_new(&error);
+    cache_file = obs_module_config_path(CACHE_FILE);
+    mdns_browser = mdns_browser_new(cache_file, &error);
+    bfree(cache_file);
     if (!mdns_browser) {
         g_warning("Could not create mDNS browser: %s", error->message);
     }
 
     active_notify = active_notify_new();
 
+    obs_register_source(&receiver_source);
     obs_register_source(&remote_source);
+    obs_register_source(&multiview_source);
     return true;
 }
 
@@ -28,4 +45,6 @@ void
 obs_module_unload(void) {
     g_clear_pointer(&mdns_browser, mdns_browser_free);
     g_clear_pointer(&active_notify, active_notify_free);
+    receiver_source_free_workers();
+    receiver_deinit();
 }
@@ -0,0 +1,484 @@
+#include "receiver-source.h"
+
+#include <glib.h>
+#include <gst/audio/audio.h>
+#include <gst/video/video.h>
+#include <obs/util/platform.h>
+
+#include "receiver.h"
+#include "view-region.h"
+
+// Frames of low-cost previews are handed to OBS by a small shared pool
+// of workers, so however many there are, they only take a few cores.
+#define PREVIEW_WORKERS 2
+
+// Audio timestamps further than this from when the matching video is
+// shown are re-anchored, e.g. after a reconnect.
+#define AUDIO_RESYNC (100 * GST_MSECOND)
+
+static GThreadPool *preview_pool = NULL;
+
+struct receiver_source {
+    obs_source_t *source;
+
+    // Settings
+    char *rtsp_url;
+    char *clock;
+    bool hw_decode;
+    int playout_delay;
+    int max_fps;
+
+    GMutex lock;
+    Receiver *receiver;
+    bool standby;
+    char *view;
+    obs_source_t *audio_target;
+
+    // Maps the audio's PTS to OBS timestamps.  Only used from the
+    // audio streaming thread.
+    uint64_t audio_base_ts;
+    GstClockTime audio_base_pts;
+
+    uint64_t frame_id;
+    uint64_t capture_time;
+    bool has_region;
+    ViewRegion region;
+
+    // The newest preview frame waiting for a worker.  Older ones are
+    // dropped if the pool falls behind.
+    GCond preview_cond;
+    GstSample *preview_sample;
+    GstClockTime preview_capture_time;
+    bool preview_queued;
+};
+
+static const char *
+receiver_source_get_name(void *user_data) {
+    return "RTSP Receiver";
+}
+
+static enum video_format
+convert_format(GstVideoFormat format) {
+    switch (format) {
+    case GST_VIDEO_FORMAT_I420:
+        return VIDEO_FORMAT_I420;
+    case GST_VIDEO_FORMAT_NV12:
+        return VIDEO_FORMAT_NV12;
+    case GST_VIDEO_FORMAT_YUY2:
+        return VIDEO_FORMAT_YUY2;
+    case GST_VIDEO_FORMAT_UYVY:
+        return VIDEO_FORMAT_UYVY;
+    case GST_VIDEO_FORMAT_BGRA:
+        return VIDEO_FORMAT_BGRA;
+    case GST_VIDEO_FORMAT_BGRx:
+        return VIDEO_FORMAT_BGRX;
+    case GST_VIDEO_FORMAT_RGBA:
+        return VIDEO_FORMAT_RGBA;
+    default:
+        return VIDEO_FORMAT_NONE;
+    }
+}
+
+static void
+receiver_source_output(struct receiver_source *rs, GstSample *sample,
+                       GstClockTime capture_time) {
+    struct obs_source_frame frame = { 0 };
+    GstVideoInfo info;
+    GstVideoFrame vframe;
+    enum video_range_type range;
+    enum video_colorspace colorspace;
+    const GstStructure *sample_info;
+    ViewRegion region;
+    bool has_region;
+    guint i;
+
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample)))
+        return;
+    if (!gst_video_frame_map(&vframe, &info, gst_sample_get_buffer(sample), GST_MAP_READ))
+        return;
+
+    frame.format = convert_format(GST_VIDEO_INFO_FORMAT(&info));
+    frame.width = GST_VIDEO_INFO_WIDTH(&info);
+    frame.height = GST_VIDEO_INFO_HEIGHT(&info);
+    for (i = 0; i < GST_VIDEO_FRAME_N_PLANES(&vframe); i++) {
+        frame.data[i] = GST_VIDEO_FRAME_PLANE_DATA(&vframe, i);
+        frame.linesize[i] = GST_VIDEO_FRAME_PLANE_STRIDE(&vframe, i);
+    }
+
+    range = info.colorimetry.range == GST_VIDEO_COLOR_RANGE_0_255
+        ? VIDEO_RANGE_FULL : VIDEO_RANGE_PARTIAL;
+    colorspace = info.colorimetry.matrix == GST_VIDEO_COLOR_MATRIX_BT601
+        ? VIDEO_CS_601 : VIDEO_CS_709;
+    frame.full_range = range == VIDEO_RANGE_FULL;
+    video_format_get_parameters(colorspace, range, frame.color_matrix,
+                                frame.color_range_min, frame.color_range_max);
+    frame.timestamp = os_gettime_ns();
+
+    obs_source_output_video(rs->source, &frame);
+    gst_video_frame_unmap(&vframe);
+
+    sample_info = gst_sample_get_info(sample);
+    has_region = sample_info && view_region_from_structure(sample_info, &region);
+
+    g_mutex_lock(&rs->lock);
+    rs->frame_id++;
+    rs->capture_time = GST_CLOCK_TIME_IS_VALID(capture_time) ? capture_time : 0;
+    rs->has_region = has_region;
+    if (has_region) {
+        rs->region = region;
+    }
+    g_mutex_unlock(&rs->lock);
+}
+
+static void
+preview_worker(void *data, void *user_data) {
+    struct receiver_source *rs = data;
+    GstSample *sample;
+    GstClockTime capture_time;
+    bool requeue;
+
+    g_mutex_lock(&rs->lock);
+    sample = g_steal_pointer(&rs->preview_sample);
+    capture_time = rs->preview_capture_time;
+    g_mutex_unlock(&rs->lock);
+
+    if (sample) {
+        receiver_source_output(rs, sample, capture_time);
+        gst_sample_unref(sample);
+    }
+
+    // A frame that arrived meanwhile wasn't queued
+    g_mutex_lock(&rs->lock);
+    requeue = rs->preview_sample != NULL;
+    rs->preview_queued = requeue;
+    g_cond_broadcast(&rs->preview_cond);
+    g_mutex_unlock(&rs->lock);
+
+    if (requeue) {
+        g_thread_pool_push(preview_pool, rs, NULL);
+    }
+}
+
+static void
+receiver_source_queue_preview(struct receiver_source *rs, GstSample *sample,
+                              GstClockTime capture_time) {
+    GstSample *old;
+    bool push;
+
+    if (g_once_init_enter(&preview_pool)) {
+        g_once_init_leave(&preview_pool, g_thread_pool_new(
+                              preview_worker, NULL, PREVIEW_WORKERS, FALSE, NULL));
+    }
+
+    g_mutex_lock(&rs->lock);
+    old = rs->preview_sample;
+    rs->preview_sample = gst_sample_ref(sample);
+    rs->preview_capture_time = capture_time;
+    push = !rs->preview_queued;
+    rs->preview_queued = true;
+    g_mutex_unlock(&rs->lock);
+
+    if (old) {
+        gst_sample_unref(old);
+    }
+    if (push) {
+        g_thread_pool_push(preview_pool, rs, NULL);
+    }
+}
+
+static void
+receiver_source_video(GstSample *sample, GstClockTime capture_time,
+                      void *user_data) {
+    struct receiver_source *rs = user_data;
+
+    if (rs->max_fps > 0) {
+        receiver_source_queue_preview(rs, sample, capture_time);
+    } else {
+        receiver_source_output(rs, sample, capture_time);
+    }
+}
+
+static enum speaker_layout
+convert_speakers(guint channels) {
+    switch (channels) {
+    case 1:
+        return SPEAKERS_MONO;
+    case 2:
+        return SPEAKERS_STEREO;
+    case 3:
+        return SPEAKERS_2POINT1;
+    case 4:
+        return SPEAKERS_4POINT0;
+    case 5:
+        return SPEAKERS_4POINT1;
+    case 6:
+        return SPEAKERS_5POINT1;
+    case 8:
+        return SPEAKERS_7POINT1;
+    default:
+        return SPEAKERS_UNKNOWN;
+    }
+}
+
+// OBS timestamps follow the audio's PTS, so OBS gets continuous audio
+// rather than network jitter.  They are anchored to when the matching
+// video is shown: on arrival, plus the playout buffer's delay when
+// frames go through it.
+static uint64_t
+receiver_source_audio_timestamp(struct receiver_source *rs, GstClockTime pts) {
+    uint64_t expected = os_gettime_ns();
+    uint64_t timestamp;
+    PlayoutStats playout;
+
+    if (receiver_source_get_playout_stats(rs->source, &playout)) {
+        expected += (uint64_t)(playout.delay_ms * GST_MSECOND);
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return expected;
+
+    if (rs->audio_base_ts != 0 && pts >= rs->audio_base_pts) {
+        timestamp = rs->audio_base_ts + (pts - rs->audio_base_pts);
+        if (timestamp + AUDIO_RESYNC > expected && timestamp < expected + AUDIO_RESYNC)
+            return timestamp;
+    }
+    rs->audio_base_ts = expected;
+    rs->audio_base_pts = pts;
+    return expected;
+}
+
+static void
+receiver_source_audio(GstSample *sample, void *user_data) {
+    struct receiver_source *rs = user_data;
+    struct obs_source_audio audio = { 0 };
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstAudioInfo info;
+    GstMapInfo map;
+
+    if (!gst_audio_info_from_caps(&info, gst_sample_get_caps(sample)))
+        return;
+    audio.speakers = convert_speakers(GST_AUDIO_INFO_CHANNELS(&info));
+    if (audio.speakers == SPEAKERS_UNKNOWN)
+        return;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return;
+
+    audio.data[0] = map.data;
+    audio.frames = (uint32_t)(map.size / GST_AUDIO_INFO_BPF(&info));
+    audio.format = AUDIO_FORMAT_FLOAT;
+    audio.samples_per_sec = GST_AUDIO_INFO_RATE(&info);
+    audio.timestamp = receiver_source_audio_timestamp(rs, GST_BUFFER_PTS(buffer));
+
+    obs_source_output_audio(rs->audio_target, &audio);
+    gst_buffer_unmap(buffer, &map);
+}
+
+static void
+receiver_source_stopped(void *user_data) {
+    struct receiver_source *rs = user_data;
+
+    obs_source_output_video(rs->source, NULL);
+}
+
+static void
+receiver_source_set_receiver(struct receiver_source *rs, Receiver *receiver) {
+    Receiver *old;
+
+    // Freeing waits for the receiver's callbacks, which take the lock
+    g_mutex_lock(&rs->lock);
+    old = g_steal_pointer(&rs->receiver);
+    g_mutex_unlock(&rs->lock);
+
+    if (old) {
+        receiver_free(old);
+
+        // No more frames can arrive, so let the pool finish with any
+        // from the old receiver before the new one starts queueing.
+        g_mutex_lock(&rs->lock);
+        while (rs->preview_queued) {
+            g_cond_wait(&rs->preview_cond, &rs->lock);
+        }
+        g_mutex_unlock(&rs->lock);
+    }
+    rs->audio_base_ts = 0;
+
+    g_mutex_lock(&rs->lock);
+    rs->receiver = receiver;
+    if (receiver) {
+        receiver_set_standby(receiver, rs->standby);
+        if (rs->view) {
+            receiver_set_view(receiver, rs->view);
+        }
+    }
+    g_mutex_unlock(&rs->lock);
+}
+
+static void
+receiver_source_update(void *user_data, obs_data_t *settings) {
+    struct receiver_source *rs = user_data;
+    const char *rtsp_url = obs_data_get_string(settings, "rtsp_url");
+    const char *clock = obs_data_get_string(settings, "clock");
+    bool hw_decode = obs_data_get_bool(settings, "hw_decode");
+    int playout_delay = (int)obs_data_get_int(settings, "playout_delay");
+    int max_fps = (int)obs_data_get_int(settings, "max_fps");
+
+    if (rs->receiver && !g_strcmp0(rtsp_url, rs->rtsp_url) &&
+        !g_strcmp0(clock, rs->clock) && hw_decode == rs->hw_decode &&
+        playout_delay == rs->playout_delay && max_fps == rs->max_fps) {
+        return;
+    }
+
+    receiver_source_set_receiver(rs, NULL);
+    obs_source_output_video(rs->source, NULL);
+
+    g_clear_pointer(&rs->rtsp_url, g_free);
+    rs->rtsp_url = g_strdup(rtsp_url);
+    g_clear_pointer(&rs->clock, g_free);
+    rs->clock = g_strdup(clock);
+    rs->hw_decode = hw_decode;
+    rs->playout_delay = playout_delay;
+    rs->max_fps = max_fps;
+
+    if (rs->rtsp_url[0] != '\0') {
+        receiver_source_set_receiver(
+            rs, receiver_new(rs->rtsp_url, rs->clock, rs->hw_decode,
+                             rs->playout_delay, rs->standby, rs->max_fps,
+                             receiver_source_video,
+                             rs->audio_target ? receiver_source_audio : NULL,
+                             receiver_source_stopped, rs));
+    }
+}
+
+static void *
+receiver_source_create(obs_data_t *settings, obs_source_t *source) {
+    struct receiver_source *rs = g_new0(struct receiver_source, 1);
+
+    rs->source = source;
+    g_mutex_init(&rs->lock);
+    g_cond_init(&rs->preview_cond);
+
+    // Frames are handed over as soon as they are decoded, so show
+    // them immediately rather than buffering them again.
+    obs_source_set_async_unbuffered(source, true);
+    receiver_source_update(rs, settings);
+
+    return rs;
+}
+
+static void
+receiver_source_destroy(void *user_data) {
+    struct receiver_source *rs = user_data;
+
+    receiver_source_set_receiver(rs, NULL);
+    g_clear_pointer(&rs->rtsp_url, g_free);
+    g_clear_pointer(&rs->clock, g_free);
+    g_clear_pointer(&rs->view, g_free);
+    g_cond_clear(&rs->preview_cond);
+    g_mutex_clear(&rs->lock);
+
+    g_free(rs);
+}
+
+void
+receiver_source_get_last_frame(obs_source_t *source, uint64_t *frame_id,
+                               uint64_t *capture_time) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+
+    g_mutex_lock(&rs->lock);
+    *frame_id = rs->frame_id;
+    *capture_time = rs->capture_time;
+    g_mutex_unlock(&rs->lock);
+}
+
+void
+receiver_source_set_standby(obs_source_t *source, bool standby) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+
+    g_mutex_lock(&rs->lock);
+    rs->standby = standby;
+    if (rs->receiver) {
+        receiver_set_standby(rs->receiver, standby);
+    }
+    g_mutex_unlock(&rs->lock);
+}
+
+bool
+receiver_source_get_region(obs_source_t *source, ViewRegion *region) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+    bool found;
+
+    g_mutex_lock(&rs->lock);
+    found = rs->has_region;
+    if (found) {
+        *region = rs->region;
+    }
+    g_mutex_unlock(&rs->lock);
+
+    return found;
+}
+
+void
+receiver_source_set_view(obs_source_t *source, const char *view) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+
+    g_mutex_lock(&rs->lock);
+    g_free(rs->view);
+    rs->view = g_strdup(view);
+    if (rs->receiver) {
+        receiver_set_view(rs->receiver, view);
+    }
+    g_mutex_unlock(&rs->lock);
+}
+
+void
+receiver_source_set_audio_target(obs_source_t *source, obs_source_t *target) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+
+    rs->audio_target = target;
+}
+
+bool
+receiver_source_is_healthy(obs_source_t *source) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+    bool healthy;
+
+    g_mutex_lock(&rs->lock);
+    healthy = rs->receiver && !receiver_is_stalled(rs->receiver);
+    g_mutex_unlock(&rs->lock);
+
+    return healthy;
+}
+
+bool
+receiver_source_get_playout_stats(obs_source_t *source, PlayoutStats *stats) {
+    struct receiver_source *rs = obs_obj_get_data(source);
+    bool found = false;
+
+    g_mutex_lock(&rs->lock);
+    if (rs->receiver) {
+        found = receiver_get_playout_stats(rs->receiver, stats);
+    }
+    g_mutex_unlock(&rs->lock);
+
+    return found;
+}
+
+void
+receiver_source_free_workers(void) {
+    if (preview_pool) {
+        g_thread_pool_free(preview_pool, FALSE, TRUE);
+        preview_pool = NULL;
+    }
+}
+
+struct obs_source_info receiver_source = {
+    .id = "rtsp_receiver_source",
+    .type = OBS_SOURCE_TYPE_INPUT,
+    .output_flags = (OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_DO_NOT_DUPLICATE |
+                     OBS_SOURCE_CAP_DISABLED),
+
+    .get_name = receiver_source_get_name,
+    .create = receiver_source_create,
+    .destroy = receiver_source_destroy,
+
+    .update = receiver_source_update,
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <obs/obs.h>
+
+#include "playout.h"
+#include "view-region.h"
+
+// Internal source decoding an RTSP stream with GStreamer, used as
+// the child of remote_source and multiview_source.  A non-zero
+// "max_fps" setting makes it a low-cost preview, whose frames are
+// handed to OBS by a shared pool of workers.
+extern struct obs_source_info receiver_source;
+
+// Stop the preview workers, once all sources are destroyed
+void receiver_source_free_workers(void);
+
+// The most recent frame handed to OBS: a counter incremented for
+// each frame, and its capture time in nanoseconds since the NTP
+// epoch (0 if unknown).
+void receiver_source_get_last_frame(obs_source_t *source, uint64_t *frame_id,
+                                    uint64_t *capture_time);
+
+// The region of the camera's picture the last frame holds, if the
+// sender cropped or scaled it to the view.
+bool receiver_source_get_region(obs_source_t *source, ViewRegion *region);
+// Tell the sender what is shown, as an "obs-view" parameter
+void receiver_source_set_view(obs_source_t *source, const char *view);
+
+// Output the stream's audio on target, normally the parent source,
+// since private sources aren't mixed.  Without one, audio isn't
+// decoded.  Takes effect when the source is next given a URL.
+void receiver_source_set_audio_target(obs_source_t *source, obs_source_t *target);
+
+// Switch between decoding and keeping the session ready in standby
+void receiver_source_set_standby(obs_source_t *source, bool standby);
+// Connected, with packets arriving
+bool receiver_source_is_healthy(obs_source_t *source);
+
+// Returns false unless frames are going through the adaptive playout
+// buffer, i.e. there is no fixed playout delay.
+bool receiver_source_get_playout_stats(obs_source_t *source,
+                                       PlayoutStats *stats);
@@ -0,0 +1,921 @@
+#include "receiver.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <string.h>
+
+#include "net-clock.h"
+#include "playout.h"
+#include "view-region.h"
+
+#define RECONNECT_DELAY 2
+#define N_STAMPS 64
+
+// A stream is stalled once nothing has arrived for this many frame
+// intervals, with a floor to allow for packets arriving in bursts.
+#define STALL_FRAMES 1.5
+#define MIN_STALL (10 * G_TIME_SPAN_MILLISECOND)
+#define DEFAULT_FRAME_INTERVAL (G_TIME_SPAN_SECOND / 30)
+
+#define VIDEO_CAPS "video/x-raw,format=(string){I420,NV12,YUY2,UYVY,BGRA,BGRx,RGBA}"
+#define AUDIO_CAPS "audio/x-raw,format=(string)F32LE,layout=(string)interleaved"
+
+// Values of decodebin's GstAutoplugSelectResult, which is not
+// exported in any header.
+enum {
+    AUTOPLUG_SELECT_TRY = 0,
+    AUTOPLUG_SELECT_SKIP = 2,
+};
+
+// Values of GstRTSPProfile
+enum {
+    PROFILE_AVP = 1 << 0,
+    PROFILE_AVPF = 1 << 2,
+};
+
+// Values of GstRtpNtpTimeSource and RTPJitterBufferMode
+enum {
+    NTP_TIME_SOURCE_CLOCK_TIME = 3,
+    BUFFER_MODE_NONE = 0,
+    BUFFER_MODE_SYNCED = 4,
+};
+
+typedef struct {
+    GstClockTime pts;
+    GstClockTime capture_time;
+    gboolean has_region;
+    ViewRegion region;
+} Stamp;
+
+struct _Receiver {
+    char *rtsp_url;
+    GstClock *clock;
+    gboolean hw_decode;
+    guint playout_delay;
+    gboolean standby;
+    guint max_fps;
+    ReceiverVideoFunc video_func;
+    ReceiverAudioFunc audio_func;
+    ReceiverStoppedFunc stopped_func;
+    void *user_data;
+
+    GMutex lock;
+    gboolean closing;
+    GstElement *pipeline;
+    GSource *bus_source;
+    GSource *reconnect_source;
+
+    GMutex stamp_lock;
+    Stamp stamps[N_STAMPS];
+    guint next_stamp;
+
+    // Waiting to be sent once the stream is playing
+    char *view;
+    gint view_pending;
+
+    // Arrival times in monotonic microseconds
+    GMutex health_lock;
+    GstClockTime last_pts;
+    gint64 last_arrival;
+    gint64 last_frame_arrival;
+    gint64 frame_interval;
+
+    // PTS of the last frame let through the frame rate cap
+    GstClockTime last_rate_pts;
+
+    // Only used without a playout delay
+    Playout *playout;
+    GThread *playout_thread;
+};
+
+static GMainContext *receiver_context = NULL;
+static GMainLoop *receiver_loop = NULL;
+static GThread *receiver_thread = NULL;
+
+// Common clocks by URI, shared by every receiver using them
+static GMutex clocks_lock;
+static GHashTable *receiver_clocks = NULL;
+
+void
+receiver_init(void) {
+    g_return_if_fail(receiver_thread == NULL);
+
+    receiver_clocks = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, gst_object_unref);
+
+    // Lets depayloaders read the region of cropped or scaled frames
+    view_region_init();
+
+    receiver_context = g_main_context_new();
+    receiver_loop = g_main_loop_new(receiver_context, FALSE);
+    receiver_thread = g_thread_new(
+        "rtsp-receiver", (GThreadFunc)g_main_loop_run, receiver_loop);
+}
+
+void
+receiver_deinit(void) {
+    if (receiver_thread == NULL) return;
+
+    g_main_loop_quit(receiver_loop);
+    g_thread_join(receiver_thread);
+    receiver_thread = NULL;
+    g_clear_pointer(&receiver_loop, g_main_loop_unref);
+    g_clear_pointer(&receiver_context, g_main_context_unref);
+    g_clear_pointer(&receiver_clocks, g_hash_table_unref);
+}
+
+static GstClock *
+receiver_get_clock(const char *uri) {
+    GstClock *clock;
+
+    if (uri == NULL || uri[0] == '\0') {
+        uri = "system";
+    }
+
+    g_mutex_lock(&clocks_lock);
+    clock = g_hash_table_lookup(receiver_clocks, uri);
+    if (clock == NULL) {
+        g_autoptr(GError) error = NULL;
+
+        clock = net_clock_new(uri, &error);
+        if (clock == NULL) {
+            g_warning("Could not set up clock '%s', using the system clock: %s",
+                      uri, error->message);
+            clock = net_clock_new(NULL, NULL);
+        }
+        g_hash_table_insert(receiver_clocks, g_strdup(uri), clock);
+    }
+    gst_object_ref(clock);
+    g_mutex_unlock(&clocks_lock);
+
+    return clock;
+}
+
+GstClockTime
+receiver_get_ntp_time(const char *clock_uri) {
+    g_autoptr(GstClock) clock = receiver_get_clock(clock_uri);
+
+    return net_clock_to_ntp(clock, gst_clock_get_time(clock));
+}
+
+static Receiver *
+receiver_ref(Receiver *receiver) {
+    return g_atomic_rc_box_acquire(receiver);
+}
+
+static void
+receiver_clear(Receiver *receiver) {
+    g_clear_pointer(&receiver->rtsp_url, g_free);
+    g_clear_object(&receiver->clock);
+    g_clear_pointer(&receiver->view, g_free);
+    g_clear_pointer(&receiver->playout, playout_free);
+    g_mutex_clear(&receiver->lock);
+    g_mutex_clear(&receiver->stamp_lock);
+    g_mutex_clear(&receiver->health_lock);
+}
+
+static void
+receiver_unref(Receiver *receiver) {
+    g_atomic_rc_box_release_full(receiver, (GDestroyNotify)receiver_clear);
+}
+
+static void
+receiver_add_stamp(Receiver *receiver, GstClockTime pts,
+                   GstClockTime capture_time, const ViewRegion *region) {
+    Stamp *stamp;
+
+    g_mutex_lock(&receiver->stamp_lock);
+    stamp = &receiver->stamps[receiver->next_stamp % N_STAMPS];
+    receiver->next_stamp++;
+    stamp->pts = pts;
+    stamp->capture_time = capture_time;
+    stamp->has_region = region != NULL;
+    if (region) {
+        stamp->region = *region;
+    }
+    g_mutex_unlock(&receiver->stamp_lock);
+}
+
+static gboolean
+receiver_lookup_stamp(Receiver *receiver, GstClockTime pts, Stamp *found) {
+    gboolean result = FALSE;
+    guint i;
+
+    g_mutex_lock(&receiver->stamp_lock);
+    for (i = 1; i <= N_STAMPS; i++) {
+        Stamp *stamp = &receiver->stamps[(receiver->next_stamp - i) % N_STAMPS];
+
+        if (stamp->pts == pts) {
+            *found = *stamp;
+            result = TRUE;
+            break;
+        }
+    }
+    g_mutex_unlock(&receiver->stamp_lock);
+
+    return result;
+}
+
+static GstPadProbeReturn
+depay_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    static GstCaps *ntp_caps = NULL;
+    Receiver *receiver = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstReferenceTimestampMeta *meta;
+    ViewRegion region;
+    gboolean has_region;
+
+    if (g_once_init_enter(&ntp_caps)) {
+        g_once_init_leave(&ntp_caps, gst_caps_new_empty_simple("timestamp/x-ntp"));
+    }
+
+    // The depayloader attaches the sender's capture time, decoded
+    // from the NTP-64 header extension, and the region of the picture
+    // if the sender cropped it.  Decoders don't reliably copy metas,
+    // so remember them by PTS.
+    meta = gst_buffer_get_reference_timestamp_meta(buffer, ntp_caps);
+    has_region = view_region_get_meta(buffer, &region);
+    if ((meta || has_region) && GST_BUFFER_PTS_IS_VALID(buffer)) {
+        receiver_add_stamp(receiver, GST_BUFFER_PTS(buffer),
+                           meta ? meta->timestamp : GST_CLOCK_TIME_NONE,
+                           has_region ? &region : NULL);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+pipeline_deep_element_added(GstBin *pipeline, GstBin *bin,
+                            GstElement *element, Receiver *receiver) {
+    GstElementFactory *factory = gst_element_get_factory(element);
+    const char *klass;
+    g_autoptr(GstPad) pad = NULL;
+
+    if (factory == NULL) return;
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (klass == NULL) return;
+
+    // Previews each decode on one thread, so many of them don't
+    // compete with the full streams for every core.
+    if (receiver->max_fps > 0 && strstr(klass, "Decoder") &&
+        g_object_class_find_property(G_OBJECT_GET_CLASS(element), "max-threads")) {
+        g_object_set(element, "max-threads", 1, NULL);
+    }
+    if (strstr(klass, "Depayloader") == NULL) return;
+
+    pad = gst_element_get_static_pad(element, "src");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, depay_probe,
+                          receiver, NULL);
+    }
+}
+
+static gint
+decodebin_autoplug_select(GstElement *bin, GstPad *pad, GstCaps *caps,
+                          GstElementFactory *factory, Receiver *receiver) {
+    const char *klass;
+
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (!receiver->hw_decode && klass && strstr(klass, "Hardware")) {
+        return AUTOPLUG_SELECT_SKIP;
+    }
+    return AUTOPLUG_SELECT_TRY;
+}
+
+static gboolean
+pad_has_media(GstPad *pad, const char *prefix, const char *media) {
+    g_autoptr(GstCaps) caps = gst_pad_query_caps(pad, NULL);
+    GstStructure *s;
+
+    if (gst_caps_is_empty(caps) || gst_caps_is_any(caps))
+        return FALSE;
+    s = gst_caps_get_structure(caps, 0);
+    if (!g_str_has_prefix(gst_structure_get_name(s), prefix))
+        return FALSE;
+    return media == NULL || !g_strcmp0(gst_structure_get_string(s, "media"), media);
+}
+
+static void
+receiver_send_view(Receiver *receiver) {
+    g_autofree char *view = NULL;
+    g_autoptr(GstElement) src = NULL;
+    gboolean sent = FALSE;
+
+    g_mutex_lock(&receiver->lock);
+    view = g_strdup(receiver->view);
+    if (receiver->pipeline) {
+        src = gst_bin_get_by_name(GST_BIN(receiver->pipeline), "src");
+    }
+    g_mutex_unlock(&receiver->lock);
+
+    if (view == NULL || src == NULL)
+        return;
+    g_signal_emit_by_name(src, "set-parameter", "obs-view", view, NULL, NULL, &sent);
+    if (!sent) {
+        g_warning("Could not send view to %s", receiver->rtsp_url);
+    }
+}
+
+static GstPadProbeReturn
+arrival_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    Receiver *receiver = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gint64 now = g_get_monotonic_time();
+
+    // The session is playing, so parameters can be set
+    if (g_atomic_int_compare_and_exchange(&receiver->view_pending, TRUE, FALSE)) {
+        receiver_send_view(receiver);
+    }
+
+    // Packets are seen whether or not the stream is being decoded
+    g_mutex_lock(&receiver->health_lock);
+    receiver->last_arrival = now;
+    if (GST_BUFFER_PTS(buffer) != receiver->last_pts) {
+        if (receiver->last_frame_arrival != 0) {
+            gint64 interval = now - receiver->last_frame_arrival;
+
+            receiver->frame_interval += (interval - receiver->frame_interval) / 8;
+        }
+        receiver->last_pts = GST_BUFFER_PTS(buffer);
+        receiver->last_frame_arrival = now;
+    }
+    g_mutex_unlock(&receiver->health_lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+rate_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    Receiver *receiver = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    // Allow for PTS rounding, so 30 fps capped to 10 keeps every third
+    GstClockTime interval = GST_SECOND / receiver->max_fps * 3 / 4;
+
+    // Dropped before conversion, which costs as much as decoding at
+    // preview sizes.  Earlier PTS mean the stream restarted.
+    if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(receiver->last_rate_pts) &&
+        pts >= receiver->last_rate_pts && pts - receiver->last_rate_pts < interval)
+        return GST_PAD_PROBE_DROP;
+
+    receiver->last_rate_pts = pts;
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+link_to_fakesink(GstElement *pipeline, GstPad *pad) {
+    GstElement *fakesink = gst_element_factory_make("fakesink", NULL);
+    g_autoptr(GstPad) sinkpad = NULL;
+
+    g_object_set(fakesink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(pipeline), fakesink);
+    sinkpad = gst_element_get_static_pad(fakesink, "sink");
+    gst_pad_link(pad, sinkpad);
+    gst_element_sync_state_with_parent(fakesink);
+}
+
+static void
+link_to_element(GstPad *pad, GstElement *element) {
+    g_autoptr(GstPad) sinkpad = gst_element_get_static_pad(element, "sink");
+
+    if (!gst_pad_is_linked(sinkpad)) {
+        gst_pad_link(pad, sinkpad);
+    }
+}
+
+static void
+src_pad_added(GstElement *src, GstPad *pad, GstElement *pipeline) {
+    g_autoptr(GstElement) valve = NULL;
+
+    if (pad_has_media(pad, "application/x-rtp", "video")) {
+        valve = gst_bin_get_by_name(GST_BIN(pipeline), "vvalve");
+    } else if (pad_has_media(pad, "application/x-rtp", "audio")) {
+        valve = gst_bin_get_by_name(GST_BIN(pipeline), "avalve");
+    }
+    if (valve) {
+        link_to_element(pad, valve);
+    } else {
+        // Unused streams still need to be consumed
+        link_to_fakesink(pipeline, pad);
+    }
+}
+
+static void
+decode_pad_added(GstElement *decode, GstPad *pad, GstElement *pipeline) {
+    g_autoptr(GstElement) convert = NULL;
+
+    if (pad_has_media(pad, "video/", NULL)) {
+        convert = gst_bin_get_by_name(GST_BIN(pipeline), "vconvert");
+    } else if (pad_has_media(pad, "audio/", NULL)) {
+        convert = gst_bin_get_by_name(GST_BIN(pipeline), "aconvert");
+    }
+    if (convert) {
+        link_to_element(pad, convert);
+    }
+}
+
+static GstFlowReturn
+video_new_sample(GstAppSink *sink, void *user_data) {
+    Receiver *receiver = user_data;
+    g_autoptr(GstSample) sample = NULL;
+    GstBuffer *buffer;
+    GstClockTime capture_time = GST_CLOCK_TIME_NONE;
+    Stamp stamp;
+
+    sample = gst_app_sink_pull_sample(sink);
+    if (sample == NULL)
+        return GST_FLOW_EOS;
+
+    buffer = gst_sample_get_buffer(sample);
+    if (receiver_lookup_stamp(receiver, GST_BUFFER_PTS(buffer), &stamp)) {
+        capture_time = stamp.capture_time;
+        if (stamp.has_region) {
+            GstSample *with_region = gst_sample_new(
+                buffer, gst_sample_get_caps(sample), gst_sample_get_segment(sample),
+                view_region_to_structure(&stamp.region));
+
+            gst_sample_unref(sample);
+            sample = with_region;
+        }
+    }
+    if (receiver->playout) {
+        playout_push(receiver->playout, sample, capture_time,
+                     GST_BUFFER_PTS(buffer), g_get_monotonic_time() * 1000);
+    } else {
+        receiver->video_func(sample, capture_time, receiver->user_data);
+    }
+
+    return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+audio_new_sample(GstAppSink *sink, void *user_data) {
+    Receiver *receiver = user_data;
+    g_autoptr(GstSample) sample = NULL;
+
+    sample = gst_app_sink_pull_sample(sink);
+    if (sample == NULL)
+        return GST_FLOW_EOS;
+
+    receiver->audio_func(sample, receiver->user_data);
+    return GST_FLOW_OK;
+}
+
+static void *
+receiver_playout_thread(void *user_data) {
+    Receiver *receiver = user_data;
+    GstSample *sample;
+    GstClockTime capture_time;
+
+    while (playout_wait(receiver->playout, &sample, &capture_time)) {
+        receiver->video_func(sample, capture_time, receiver->user_data);
+        gst_sample_unref(sample);
+    }
+
+    return NULL;
+}
+
+// Audio is decoded to interleaved floats for OBS.  It bypasses the
+// adaptive playout buffer, and with a playout delay is released on
+// the common clock like video.
+static gboolean
+receiver_add_audio(Receiver *receiver, GstElement *pipeline) {
+    g_autoptr(GstCaps) caps = NULL;
+    GstElement *valve, *decode, *convert, *sink;
+    GstAppSinkCallbacks callbacks = { NULL };
+
+    valve = gst_element_factory_make("valve", "avalve");
+    decode = gst_element_factory_make("decodebin", "adecode");
+    convert = gst_element_factory_make("audioconvert", "aconvert");
+    sink = gst_element_factory_make("appsink", "asink");
+    if (!valve || !decode || !convert || !sink) {
+        g_warning("Missing GStreamer elements needed to receive audio from %s",
+                  receiver->rtsp_url);
+        g_clear_object(&valve);
+        g_clear_object(&decode);
+        g_clear_object(&convert);
+        g_clear_object(&sink);
+        return FALSE;
+    }
+    gst_bin_add_many(GST_BIN(pipeline), valve, decode, convert, sink, NULL);
+    gst_element_link(valve, decode);
+    gst_element_link(convert, sink);
+
+    caps = gst_caps_from_string(AUDIO_CAPS);
+    g_object_set(sink,
+                 "caps", caps,
+                 "sync", receiver->playout_delay > 0,
+                 NULL);
+    callbacks.new_sample = audio_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks,
+                               receiver_ref(receiver),
+                               (GDestroyNotify)receiver_unref);
+
+    g_signal_connect(decode, "pad-added", G_CALLBACK(decode_pad_added), pipeline);
+    return TRUE;
+}
+
+static GstElement *
+receiver_create_pipeline(Receiver *receiver) {
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstCaps) caps = NULL;
+    g_autoptr(GstPad) valve_pad = NULL;
+    g_autoptr(GstPad) convert_pad = NULL;
+    GstElement *src, *valve, *decode, *convert, *sink;
+    GstAppSinkCallbacks callbacks = { NULL };
+
+    pipeline = gst_object_ref_sink(gst_pipeline_new(NULL));
+    src = gst_element_factory_make("rtspsrc", "src");
+    valve = gst_element_factory_make("valve", "vvalve");
+    decode = gst_element_factory_make("decodebin", "vdecode");
+    convert = gst_element_factory_make("videoconvert", "vconvert");
+    sink = gst_element_factory_make("appsink", "vsink");
+    if (!src || !valve || !decode || !convert || !sink) {
+        g_warning("Missing GStreamer elements needed to receive %s", receiver->rtsp_url);
+        g_clear_object(&src);
+        g_clear_object(&valve);
+        g_clear_object(&decode);
+        g_clear_object(&convert);
+        g_clear_object(&sink);
+        return NULL;
+    }
+    gst_bin_add_many(GST_BIN(pipeline), src, valve, decode, convert, sink, NULL);
+
+    // AVPF lets a keyframe be requested straight away when leaving
+    // standby, rather than at the next regular RTCP report.
+    g_object_set(src,
+                 "location", receiver->rtsp_url,
+                 "latency", 0,
+                 "profiles", PROFILE_AVP | PROFILE_AVPF,
+                 NULL);
+
+    // In standby the session is kept up but nothing is decoded
+    valve_pad = gst_element_get_static_pad(valve, "sink");
+    gst_pad_add_probe(valve_pad, GST_PAD_PROBE_TYPE_BUFFER, arrival_probe,
+                      receiver, NULL);
+    gst_element_link(valve, decode);
+
+    caps = gst_caps_from_string(VIDEO_CAPS);
+    g_object_set(sink,
+                 "caps", caps,
+                 "sync", receiver->playout_delay > 0,
+                 "max-buffers", 2,
+                 "drop", TRUE,
+                 NULL);
+
+    if (receiver->playout_delay > 0) {
+        // Running time is the common clock's time, so buffer times
+        // derived from sender reports on the same clock line up
+        // across every receiver.
+        gst_pipeline_use_clock(GST_PIPELINE(pipeline), receiver->clock);
+        gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+        gst_element_set_base_time(pipeline, 0);
+        g_object_set(src,
+                     "latency", receiver->playout_delay,
+                     "ntp-sync", TRUE,
+                     "ntp-time-source", NTP_TIME_SOURCE_CLOCK_TIME,
+                     "buffer-mode", BUFFER_MODE_SYNCED,
+                     NULL);
+    } else {
+        // Keep the sender's RTP timestamps, so the playout buffer can
+        // measure skew against them.
+        g_object_set(src, "buffer-mode", BUFFER_MODE_NONE, NULL);
+    }
+    callbacks.new_sample = video_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks,
+                               receiver_ref(receiver),
+                               (GDestroyNotify)receiver_unref);
+
+    gst_element_link(convert, sink);
+    if (receiver->max_fps > 0) {
+        convert_pad = gst_element_get_static_pad(convert, "sink");
+        gst_pad_add_probe(convert_pad, GST_PAD_PROBE_TYPE_BUFFER, rate_probe,
+                          receiver, NULL);
+    }
+
+    g_signal_connect(src, "pad-added", G_CALLBACK(src_pad_added), pipeline);
+    g_signal_connect(decode, "pad-added", G_CALLBACK(decode_pad_added), pipeline);
+    g_signal_connect(decode, "autoplug-select",
+                     G_CALLBACK(decodebin_autoplug_select), receiver);
+    g_signal_connect(pipeline, "deep-element-added",
+                     G_CALLBACK(pipeline_deep_element_added), receiver);
+
+    if (receiver->audio_func && !receiver_add_audio(receiver, pipeline))
+        return NULL;
+
+    return g_steal_pointer(&pipeline);
+}
+
+static void receiver_schedule_reconnect(Receiver *receiver);
+
+static gboolean
+receiver_bus_message(GstBus *bus, GstMessage *message, void *user_data) {
+    Receiver *receiver = user_data;
+    g_autoptr(GError) error = NULL;
+
+    switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(message, &error, NULL);
+        g_warning("Error receiving %s: %s", receiver->rtsp_url, error->message);
+        receiver_schedule_reconnect(receiver);
+        break;
+
+    case GST_MESSAGE_EOS:
+        g_message("Stream %s ended", receiver->rtsp_url);
+        receiver_schedule_reconnect(receiver);
+        break;
+
+    default:
+        break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+// Pipelines are only started and stopped on the receiver thread, so
+// starts, stops and teardown never overlap.
+static void
+receiver_start(Receiver *receiver) {
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstBus) bus = NULL;
+    g_autoptr(GstElement) valve = NULL;
+    g_autoptr(GstElement) avalve = NULL;
+    GSource *bus_source;
+
+    pipeline = receiver_create_pipeline(receiver);
+    if (pipeline == NULL)
+        return;
+
+    bus = gst_element_get_bus(pipeline);
+    bus_source = gst_bus_create_watch(bus);
+    g_source_set_callback(bus_source, (GSourceFunc)receiver_bus_message,
+                          receiver_ref(receiver), (GDestroyNotify)receiver_unref);
+
+    g_mutex_lock(&receiver->lock);
+    if (receiver->closing) {
+        g_mutex_unlock(&receiver->lock);
+        g_source_unref(bus_source);
+        return;
+    }
+    g_source_attach(bus_source, receiver_context);
+    receiver->bus_source = bus_source;
+    receiver->pipeline = gst_object_ref(pipeline);
+    valve = gst_bin_get_by_name(GST_BIN(pipeline), "vvalve");
+    g_object_set(valve, "drop", receiver->standby, NULL);
+    avalve = gst_bin_get_by_name(GST_BIN(pipeline), "avalve");
+    if (avalve) {
+        g_object_set(avalve, "drop", receiver->standby, NULL);
+    }
+    g_mutex_unlock(&receiver->lock);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+}
+
+static void
+receiver_stop(Receiver *receiver) {
+    GstElement *pipeline;
+    GSource *bus_source;
+
+    g_mutex_lock(&receiver->lock);
+    pipeline = g_steal_pointer(&receiver->pipeline);
+    bus_source = g_steal_pointer(&receiver->bus_source);
+    g_mutex_unlock(&receiver->lock);
+
+    if (bus_source) {
+        g_source_destroy(bus_source);
+        g_source_unref(bus_source);
+    }
+    if (pipeline) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+    }
+}
+
+static gboolean
+receiver_reconnect(void *user_data) {
+    Receiver *receiver = user_data;
+
+    g_mutex_lock(&receiver->lock);
+    g_clear_pointer(&receiver->reconnect_source, g_source_unref);
+    g_mutex_unlock(&receiver->lock);
+
+    receiver_start(receiver);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+receiver_start_idle(void *user_data) {
+    receiver_start(user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+receiver_schedule_reconnect(Receiver *receiver) {
+    GSource *source;
+
+    receiver_stop(receiver);
+    if (receiver->playout) {
+        playout_reset(receiver->playout);
+    }
+    g_mutex_lock(&receiver->health_lock);
+    receiver->last_arrival = 0;
+    receiver->last_frame_arrival = 0;
+    g_mutex_unlock(&receiver->health_lock);
+    g_atomic_int_set(&receiver->view_pending, TRUE);
+
+    g_mutex_lock(&receiver->lock);
+    if (!receiver->closing && receiver->reconnect_source == NULL) {
+        if (receiver->stopped_func) {
+            receiver->stopped_func(receiver->user_data);
+        }
+
+        source = g_timeout_source_new_seconds(RECONNECT_DELAY);
+        g_source_set_callback(source, receiver_reconnect,
+                              receiver_ref(receiver), (GDestroyNotify)receiver_unref);
+        g_source_attach(source, receiver_context);
+        receiver->reconnect_source = source;
+    }
+    g_mutex_unlock(&receiver->lock);
+}
+
+Receiver *
+receiver_new(const char *rtsp_url, const char *clock, gboolean hw_decode,
+             guint playout_delay, gboolean standby, guint max_fps,
+             ReceiverVideoFunc video_func,
+             ReceiverAudioFunc audio_func, ReceiverStoppedFunc stopped_func,
+             void *user_data) {
+    Receiver *receiver = g_atomic_rc_box_new0(Receiver);
+    GSource *source;
+
+    g_assert(receiver_context != NULL);
+
+    receiver->rtsp_url = g_strdup(rtsp_url);
+    receiver->clock = receiver_get_clock(clock);
+    receiver->hw_decode = hw_decode;
+    receiver->playout_delay = playout_delay;
+    receiver->standby = standby;
+    receiver->max_fps = max_fps;
+    receiver->last_rate_pts = GST_CLOCK_TIME_NONE;
+    receiver->frame_interval = DEFAULT_FRAME_INTERVAL;
+    receiver->last_pts = GST_CLOCK_TIME_NONE;
+    receiver->video_func = video_func;
+    receiver->audio_func = audio_func;
+    receiver->stopped_func = stopped_func;
+    receiver->user_data = user_data;
+    g_mutex_init(&receiver->lock);
+    g_mutex_init(&receiver->stamp_lock);
+    g_mutex_init(&receiver->health_lock);
+
+    if (playout_delay == 0) {
+        receiver->playout = playout_new();
+        receiver->playout_thread = g_thread_new(
+            "rtsp-playout", receiver_playout_thread, receiver);
+    }
+    source = g_idle_source_new();
+    g_source_set_callback(source, receiver_start_idle,
+                          receiver_ref(receiver), (GDestroyNotify)receiver_unref);
+    g_source_attach(source, receiver_context);
+    g_source_unref(source);
+
+    return receiver;
+}
+
+void
+receiver_set_standby(Receiver *receiver, gboolean standby) {
+    g_autoptr(GstElement) valve = NULL;
+    g_autoptr(GstElement) avalve = NULL;
+
+    g_mutex_lock(&receiver->lock);
+    if (receiver->standby == standby) {
+        g_mutex_unlock(&receiver->lock);
+        return;
+    }
+    receiver->standby = standby;
+    if (receiver->pipeline) {
+        valve = gst_bin_get_by_name(GST_BIN(receiver->pipeline), "vvalve");
+        avalve = gst_bin_get_by_name(GST_BIN(receiver->pipeline), "avalve");
+    }
+    g_mutex_unlock(&receiver->lock);
+
+    if (avalve) {
+        g_object_set(avalve, "drop", standby, NULL);
+    }
+    if (valve == NULL)
+        return;
+    g_object_set(valve, "drop", standby, NULL);
+    if (!standby) {
+        // The decoder can only start from a keyframe
+        gst_element_send_event(
+            valve, gst_video_event_new_upstream_force_key_unit(
+                GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+}
+
+void
+receiver_set_view(Receiver *receiver, const char *view) {
+    g_mutex_lock(&receiver->lock);
+    g_free(receiver->view);
+    receiver->view = g_strdup(view);
+    g_mutex_unlock(&receiver->lock);
+
+    // Sent from the streaming thread once packets are arriving
+    g_atomic_int_set(&receiver->view_pending, TRUE);
+}
+
+gboolean
+receiver_is_stalled(Receiver *receiver) {
+    gint64 now = g_get_monotonic_time();
+    gint64 limit;
+    gboolean stalled;
+
+    g_mutex_lock(&receiver->health_lock);
+    limit = MAX((gint64)(receiver->frame_interval * STALL_FRAMES), MIN_STALL);
+    stalled = receiver->last_arrival == 0 || now - receiver->last_arrival > limit;
+    g_mutex_unlock(&receiver->health_lock);
+
+    return stalled;
+}
+
+gboolean
+receiver_get_playout_stats(Receiver *receiver, PlayoutStats *stats) {
+    if (receiver->playout == NULL)
+        return FALSE;
+
+    playout_get_stats(receiver->playout, stats);
+    return TRUE;
+}
+
+typedef struct {
+    Receiver *receiver;
+    GMutex lock;
+    GCond cond;
+    gboolean done;
+} Teardown;
+
+static gboolean
+receiver_teardown(void *user_data) {
+    Teardown *teardown = user_data;
+    Receiver *receiver = teardown->receiver;
+    GSource *reconnect_source;
+
+    g_mutex_lock(&receiver->lock);
+    reconnect_source = g_steal_pointer(&receiver->reconnect_source);
+    g_mutex_unlock(&receiver->lock);
+
+    if (reconnect_source) {
+        g_source_destroy(reconnect_source);
+        g_source_unref(reconnect_source);
+    }
+    receiver_stop(receiver);
+
+    g_mutex_lock(&teardown->lock);
+    teardown->done = TRUE;
+    g_cond_signal(&teardown->cond);
+    g_mutex_unlock(&teardown->lock);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+receiver_free(Receiver *receiver) {
+    Teardown teardown = { receiver };
+
+    if (receiver == NULL) return;
+
+    g_mutex_lock(&receiver->lock);
+    receiver->closing = TRUE;
+    g_mutex_unlock(&receiver->lock);
+
+    // Stop the pipeline on the receiver thread, after any start or
+    // reconnect already under way there, and wait for it: once it is
+    // shut down, no more callbacks will arrive.
+    g_mutex_init(&teardown.lock);
+    g_cond_init(&teardown.cond);
+    if (g_main_context_is_owner(receiver_context)) {
+        receiver_teardown(&teardown);
+    } else {
+        GSource *source = g_idle_source_new();
+
+        g_source_set_priority(source, G_PRIORITY_HIGH);
+        g_source_set_callback(source, receiver_teardown, &teardown, NULL);
+        g_source_attach(source, receiver_context);
+        g_source_unref(source);
+
+        g_mutex_lock(&teardown.lock);
+        while (!teardown.done) {
+            g_cond_wait(&teardown.cond, &teardown.lock);
+        }
+        g_mutex_unlock(&teardown.lock);
+    }
+    g_cond_clear(&teardown.cond);
+    g_mutex_clear(&teardown.lock);
+
+    if (receiver->playout_thread) {
+        playout_set_flushing(receiver->playout, TRUE);
+        g_thread_join(receiver->playout_thread);
+    }
+
+    receiver_unref(receiver);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/gst.h>
+
+#include "playout.h"
+
+typedef struct _Receiver Receiver;
+
+// Called from a streaming thread for each decoded frame.
+// capture_time is the frame's capture time in nanoseconds since the
+// NTP epoch if the sender stamped it, or GST_CLOCK_TIME_NONE.  If the
+// sender cropped or scaled the frame, the sample's info holds its
+// ViewRegion (see view_region_from_structure()).
+typedef void (*ReceiverVideoFunc)(GstSample *sample, GstClockTime capture_time,
+                                  void *user_data);
+
+// Called from a streaming thread for each block of decoded audio, as
+// interleaved 32-bit floats.  The buffer's PTS follows the stream's
+// RTP timestamps.
+typedef void (*ReceiverAudioFunc)(GstSample *sample, void *user_data);
+
+// Called from the receiver's thread when the stream stops, so any
+// displayed frame can be cleared.
+typedef void (*ReceiverStoppedFunc)(void *user_data);
+
+// Start and stop the thread that monitors all receivers' pipelines.
+void receiver_init(void);
+void receiver_deinit(void);
+
+// Current time on a common clock, in nanoseconds since the NTP epoch.
+// clock_uri is as for net_clock_new(); NULL or "" is the system clock.
+GstClockTime receiver_get_ntp_time(const char *clock_uri);
+
+// With a non-zero playout_delay (in milliseconds), frames are released
+// at their capture time on the common clock plus the delay, using the
+// sender's RTCP sender reports.  Receivers given the same clock and
+// delay play out in sync, without drifting.  Otherwise frames pass through an
+// adaptive playout buffer that smooths out network jitter and the
+// sender's clock skew.
+//
+// A receiver in standby keeps its session running but doesn't decode.
+//
+// A non-zero max_fps makes a low-cost preview: frames beyond that rate
+// are dropped before conversion, and software decoders get one thread.
+//
+// Without an audio_func, any audio stream is received but not decoded.
+Receiver *receiver_new(const char *rtsp_url, const char *clock,
+                       gboolean hw_decode, guint playout_delay,
+                       gboolean standby, guint max_fps,
+                       ReceiverVideoFunc video_func,
+                       ReceiverAudioFunc audio_func,
+                       ReceiverStoppedFunc stopped_func,
+                       void *user_data);
+void receiver_free(Receiver *receiver);
+
+// Leaving standby requests a keyframe so decoding can start at once
+void receiver_set_standby(Receiver *receiver, gboolean standby);
+
+// TRUE if no packets have arrived for about one and a half frame
+// intervals, or the stream isn't connected.
+gboolean receiver_is_stalled(Receiver *receiver);
+
+// Tell the sender what is shown of the stream, as an "obs-view"
+// parameter.  It is sent again whenever the stream reconnects.
+void receiver_set_view(Receiver *receiver, const char *view);
+
+// Returns FALSE if the receiver has no adaptive playout buffer
+gboolean receiver_get_playout_stats(Receiver *receiver, PlayoutStats *stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Receiver, receiver_free);
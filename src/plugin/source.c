@@ -1,8 +1,20 @@
 #include "source.h"
 #include <glib.h>
+#include <math.h>
+#include <obs/graphics/matrix4.h>
+#include <obs/util/platform.h>
 
 #include "mdns-browse.h"
 #include "active-notify.h"
+#include "histogram.h"
+#include "receiver.h"
+#include "receiver-source.h"
+
+#define LATENCY_LOG_INTERVAL 10.0f
+#define VIEW_INTERVAL 1.0f
+
+// How long a recovered primary must stay healthy before switching back
+#define RESTORE_DELAY (10 * 1000000000ULL)
 
 extern MdnsBrowser *mdns_browser;
 extern ActiveNotify *active_notify;
@@ -13,10 +25,33 @@ struct remote_source {
     // Settings
     char *service_name;
     char *rtsp_url;
+    char *backup_service_name;
+    char *backup_url;
     bool hw_decode;
+    bool measure_latency;
+    bool adapt_view;
+    int playout_delay;
+    char *clock;
     gint last_stamp;
 
     obs_source_t *media_source;
+    obs_source_t *backup_source;
+
+    // Failover.  The shown source lags behind the active one until
+    // the newly active one has decoded a frame.
+    bool on_backup;
+    uint64_t primary_healthy_since;
+    obs_source_t *shown_source;
+    uint64_t switch_frame_id;
+
+    // What is shown of the picture, as last sent to the senders
+    char *view;
+    float view_elapsed;
+
+    // Glass-to-glass latency measurement
+    Histogram *latency;
+    uint64_t last_frame_id;
+    float latency_log_elapsed;
 };
 
 static void remote_source_update(void *user_data, obs_data_t *settings);
@@ -33,8 +68,17 @@ remote_source_create(obs_data_t *settings, obs_source_t *source) {
     remote->source = source;
     remote->service_name = g_strdup("");
     remote->rtsp_url = NULL;
+    remote->latency = histogram_new();
+    remote->backup_service_name = g_strdup("");
     remote->media_source = obs_source_create_private(
-        "ffmpeg_source", NULL, NULL);
+        "rtsp_receiver_source", NULL, NULL);
+    remote->backup_source = obs_source_create_private(
+        "rtsp_receiver_source", NULL, NULL);
+    receiver_source_set_standby(remote->backup_source, true);
+    // Only the active child decodes, so only it outputs audio
+    receiver_source_set_audio_target(remote->media_source, source);
+    receiver_source_set_audio_target(remote->backup_source, source);
+    remote->shown_source = remote->media_source;
     remote_source_update(remote, settings);
 
     return remote;
@@ -45,36 +89,47 @@ remote_source_destroy(void *user_data) {
     struct remote_source *remote = user_data;
 
     obs_source_remove(remote->media_source);
+    obs_source_remove(remote->backup_source);
     g_clear_pointer(&remote->media_source, obs_source_release);
+    g_clear_pointer(&remote->backup_source, obs_source_release);
     g_clear_pointer(&remote->rtsp_url, g_free);
     g_clear_pointer(&remote->service_name, g_free);
+    g_clear_pointer(&remote->backup_url, g_free);
+    g_clear_pointer(&remote->backup_service_name, g_free);
+    g_clear_pointer(&remote->view, g_free);
+    g_clear_pointer(&remote->clock, g_free);
+    g_clear_pointer(&remote->latency, histogram_free);
 
     g_free(remote);
 }
 
 static void
 remote_source_get_defaults(obs_data_t *settings) {
+    obs_data_set_default_int(settings, "playout_delay", 0);
+    obs_data_set_default_string(settings, "clock", "system");
+    obs_data_set_default_bool(settings, "adapt_view", true);
 }
 
-static obs_properties_t *
-remote_source_get_properties(void *user_data) {
-    struct remote_source *remote = user_data;
-    obs_properties_t *props;
+static void
+add_service_list(obs_properties_t *props, const char *name,
+                 const char *description, const char *current,
+                 bool allow_none) {
     obs_property_t *service_list;
     bool service_found = false;
 
-    props = obs_properties_create();
-    obs_properties_set_flags(props, OBS_PROPERTIES_DEFER_UPDATE);
-
     service_list = obs_properties_add_list(
-        props, "service_name", "Service",
+        props, name, description,
         OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+    if (allow_none) {
+        obs_property_list_add_string(service_list, "None", "");
+        service_found = current[0] == '\0';
+    }
     if (mdns_browser) {
         g_auto(GStrv) names = mdns_browser_get_available(mdns_browser);
         int i;
 
         for (i = 0; names[i] != NULL; i++) {
-            if (!g_strcmp0(remote->service_name, names[i])) {
+            if (!g_strcmp0(current, names[i])) {
                 service_found = true;
             }
             obs_property_list_add_string(service_list, names[i], names[i]);
@@ -82,39 +137,190 @@ remote_source_get_properties(void *user_data) {
     }
     if (!service_found) {
         size_t index = obs_property_list_add_string(
-            service_list, remote->service_name, remote->service_name);
+            service_list, current, current);
         obs_property_list_item_disable(service_list, index, true);
     }
+}
+
+// Returning true has the dialog fetch the properties again
+static bool
+refresh_stats_clicked(obs_properties_t *props, obs_property_t *property,
+                      void *user_data) {
+    return true;
+}
+
+static obs_properties_t *
+remote_source_get_properties(void *user_data) {
+    struct remote_source *remote = user_data;
+    obs_properties_t *props;
+    obs_property_t *prop;
+    PlayoutStats playout;
+    bool has_stats = false;
+
+    props = obs_properties_create();
+    obs_properties_set_flags(props, OBS_PROPERTIES_DEFER_UPDATE);
+
+    add_service_list(props, "service_name", "Service",
+                     remote->service_name, false);
+    add_service_list(props, "backup_service_name", "Backup service",
+                     remote->backup_service_name, true);
+    prop = obs_properties_get(props, "backup_service_name");
+    obs_property_set_long_description(
+        prop, "A second sender for the same camera.  Its stream is kept "
+        "connected and is switched to as soon as the main service stalls.");
 
     obs_properties_add_bool(props, "hw_decode",
                             "Use hardware decoding when available");
 
+    prop = obs_properties_add_int(props, "playout_delay",
+                                  "Synchronised playout delay", 0, 5000, 10);
+    obs_property_int_set_suffix(prop, " ms");
+    obs_property_set_long_description(
+        prop, "Sources with the same delay play out in sync with each other.  "
+        "0 adapts the buffering to the network instead.");
+
+    prop = obs_properties_add_text(props, "clock", "Common clock", OBS_TEXT_DEFAULT);
+    obs_property_set_long_description(
+        prop, "system, ntp://HOST[:PORT] or ptp://DOMAIN, matching the senders' "
+        "--clock.  Sources played out in sync must use the same clock.");
+
+    prop = obs_properties_add_bool(props, "adapt_view",
+                                   "Only ask for the part of the picture that is shown");
+    obs_property_set_long_description(
+        prop, "When the source is scaled down or cropped in its scenes, the "
+        "sender can crop, scale and reduce the frame rate before encoding.  "
+        "Turn this off if the source is shown full size some other way, "
+        "such as in a projector.");
+
+    obs_properties_add_bool(props, "measure_latency",
+                            "Measure glass-to-glass latency (needs sender timestamps)");
+    if (remote->measure_latency && histogram_get_count(remote->latency) > 0) {
+        g_autoptr(GString) stats = g_string_new(NULL);
+
+        g_string_append_printf(
+            stats, "Latency p50/p95/p99: %.1f / %.1f / %.1f ms (%" G_GUINT64_FORMAT " frames)\n",
+            histogram_get_percentile(remote->latency, 0.50) / 1000.0,
+            histogram_get_percentile(remote->latency, 0.95) / 1000.0,
+            histogram_get_percentile(remote->latency, 0.99) / 1000.0,
+            histogram_get_count(remote->latency));
+        histogram_format_bars(remote->latency, stats, 10, 1000.0);
+        obs_properties_add_text(props, "latency_stats", stats->str, OBS_TEXT_INFO);
+        has_stats = true;
+    }
+    if (remote->on_backup) {
+        obs_properties_add_text(props, "failover_status",
+                                "Showing the backup service", OBS_TEXT_INFO);
+    }
+    if (receiver_source_get_playout_stats(remote->shown_source, &playout)) {
+        g_autofree char *text = g_strdup_printf(
+            "Playout target %.1f ms, depth %u frames / %.1f ms, "
+            "clock skew %+.0f ppm, %" G_GUINT64_FORMAT " dropped",
+            playout.target_ms, playout.depth_frames, playout.depth_ms,
+            playout.skew_ppm, playout.dropped);
+
+        obs_properties_add_text(props, "playout_stats", text, OBS_TEXT_INFO);
+        has_stats = true;
+    }
+    // Rebuilding the dialog on a timer would interrupt editing it
+    if (has_stats) {
+        obs_properties_add_button(props, "refresh_stats", "Refresh statistics",
+                                  refresh_stats_clicked);
+    }
+
     return props;
 }
 
 static void
-remote_source_update_media_source(struct remote_source *remote) {
+remote_source_update_media_source(struct remote_source *remote,
+                                  obs_source_t *media_source,
+                                  const char *rtsp_url) {
     obs_data_t *media_settings;
 
     media_settings = obs_data_create();
-    obs_data_set_bool(media_settings, "is_local_file", false);
-    obs_data_set_string(media_settings, "input",
-                        remote->rtsp_url ? remote->rtsp_url : "");
-    obs_data_set_string(media_settings, "input_format", "");
-    obs_data_set_int(media_settings, "reconnect_delay_sec", 10);
-    obs_data_set_int(media_settings, "buffering_mb", 0);
-    obs_data_set_int(media_settings, "speed_percent", 100);
-    obs_data_set_bool(media_settings, "close_when_inactive", false);
-    obs_data_set_bool(media_settings, "clear_on_media_end", true);
-    obs_data_set_bool(media_settings, "restart_on_activate", false);
-    obs_data_set_bool(media_settings, "seekable", false);
+    obs_data_set_string(media_settings, "rtsp_url", rtsp_url ? rtsp_url : "");
     obs_data_set_bool(media_settings, "hw_decode", remote->hw_decode);
+    obs_data_set_int(media_settings, "playout_delay", remote->playout_delay);
+    obs_data_set_string(media_settings, "clock", remote->clock ? remote->clock : "");
 
-    obs_source_update(remote->media_source, media_settings);
+    obs_source_update(media_source, media_settings);
 
     obs_data_release(media_settings);
 }
 
+static const char *
+remote_source_get_active_url(struct remote_source *remote) {
+    return remote->on_backup ? remote->backup_url : remote->rtsp_url;
+}
+
+static void
+remote_source_set_on_backup(struct remote_source *remote, bool on_backup) {
+    obs_source_t *from, *to;
+    uint64_t capture_time;
+
+    if (on_backup == remote->on_backup)
+        return;
+
+    from = on_backup ? remote->media_source : remote->backup_source;
+    to = on_backup ? remote->backup_source : remote->media_source;
+    g_message("Switching %s to its %s service", remote->service_name,
+              on_backup ? "backup" : "main");
+
+    if (obs_source_active(remote->source)) {
+        if (remote_source_get_active_url(remote)) {
+            active_notify_send(active_notify, remote_source_get_active_url(remote), FALSE);
+        }
+    }
+    receiver_source_get_last_frame(to, &remote->switch_frame_id, &capture_time);
+    receiver_source_set_standby(to, false);
+    receiver_source_set_standby(from, true);
+    remote->on_backup = on_backup;
+    remote->primary_healthy_since = 0;
+    if (obs_source_active(remote->source)) {
+        if (remote_source_get_active_url(remote)) {
+            active_notify_send(active_notify, remote_source_get_active_url(remote), TRUE);
+        }
+    }
+}
+
+static void
+remote_source_check_failover(struct remote_source *remote) {
+    bool primary_ok, backup_ok;
+    obs_source_t *active;
+    uint64_t frame_id, capture_time, now;
+
+    primary_ok = remote->rtsp_url &&
+        receiver_source_is_healthy(remote->media_source);
+    backup_ok = remote->backup_url &&
+        receiver_source_is_healthy(remote->backup_source);
+
+    if (!remote->on_backup) {
+        if (!primary_ok && backup_ok) {
+            remote_source_set_on_backup(remote, true);
+        }
+    } else if (primary_ok) {
+        // Go back to the main service once it is reliable again, or
+        // straight away if the backup has failed too.
+        now = os_gettime_ns();
+        if (remote->primary_healthy_since == 0) {
+            remote->primary_healthy_since = now;
+        }
+        if (!backup_ok || now - remote->primary_healthy_since >= RESTORE_DELAY) {
+            remote_source_set_on_backup(remote, false);
+        }
+    } else {
+        remote->primary_healthy_since = 0;
+    }
+
+    // Keep showing the old stream until the new one has a frame
+    active = remote->on_backup ? remote->backup_source : remote->media_source;
+    if (remote->shown_source != active) {
+        receiver_source_get_last_frame(active, &frame_id, &capture_time);
+        if (frame_id != remote->switch_frame_id) {
+            remote->shown_source = active;
+        }
+    }
+}
+
 static void
 remote_source_update(void *user_data, obs_data_t *settings) {
     struct remote_source *remote = user_data;
@@ -123,63 +329,133 @@ remote_source_update(void *user_data, obs_data_t *settings) {
     // Set RTSP URL from settings
     g_clear_pointer(&remote->service_name, g_free);
     remote->service_name = g_strdup(obs_data_get_string(settings, "service_name"));
+    g_clear_pointer(&remote->backup_service_name, g_free);
+    remote->backup_service_name = g_strdup(
+        obs_data_get_string(settings, "backup_service_name"));
     remote->hw_decode = obs_data_get_bool(settings, "hw_decode");
+    remote->playout_delay = (int)obs_data_get_int(settings, "playout_delay");
+    g_clear_pointer(&remote->clock, g_free);
+    remote->clock = g_strdup(obs_data_get_string(settings, "clock"));
+    if (obs_data_get_bool(settings, "adapt_view") != remote->adapt_view) {
+        remote->adapt_view = !remote->adapt_view;
+        remote->view_elapsed = VIEW_INTERVAL;
+    }
+    if (obs_data_get_bool(settings, "measure_latency") != remote->measure_latency) {
+        remote->measure_latency = !remote->measure_latency;
+        histogram_reset(remote->latency);
+    }
 
     g_clear_pointer(&remote->rtsp_url, g_free);
+    g_clear_pointer(&remote->backup_url, g_free);
     if (mdns_browser) {
         remote->rtsp_url = mdns_browser_get_uri(
             mdns_browser, remote->service_name, &remote->last_stamp);
+        if (remote->backup_service_name[0] != '\0') {
+            remote->backup_url = mdns_browser_get_uri(
+                mdns_browser, remote->backup_service_name, NULL);
+        }
     }
     g_message("rtsp url for %s is %s", remote->service_name, remote->rtsp_url);
 
-    remote_source_update_media_source(remote);
+    if (remote->backup_service_name[0] == '\0') {
+        remote_source_set_on_backup(remote, false);
+    }
+    remote_source_update_media_source(remote, remote->media_source,
+                                      remote->rtsp_url);
+    remote_source_update_media_source(remote, remote->backup_source,
+                                      remote->backup_url);
+}
+
+// Where the shown frame sits in the camera's full picture, if the
+// sender cropped or scaled it.
+static bool
+remote_source_get_region(struct remote_source *remote, ViewRegion *region) {
+    return obs_source_get_width(remote->shown_source) > 0 &&
+        receiver_source_get_region(remote->shown_source, region);
 }
 
 static uint32_t
 remote_source_get_height(void *user_data)
 {
     struct remote_source *remote = user_data;
+    ViewRegion region;
 
-    return obs_source_get_height(remote->media_source);
+    // Keep the full size, so scene items don't move as the view changes
+    if (remote_source_get_region(remote, &region))
+        return region.full_height;
+    return obs_source_get_height(remote->shown_source);
 }
 
 static uint32_t
 remote_source_get_width(void *user_data)
 {
     struct remote_source *remote = user_data;
+    ViewRegion region;
 
-    return obs_source_get_width(remote->media_source);
+    if (remote_source_get_region(remote, &region))
+        return region.full_width;
+    return obs_source_get_width(remote->shown_source);
 }
 
 static void
 remote_source_activate(void *user_data) {
     struct remote_source *remote = user_data;
 
-    if (remote->rtsp_url != NULL) {
-        active_notify_send(active_notify, remote->rtsp_url, TRUE);
+    if (remote_source_get_active_url(remote) != NULL) {
+        active_notify_send(active_notify, remote_source_get_active_url(remote), TRUE);
     }
     obs_source_add_active_child(remote->source, remote->media_source);
+    obs_source_add_active_child(remote->source, remote->backup_source);
 }
 
 static void
 remote_source_deactivate(void *user_data) {
     struct remote_source *remote = user_data;
 
-    if (remote->rtsp_url != NULL) {
-        active_notify_send(active_notify, remote->rtsp_url, FALSE);
+    if (remote_source_get_active_url(remote) != NULL) {
+        active_notify_send(active_notify, remote_source_get_active_url(remote), FALSE);
     }
     obs_source_remove_active_child(remote->source, remote->media_source);
+    obs_source_remove_active_child(remote->source, remote->backup_source);
 }
 
 static void
-remote_source_video_tick(void *user_data, float seconds) {
-    struct remote_source *remote = user_data;
-    gint new_stamp;
-    g_autofree char *new_url = NULL;
+remote_source_measure_latency(struct remote_source *remote) {
+    uint64_t frame_id, capture_time, now;
 
-    if (!mdns_browser) {
+    // Only count the first render of each frame
+    receiver_source_get_last_frame(remote->shown_source, &frame_id, &capture_time);
+    if (frame_id == remote->last_frame_id)
         return;
+    remote->last_frame_id = frame_id;
+
+    now = receiver_get_ntp_time(remote->clock);
+    if (capture_time != 0 && now > capture_time) {
+        histogram_add(remote->latency, (now - capture_time) / 1000);
     }
+}
+
+static void
+remote_source_latency_tick(struct remote_source *remote, float seconds) {
+    remote->latency_log_elapsed += seconds;
+
+    if (remote->latency_log_elapsed >= LATENCY_LOG_INTERVAL) {
+        remote->latency_log_elapsed = 0;
+        if (histogram_get_count(remote->latency) > 0) {
+            g_message("Latency for %s p50/p95/p99: %.1f / %.1f / %.1f ms",
+                      remote->service_name,
+                      histogram_get_percentile(remote->latency, 0.50) / 1000.0,
+                      histogram_get_percentile(remote->latency, 0.95) / 1000.0,
+                      histogram_get_percentile(remote->latency, 0.99) / 1000.0);
+        }
+    }
+}
+
+static void
+remote_source_check_services(struct remote_source *remote) {
+    gint new_stamp;
+    g_autofree char *new_url = NULL;
+    g_autofree char *new_backup_url = NULL;
 
     // Perform quick check to see if service browser state has changed
     new_stamp = mdns_browser_get_stamp(mdns_browser);
@@ -187,17 +463,226 @@ remote_source_video_tick(void *user_data, float seconds) {
         return;
     }
 
-    // Is the new URL for our service different?
+    // Are the new URLs for our services different?
     new_url = mdns_browser_get_uri(
         mdns_browser, remote->service_name, &remote->last_stamp);
     if (g_strcmp0(new_url, remote->rtsp_url) != 0) {
         g_clear_pointer(&remote->rtsp_url, g_free);
         remote->rtsp_url = g_steal_pointer(&new_url);
-        remote_source_update_media_source(remote);
+        remote_source_update_media_source(remote, remote->media_source,
+                                          remote->rtsp_url);
+    }
+    if (remote->backup_service_name[0] != '\0') {
+        new_backup_url = mdns_browser_get_uri(
+            mdns_browser, remote->backup_service_name, NULL);
+    }
+    if (g_strcmp0(new_backup_url, remote->backup_url) != 0) {
+        g_clear_pointer(&remote->backup_url, g_free);
+        remote->backup_url = g_steal_pointer(&new_backup_url);
+        remote_source_update_media_source(remote, remote->backup_source,
+                                          remote->backup_url);
     }
     obs_source_update_properties(remote->source);
 }
 
+struct view_area {
+    bool found;
+    // In pixels of the full picture
+    double x0, y0, x1, y1;
+    // Output pixels per picture pixel
+    double density_x, density_y;
+};
+
+struct view_search {
+    obs_source_t *source;
+    // Scaling from enclosing groups and the output resolution
+    double scale_x, scale_y;
+    // What crop filters leave of the full picture
+    double left, top, width, height;
+    struct view_area *area;
+};
+
+static void
+remote_source_find_crop(obs_source_t *parent, obs_source_t *filter,
+                        void *param) {
+    struct view_search *search = param;
+    obs_data_t *settings;
+    double left, top, right, bottom, cx, cy;
+
+    if (!obs_source_enabled(filter) ||
+        g_strcmp0(obs_source_get_unversioned_id(filter), "crop_filter") != 0)
+        return;
+
+    settings = obs_source_get_settings(filter);
+    left = (double)obs_data_get_int(settings, "left");
+    top = (double)obs_data_get_int(settings, "top");
+    if (obs_data_get_bool(settings, "relative")) {
+        right = (double)obs_data_get_int(settings, "right");
+        bottom = (double)obs_data_get_int(settings, "bottom");
+    } else {
+        // A size of 0 reaches the edge
+        cx = (double)obs_data_get_int(settings, "cx");
+        cy = (double)obs_data_get_int(settings, "cy");
+        right = cx > 0 ? search->width - left - cx : 0.0;
+        bottom = cy > 0 ? search->height - top - cy : 0.0;
+    }
+    obs_data_release(settings);
+
+    // Negative values pad rather than crop
+    left = MAX(left, 0.0);
+    top = MAX(top, 0.0);
+    right = MAX(right, 0.0);
+    bottom = MAX(bottom, 0.0);
+    if (left + right >= search->width || top + bottom >= search->height)
+        return;
+
+    // Filters apply in turn, each cropping what the last one left
+    search->left += left;
+    search->top += top;
+    search->width -= left + right;
+    search->height -= top + bottom;
+}
+
+static bool
+remote_source_find_items(obs_scene_t *scene, obs_sceneitem_t *item,
+                         void *param) {
+    struct view_search *search = param;
+    struct view_area *area = search->area;
+    struct obs_sceneitem_crop crop;
+    struct matrix4 transform;
+    double scale_x, scale_y, x0, y0, x1, y1;
+
+    if (!obs_sceneitem_visible(item))
+        return true;
+
+    obs_sceneitem_get_draw_transform(item, &transform);
+    scale_x = search->scale_x * hypot(transform.x.x, transform.x.y);
+    scale_y = search->scale_y * hypot(transform.y.x, transform.y.y);
+
+    if (obs_sceneitem_is_group(item)) {
+        struct view_search inner = *search;
+
+        inner.scale_x = scale_x;
+        inner.scale_y = scale_y;
+        obs_sceneitem_group_enum_items(item, remote_source_find_items, &inner);
+        return true;
+    }
+    if (obs_sceneitem_get_source(item) != search->source)
+        return true;
+
+    obs_sceneitem_get_crop(item, &crop);
+    x0 = search->left + MIN(crop.left, search->width);
+    y0 = search->top + MIN(crop.top, search->height);
+    x1 = MAX(search->left + search->width - crop.right, x0 + 1.0);
+    y1 = MAX(search->top + search->height - crop.bottom, y0 + 1.0);
+
+    if (!area->found) {
+        area->x0 = x0;
+        area->y0 = y0;
+        area->x1 = x1;
+        area->y1 = y1;
+        area->found = true;
+    }
+    area->x0 = MIN(area->x0, x0);
+    area->y0 = MIN(area->y0, y0);
+    area->x1 = MAX(area->x1, x1);
+    area->y1 = MAX(area->y1, y1);
+    area->density_x = MAX(area->density_x, scale_x);
+    area->density_y = MAX(area->density_y, scale_y);
+    return true;
+}
+
+static bool
+remote_source_find_in_scene(void *param, obs_source_t *scene_source) {
+    obs_scene_t *scene = obs_scene_from_source(scene_source);
+
+    if (scene) {
+        obs_scene_enum_items(scene, remote_source_find_items, param);
+    }
+    return true;
+}
+
+static char *
+remote_source_format_view(const struct view_area *area, double width,
+                          double height, const struct obs_video_info *ovi) {
+    char x0[G_ASCII_DTOSTR_BUF_SIZE], y0[G_ASCII_DTOSTR_BUF_SIZE];
+    char x1[G_ASCII_DTOSTR_BUF_SIZE], y1[G_ASCII_DTOSTR_BUF_SIZE];
+    // Never more than the full resolution
+    double density_x = MIN(area->density_x, 1.0);
+    double density_y = MIN(area->density_y, 1.0);
+
+    g_ascii_formatd(x0, sizeof(x0), "%.4f", area->x0 / width);
+    g_ascii_formatd(y0, sizeof(y0), "%.4f", area->y0 / height);
+    g_ascii_formatd(x1, sizeof(x1), "%.4f", MIN(area->x1 / width, 1.0));
+    g_ascii_formatd(y1, sizeof(y1), "%.4f", MIN(area->y1 / height, 1.0));
+    return g_strdup_printf("size=%ux%u crop=%s,%s,%s,%s fps=%u/%u",
+                           (unsigned)ceil((area->x1 - area->x0) * density_x),
+                           (unsigned)ceil((area->y1 - area->y0) * density_y),
+                           x0, y0, x1, y1, ovi->fps_num, ovi->fps_den);
+}
+
+// Tell the senders the largest size, the union of the crops and the
+// frame rate this source is shown at across all scenes.
+static void
+remote_source_update_view(struct remote_source *remote) {
+    struct view_area area = { 0 };
+    struct view_search search = { 0 };
+    struct obs_video_info ovi = { 0 };
+    g_autofree char *view = NULL;
+    ViewRegion region;
+    double width, height;
+
+    if (remote_source_get_region(remote, &region)) {
+        width = region.full_width;
+        height = region.full_height;
+    } else {
+        width = obs_source_get_width(remote->shown_source);
+        height = obs_source_get_height(remote->shown_source);
+    }
+
+    if (remote->adapt_view && width > 0 && height > 0 &&
+        obs_get_video_info(&ovi) && ovi.base_width > 0 && ovi.base_height > 0) {
+        search.source = remote->source;
+        search.scale_x = (double)ovi.output_width / ovi.base_width;
+        search.scale_y = (double)ovi.output_height / ovi.base_height;
+        search.width = width;
+        search.height = height;
+        search.area = &area;
+        obs_source_enum_filters(remote->source, remote_source_find_crop, &search);
+        obs_enum_scenes(remote_source_find_in_scene, &search);
+    }
+    // Not in any scene: it may be shown some other way
+    view = area.found ? remote_source_format_view(&area, width, height, &ovi)
+        : g_strdup("none");
+
+    if (g_strcmp0(view, remote->view) == 0)
+        return;
+    g_clear_pointer(&remote->view, g_free);
+    remote->view = g_steal_pointer(&view);
+    receiver_source_set_view(remote->media_source, remote->view);
+    receiver_source_set_view(remote->backup_source, remote->view);
+}
+
+static void
+remote_source_video_tick(void *user_data, float seconds) {
+    struct remote_source *remote = user_data;
+
+    remote->view_elapsed += seconds;
+    if (remote->view_elapsed >= VIEW_INTERVAL) {
+        remote->view_elapsed = 0;
+        remote_source_update_view(remote);
+    }
+
+    if (remote->measure_latency) {
+        remote_source_latency_tick(remote, seconds);
+    }
+
+    if (mdns_browser) {
+        remote_source_check_services(remote);
+    }
+    remote_source_check_failover(remote);
+}
+
 static void
 remote_source_enum_active_sources(void *user_data,
                                   obs_source_enum_proc_t enum_callback,
@@ -206,6 +691,8 @@ remote_source_enum_active_sources(void *user_data,
 
     if (obs_source_active(remote->media_source))
         enum_callback(remote->source, remote->media_source, param);
+    if (obs_source_active(remote->backup_source))
+        enum_callback(remote->source, remote->backup_source, param);
 }
 
 static void
@@ -215,57 +702,38 @@ remote_source_enum_all_sources(void *user_data,
     struct remote_source *remote = user_data;
 
     enum_callback(remote->source, remote->media_source, param);
+    enum_callback(remote->source, remote->backup_source, param);
 }
 
 static void
 remote_source_video_render(void *user_data, gs_effect_t *effect) {
     struct remote_source *remote = user_data;
-
-    obs_source_video_render(remote->media_source);
-}
-
-static bool
-remote_source_audio_render(void *user_data,
-                           uint64_t *ts_out,
-                           struct obs_source_audio_mix *audio_output,
-                           uint32_t mixers,
-                           size_t channels,
-                           size_t sample_rate) {
-    struct remote_source *remote = user_data;
-    struct obs_source_audio_mix child_audio;
-    uint64_t source_ts;
-
-    if (obs_source_audio_pending(remote->media_source))
-        return false;
-
-    source_ts = obs_source_get_audio_timestamp(remote->media_source);
-    if (!source_ts)
-        return false;
-
-    obs_source_get_audio_mix(remote->media_source, &child_audio);
-    for (size_t mix = 0; mix < MAX_AUDIO_MIXES; mix++) {
-        if ((mixers & (1 << mix)) == 0)
-            continue;
-
-        for (size_t ch = 0; ch < channels; ch++) {
-            float *out = audio_output->output[mix].data[ch];
-            float *in = child_audio.output[mix].data[ch];
-
-            memcpy(out, in,
-                   AUDIO_OUTPUT_FRAMES * MAX_AUDIO_CHANNELS * sizeof(float));
-        }
+    ViewRegion region;
+
+    if (remote_source_get_region(remote, &region)) {
+        // Put a cropped or scaled frame back in its place
+        gs_matrix_push();
+        gs_matrix_translate3f((float)region.x, (float)region.y, 0.0f);
+        gs_matrix_scale3f(
+            (float)region.width / obs_source_get_width(remote->shown_source),
+            (float)region.height / obs_source_get_height(remote->shown_source),
+            1.0f);
+        obs_source_video_render(remote->shown_source);
+        gs_matrix_pop();
+    } else {
+        obs_source_video_render(remote->shown_source);
     }
 
-    *ts_out = source_ts;
-
-    return true;
+    if (remote->measure_latency) {
+        remote_source_measure_latency(remote);
+    }
 }
 
 struct obs_source_info remote_source = {
     .id = "rtsp_remote_source",
     .type = OBS_SOURCE_TYPE_INPUT,
     .icon_type = OBS_ICON_TYPE_MEDIA,
-    .output_flags = (OBS_SOURCE_VIDEO | OBS_SOURCE_COMPOSITE |
+    .output_flags = (OBS_SOURCE_VIDEO | OBS_SOURCE_AUDIO |
                      OBS_SOURCE_DO_NOT_DUPLICATE),
 
     .get_name = remote_source_get_name,
@@ -287,5 +755,4 @@ struct obs_source_info remote_source = {
     .enum_active_sources = remote_source_enum_active_sources,
     .enum_all_sources = remote_source_enum_all_sources,
     .video_render = remote_source_video_render,
-    .audio_render = remote_source_audio_render,
 };
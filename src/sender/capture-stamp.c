@@ -0,0 +1,65 @@
+#include "capture-stamp.h"
+
+#include <gst/rtp/rtp.h>
+
+#include "net-clock.h"
+
+#define NTP_64_URI "urn:ietf:params:rtp-hdrext:ntp-64"
+#define NTP_64_ID 1
+
+static GstPadProbeReturn
+stamp_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    static GstCaps *ntp_caps = NULL;
+    g_autoptr(GstElement) element = NULL;
+    g_autoptr(GstClock) clock = NULL;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime capture_time;
+
+    if (g_once_init_enter(&ntp_caps)) {
+        g_once_init_leave(&ntp_caps, gst_caps_new_empty_simple("timestamp/x-ntp"));
+    }
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    // Running time plus base time gives the clock time at capture
+    element = gst_pad_get_parent_element(pad);
+    clock = gst_element_get_clock(element);
+    if (clock == NULL)
+        return GST_PAD_PROBE_OK;
+    capture_time = gst_element_get_base_time(element) + GST_BUFFER_PTS(buffer);
+
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_add_reference_timestamp_meta(
+        buffer, ntp_caps, net_clock_to_ntp(clock, capture_time),
+        GST_CLOCK_TIME_NONE);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    return GST_PAD_PROBE_OK;
+}
+
+void
+capture_stamp_attach(GstRTSPMedia *media, const char *path) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstRTPHeaderExtension) ext = NULL;
+    g_autoptr(GstPad) pad = NULL;
+
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    if (pay == NULL) {
+        g_warning("Cannot add timestamps to '%s': no pay0 element", path);
+        return;
+    }
+
+    ext = gst_rtp_header_extension_create_from_uri(NTP_64_URI);
+    if (ext == NULL) {
+        g_warning("Cannot add timestamps to '%s': no RTP header extension for %s",
+                  path, NTP_64_URI);
+        return;
+    }
+    gst_rtp_header_extension_set_id(ext, NTP_64_ID);
+    g_signal_emit_by_name(pay, "add-extension", ext);
+
+    pad = gst_element_get_static_pad(pay, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stamp_probe, NULL, NULL);
+}
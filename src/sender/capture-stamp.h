@@ -0,0 +1,8 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+// Stamp the capture time of each frame into the RTP stream produced
+// by pay0, using the NTP-64 RTP header extension (RFC 6051).
+void capture_stamp_attach(GstRTSPMedia *media, const char *path);
@@ -0,0 +1,317 @@
+#include "capture-watchdog.h"
+
+#include "media-util.h"
+
+#define CHECK_INTERVAL_MS 100
+
+// One watched media's capture source
+typedef struct {
+    GstRTSPMedia *media;
+    GstElement *pipeline;
+    GstElement *source;
+    GstPad *pad;
+    gulong probe;
+    gint frames;
+    gint failed;
+    gint restarting;
+
+    // Only used from the main loop
+    gint seen;
+    gint64 last_frame;
+} Watch;
+
+struct _CaptureWatchdog {
+    char *path;
+    gint64 timeout;
+    guint check_source;
+
+    GMutex lock;
+    GPtrArray *watches;
+    guint64 restarts;
+    gint64 last_restart_us;
+};
+
+static Watch *
+watch_ref(Watch *watch) {
+    return g_atomic_rc_box_acquire(watch);
+}
+
+static void
+watch_clear(Watch *watch) {
+    g_clear_object(&watch->pad);
+    g_clear_object(&watch->source);
+    g_clear_object(&watch->pipeline);
+    g_clear_object(&watch->media);
+}
+
+static void
+watch_unref(Watch *watch) {
+    g_atomic_rc_box_release_full(watch, (GDestroyNotify)watch_clear);
+}
+
+static GstPadProbeReturn
+source_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    Watch *watch = user_data;
+
+    if (info->type & (GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST)) {
+        g_atomic_int_inc(&watch->frames);
+        return GST_PAD_PROBE_OK;
+    }
+
+    // A failing source sends EOS after its error.  Keep it from
+    // ending the stream, since the source will be restarted, but let
+    // any other EOS end it as usual.
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS &&
+        (g_atomic_int_get(&watch->failed) || g_atomic_int_get(&watch->restarting)))
+        return GST_PAD_PROBE_DROP;
+    return GST_PAD_PROBE_OK;
+}
+
+// Runs in the thread posting the message, ahead of the media's own
+// bus watch.
+static GstBusSyncReply
+bus_sync_handler(GstMessage *message, void *user_data) {
+    Watch *watch = user_data;
+    GstObject *src = GST_MESSAGE_SRC(message);
+
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ERROR)
+        return GST_BUS_PASS;
+    if (src != GST_OBJECT(watch->source) &&
+        !gst_object_has_as_ancestor(src, GST_OBJECT(watch->source)))
+        return GST_BUS_PASS;
+
+    g_atomic_int_set(&watch->failed, TRUE);
+    return GST_BUS_DROP;
+}
+
+// Drop the probe's and sync handler's references, which the pipeline
+// holds.
+static void
+watch_stop(Watch *watch) {
+    gst_pad_remove_probe(watch->pad, watch->probe);
+    media_util_remove_sync_handler(watch->media, bus_sync_handler, watch);
+}
+
+typedef struct {
+    CaptureWatchdog *watchdog;
+    Watch *watch;
+    char *reason;
+} Restart;
+
+static void
+restart_free(Restart *restart) {
+    g_atomic_int_set(&restart->watch->restarting, FALSE);
+    watch_unref(restart->watch);
+    capture_watchdog_unref(restart->watchdog);
+    g_free(restart->reason);
+    g_free(restart);
+}
+
+// Runs on one of GStreamer's threads, since reopening a device can
+// take a while.
+static void
+capture_watchdog_restart(GstElement *source, void *user_data) {
+    Restart *restart = user_data;
+    CaptureWatchdog *watchdog = restart->watchdog;
+    Watch *watch = restart->watch;
+    const char *reason = restart->reason;
+    g_autoptr(GstClock) clock = gst_element_get_clock(watch->pipeline);
+    gint64 start = g_get_monotonic_time();
+    gboolean restarted;
+    gint64 elapsed;
+
+    gst_element_set_state(watch->source, GST_STATE_NULL);
+    // Cleared only now the source has stopped, so its EOS is dropped
+    g_atomic_int_set(&watch->failed, FALSE);
+    // Rejoin the pipeline as an element added while playing would,
+    // so its timestamps carry on from the running time.
+    gst_element_set_clock(watch->source, clock);
+    gst_element_set_base_time(watch->source, gst_element_get_base_time(watch->pipeline));
+    restarted = gst_element_sync_state_with_parent(watch->source);
+    elapsed = g_get_monotonic_time() - start;
+
+    g_mutex_lock(&watchdog->lock);
+    watchdog->restarts++;
+    watchdog->last_restart_us = elapsed;
+    g_mutex_unlock(&watchdog->lock);
+
+    if (!restarted) {
+        g_warning("Could not restart capture for '%s' after %s", watchdog->path, reason);
+    } else {
+        g_message("Restarted capture for '%s' after %s in %.1f ms",
+                  watchdog->path, reason, elapsed / 1000.0);
+    }
+}
+
+// Only one restart of a source runs at a time
+static void
+capture_watchdog_start_restart(CaptureWatchdog *watchdog, Watch *watch,
+                               char *reason) {
+    Restart *restart = g_new0(Restart, 1);
+
+    g_atomic_int_set(&watch->restarting, TRUE);
+    restart->watchdog = capture_watchdog_ref(watchdog);
+    restart->watch = watch_ref(watch);
+    restart->reason = reason;
+    gst_element_call_async(watch->source, capture_watchdog_restart, restart,
+                           (GDestroyNotify)restart_free);
+}
+
+static gboolean
+check_watches(void *user_data) {
+    CaptureWatchdog *watchdog = user_data;
+    g_autoptr(GPtrArray) watches = g_ptr_array_new_with_free_func((GDestroyNotify)watch_unref);
+    gint64 now = g_get_monotonic_time();
+    guint i;
+
+    g_mutex_lock(&watchdog->lock);
+    for (i = 0; i < watchdog->watches->len; i++) {
+        g_ptr_array_add(watches, watch_ref(g_ptr_array_index(watchdog->watches, i)));
+    }
+    g_mutex_unlock(&watchdog->lock);
+
+    for (i = 0; i < watches->len; i++) {
+        Watch *watch = g_ptr_array_index(watches, i);
+        gint frames = g_atomic_int_get(&watch->frames);
+        gboolean failed;
+
+        // Time the source out from when its restart finishes
+        if (g_atomic_int_get(&watch->restarting)) {
+            watch->seen = frames;
+            watch->last_frame = now;
+            continue;
+        }
+
+        // Paused media, with no clients, produces no frames
+        if (GST_STATE(watch->pipeline) != GST_STATE_PLAYING || frames != watch->seen) {
+            watch->seen = frames;
+            watch->last_frame = now;
+        }
+        failed = g_atomic_int_get(&watch->failed);
+
+        if (failed) {
+            capture_watchdog_start_restart(watchdog, watch, g_strdup("an error"));
+        } else if (now - watch->last_frame > watchdog->timeout) {
+            capture_watchdog_start_restart(
+                watchdog, watch,
+                g_strdup_printf("%" G_GINT64_FORMAT " ms without frames",
+                                (now - watch->last_frame) / 1000));
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+media_unprepared(GstRTSPMedia *media, CaptureWatchdog *watchdog) {
+    guint i;
+
+    g_mutex_lock(&watchdog->lock);
+    for (i = 0; i < watchdog->watches->len; i++) {
+        Watch *watch = g_ptr_array_index(watchdog->watches, i);
+
+        if (watch->media == media) {
+            watch_stop(watch);
+            g_ptr_array_remove_index_fast(watchdog->watches, i);
+            break;
+        }
+    }
+    g_mutex_unlock(&watchdog->lock);
+}
+
+void
+capture_watchdog_attach(CaptureWatchdog *watchdog, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstElement) source = NULL;
+    g_autoptr(GstPad) pad = NULL;
+    Watch *watch;
+
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    // Following pay0 upstream skips any audio source
+    if (pay) {
+        source = media_util_find_upstream_source(pay);
+    }
+    if (source == NULL) {
+        source = media_util_find_capture_source(element);
+    }
+    if (source) {
+        pad = gst_element_get_static_pad(source, "src");
+    }
+    if (pad == NULL) {
+        g_warning("Cannot watch '%s': no capture source", watchdog->path);
+        return;
+    }
+
+    watch = g_atomic_rc_box_new0(Watch);
+    watch->media = g_object_ref(media);
+    watch->pipeline = media_util_get_pipeline(media);
+    watch->source = g_steal_pointer(&source);
+    watch->pad = g_steal_pointer(&pad);
+    watch->last_frame = g_get_monotonic_time();
+
+    watch->probe = gst_pad_add_probe(watch->pad,
+                      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+                      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      source_probe, watch_ref(watch), (GDestroyNotify)watch_unref);
+    media_util_add_sync_handler(media, bus_sync_handler, watch_ref(watch),
+                                (GDestroyNotify)watch_unref);
+    g_signal_connect(media, "unprepared", G_CALLBACK(media_unprepared), watchdog);
+
+    g_mutex_lock(&watchdog->lock);
+    g_ptr_array_add(watchdog->watches, watch);
+    g_mutex_unlock(&watchdog->lock);
+}
+
+static void
+capture_watchdog_clear(CaptureWatchdog *watchdog) {
+    guint i;
+
+    g_source_remove(watchdog->check_source);
+    for (i = 0; i < watchdog->watches->len; i++) {
+        Watch *watch = g_ptr_array_index(watchdog->watches, i);
+
+        g_signal_handlers_disconnect_by_data(watch->media, watchdog);
+        watch_stop(watch);
+    }
+    g_clear_pointer(&watchdog->watches, g_ptr_array_unref);
+    g_clear_pointer(&watchdog->path, g_free);
+    g_mutex_clear(&watchdog->lock);
+}
+
+CaptureWatchdog *
+capture_watchdog_new(const char *path, guint timeout_ms) {
+    CaptureWatchdog *watchdog = g_atomic_rc_box_new0(CaptureWatchdog);
+
+    watchdog->path = g_strdup(path);
+    watchdog->timeout = (gint64)timeout_ms * 1000;
+    g_mutex_init(&watchdog->lock);
+    watchdog->watches = g_ptr_array_new_with_free_func((GDestroyNotify)watch_unref);
+    watchdog->check_source = g_timeout_add(CHECK_INTERVAL_MS, check_watches, watchdog);
+
+    return watchdog;
+}
+
+CaptureWatchdog *
+capture_watchdog_ref(CaptureWatchdog *watchdog) {
+    return g_atomic_rc_box_acquire(watchdog);
+}
+
+void
+capture_watchdog_unref(CaptureWatchdog *watchdog) {
+    g_atomic_rc_box_release_full(watchdog, (GDestroyNotify)capture_watchdog_clear);
+}
+
+void
+capture_watchdog_collect(GString *out, void *user_data) {
+    CaptureWatchdog *watchdog = user_data;
+
+    g_mutex_lock(&watchdog->lock);
+    g_string_append_printf(
+        out, "rtsp_sender_capture_restarts_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        watchdog->path, watchdog->restarts);
+    g_string_append_printf(
+        out, "rtsp_sender_capture_restart_seconds{mount=\"%s\"} %g\n",
+        watchdog->path, watchdog->last_restart_us / (double)G_USEC_PER_SEC);
+    g_mutex_unlock(&watchdog->lock);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _CaptureWatchdog CaptureWatchdog;
+
+// Restarts a mount's capture source when it stops producing frames for
+// longer than timeout_ms while playing, or posts an error.  The rest of
+// the pipeline keeps running, so clients keep their sessions and see
+// continuous RTP sequence numbers and timestamps.
+CaptureWatchdog *capture_watchdog_new(const char *path, guint timeout_ms);
+CaptureWatchdog *capture_watchdog_ref(CaptureWatchdog *watchdog);
+void capture_watchdog_unref(CaptureWatchdog *watchdog);
+
+void capture_watchdog_attach(CaptureWatchdog *watchdog, GstRTSPMedia *media);
+
+void capture_watchdog_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(CaptureWatchdog, capture_watchdog_unref);
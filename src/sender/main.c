@@ -1,95 +1,356 @@
 #include <glib.h>
+#include <glib-unix.h>
 #include <glib-object.h>
 #include <gst/gst.h>
+#include <gio/gio.h>
 #include <gst/rtsp-server/rtsp-server.h>
+#include <signal.h>
+#include <string.h>
 
 #include "mdns-publisher.h"
+#include "metrics.h"
+#include "mount.h"
+#include "net-clock.h"
+#include "thread-policy.h"
 
 #define DEFAULT_RTSP_PORT 8554
 #define DEFAULT_CONFIG_FILE "rtsp-sender.conf"
+#define DEFAULT_STATS_INTERVAL 10
+
+#define RELOAD_DELAY_MS 500
+
+typedef struct {
+    int port;
+    int metrics_port;
+    int stats_interval;
+    char *clock;
+    char *config_file;
+    char *server_cpus;
+    char *server_sched;
+} Options;
+
+typedef struct {
+    const char *config_file;
+    GstRTSPServer *server;
+    MdnsPublisher *publisher;
+    GstClock *clock;
+    Metrics *metrics;
+    // The running mounts, and the configuration section each was made
+    // from, by path
+    GHashTable *mounts;
+    GHashTable *sections;
+    guint reload_source;
+} Sender;
 
 static gboolean
-parse_options(int *argc, char ***argv, int *port, GKeyFile **config,
-              GError **error) {
+parse_options(int *argc, char ***argv, Options *opts, GError **error) {
     g_autoptr(GOptionContext) ctx = NULL;
-    char *config_file = DEFAULT_CONFIG_FILE;
     GOptionEntry options[] = {
-        {"port", 'p', 0, G_OPTION_ARG_INT, port,
+        {"port", 'p', 0, G_OPTION_ARG_INT, &opts->port,
          "Port to listen on (default: " G_STRINGIFY(DEFAULT_RTSP_PORT) ")", "PORT"},
-        {"config", 'c', 0, G_OPTION_ARG_FILENAME, &config_file,
+        {"config", 'c', 0, G_OPTION_ARG_FILENAME, &opts->config_file,
          "Configuration file (default: " DEFAULT_CONFIG_FILE ")", "CONFIG"},
+        {"metrics-port", 'm', 0, G_OPTION_ARG_INT, &opts->metrics_port,
+         "Port to serve metrics over HTTP on (default: disabled)", "PORT"},
+        {"stats-interval", 0, 0, G_OPTION_ARG_INT, &opts->stats_interval,
+         "Seconds between statistics log messages (default: " G_STRINGIFY(DEFAULT_STATS_INTERVAL) ")", "SECONDS"},
+        {"clock", 0, 0, G_OPTION_ARG_STRING, &opts->clock,
+         "Pipeline clock: system, ntp://HOST[:PORT] or ptp://DOMAIN (default: system)", "CLOCK"},
+        {"server-cpus", 0, 0, G_OPTION_ARG_STRING, &opts->server_cpus,
+         "CPUs to run the RTSP server's threads on, e.g. 0-1", "CPUS"},
+        {"server-sched", 0, 0, G_OPTION_ARG_STRING, &opts->server_sched,
+         "Scheduling for the RTSP server's threads, e.g. fifo:10", "POLICY[:PRIORITY]"},
         {NULL}
     };
 
-    *port = DEFAULT_RTSP_PORT;
+    opts->port = DEFAULT_RTSP_PORT;
+    opts->metrics_port = 0;
+    opts->stats_interval = DEFAULT_STATS_INTERVAL;
+    opts->clock = NULL;
+    opts->config_file = DEFAULT_CONFIG_FILE;
+    opts->server_cpus = NULL;
+    opts->server_sched = NULL;
     ctx = g_option_context_new(NULL);
     g_option_context_add_main_entries(ctx, options, NULL);
     g_option_context_add_group(ctx, gst_init_get_option_group());
 
-    if (!g_option_context_parse (ctx, argc, argv, error)) {
-        return FALSE;
+    return g_option_context_parse (ctx, argc, argv, error);
+}
+
+// A section's keys and values, to tell whether it has changed
+static char *
+config_get_section(GKeyFile *config, const char *group) {
+    g_auto(GStrv) keys = g_key_file_get_keys(config, group, NULL, NULL);
+    GString *section = g_string_new(NULL);
+    gsize i;
+
+    for (i = 0; keys && keys[i] != NULL; i++) {
+        g_autofree char *value = g_key_file_get_value(config, group, keys[i], NULL);
+
+        g_string_append_printf(section, "%s=%s\n", keys[i], value);
+    }
+    return g_string_free(section, FALSE);
+}
+
+typedef struct {
+    const char *path;
+    gboolean found;
+} PathMatch;
+
+static GstRTSPFilterResult
+match_session_media(GstRTSPSession *session, GstRTSPSessionMedia *media,
+                    void *user_data) {
+    PathMatch *match = user_data;
+    int matched = 0;
+
+    if (gst_rtsp_session_media_matches(media, match->path, &matched) &&
+        matched == (int)strlen(match->path)) {
+        match->found = TRUE;
     }
+    return GST_RTSP_FILTER_KEEP;
+}
+
+static GstRTSPFilterResult
+match_client_session(GstRTSPClient *client, GstRTSPSession *session,
+                     void *user_data) {
+    gst_rtsp_session_filter(session, match_session_media, user_data);
+    return GST_RTSP_FILTER_KEEP;
+}
+
+static GstRTSPFilterResult
+close_matching_client(GstRTSPServer *server, GstRTSPClient *client,
+                      void *user_data) {
+    PathMatch match = { user_data, FALSE };
 
-    *config = g_key_file_new();
-    return g_key_file_load_from_file(*config, config_file, G_KEY_FILE_NONE, error);
+    gst_rtsp_client_session_filter(client, match_client_session, &match);
+    return match.found ? GST_RTSP_FILTER_REMOVE : GST_RTSP_FILTER_KEEP;
+}
+
+// Disconnect clients playing path, so they reconnect to whatever now
+// serves it and its device is released.
+static void
+sender_close_clients(Sender *sender, const char *path) {
+    gst_rtsp_server_client_filter(sender->server, close_matching_client, (void *)path);
+}
+
+static void
+sender_drop_mount(void *mount) {
+    mount_close(mount);
+    mount_unref(mount);
 }
 
+static void
+sender_remove_mount(Sender *sender, const char *path) {
+    g_autoptr(GstRTSPMountPoints) mount_points = NULL;
+    g_autofree char *replay_path = g_strconcat(path, "/replay", NULL);
+
+    mount_points = gst_rtsp_server_get_mount_points(sender->server);
+    gst_rtsp_mount_points_remove_factory(mount_points, path);
+    gst_rtsp_mount_points_remove_factory(mount_points, replay_path);
+    mdns_publisher_remove_stream(sender->publisher, path);
+    sender_close_clients(sender, path);
+    sender_close_clients(sender, replay_path);
+
+    g_hash_table_remove(sender->mounts, path);
+    g_hash_table_remove(sender->sections, path);
+}
+
+static void
+sender_add_mount(Sender *sender, Mount *mount, char *section) {
+    g_autoptr(GstRTSPMountPoints) mount_points = NULL;
+    const char *path = mount_get_path(mount);
+
+    mount_points = gst_rtsp_server_get_mount_points(sender->server);
+    gst_rtsp_mount_points_add_factory(
+        mount_points, path, g_object_ref(mount_get_factory(mount)));
+    if (mount_get_replay_factory(mount)) {
+        g_autofree char *replay_path = g_strconcat(path, "/replay", NULL);
+
+        gst_rtsp_mount_points_add_factory(
+            mount_points, replay_path,
+            g_object_ref(mount_get_replay_factory(mount)));
+    }
+
+    if (mount_get_publish(mount)) {
+        mdns_publisher_add_stream(sender->publisher, path, mount_get_publish(mount));
+    }
+    g_hash_table_insert(sender->sections, g_strdup(path), section);
+    g_hash_table_insert(sender->mounts, g_strdup(path), mount);
+}
+
+// Bring the mounts in line with the configuration file.  Sections
+// that haven't changed are left alone, so their clients keep playing.
+// When reloading, a section that fails to load keeps its old mount.
 static gboolean
-setup_streams(GstRTSPServer *server, MdnsPublisher *publisher,
-              GKeyFile *config, GError **error) {
-    g_autoptr(GstRTSPMountPoints) mounts = NULL;
+sender_load_config(Sender *sender, gboolean reload, GError **error) {
+    g_autoptr(GKeyFile) config = g_key_file_new();
+    g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func(g_free);
     g_auto(GStrv) groups = NULL;
+    GHashTableIter iter;
+    const char *path;
     gsize n_groups, i;
 
-    mounts = gst_rtsp_server_get_mount_points(server);
+    if (!g_key_file_load_from_file(config, sender->config_file, G_KEY_FILE_NONE, error))
+        return FALSE;
+
+    g_hash_table_iter_init(&iter, sender->sections);
+    while (g_hash_table_iter_next(&iter, (void **)&path, NULL)) {
+        if (!g_key_file_has_group(config, path)) {
+            g_ptr_array_add(removed, g_strdup(path));
+        }
+    }
+    for (i = 0; i < removed->len; i++) {
+        g_message("Removing '%s'", (char *)g_ptr_array_index(removed, i));
+        sender_remove_mount(sender, g_ptr_array_index(removed, i));
+    }
 
     groups = g_key_file_get_groups(config, &n_groups);
     for (i = 0; i < n_groups; i++) {
-        g_autoptr(GstRTSPMediaFactory) factory = NULL;
-        g_autofree char *pipeline = NULL;
-        g_autofree char *launch = NULL;
-        g_autofree char *publish = NULL;
+        g_autofree char *section = config_get_section(config, groups[i]);
+        const char *old = g_hash_table_lookup(sender->sections, groups[i]);
+        g_autoptr(GError) local_error = NULL;
+        Mount *mount;
+
+        if (old && !strcmp(old, section))
+            continue;
+
+        mount = mount_new(groups[i], config, sender->clock, sender->metrics, &local_error);
+        if (!mount) {
+            if (!reload) {
+                g_propagate_error(error, g_steal_pointer(&local_error));
+                return FALSE;
+            }
+            g_warning("Not reloading '%s': %s", groups[i], local_error->message);
+            continue;
+        }
 
-        pipeline = g_key_file_get_string(config, groups[i], "pipeline", error);
-        if (!pipeline)
-            return FALSE;
+        if (old) {
+            g_message("Reloading '%s'", groups[i]);
+            sender_remove_mount(sender, groups[i]);
+        } else if (reload) {
+            g_message("Adding '%s'", groups[i]);
+        }
+        sender_add_mount(sender, mount, g_steal_pointer(&section));
+    }
 
-        factory = gst_rtsp_media_factory_new();
-        launch = g_strconcat("( ", pipeline, " )", NULL);
-        gst_rtsp_media_factory_set_launch(factory, launch);
-        gst_rtsp_media_factory_set_shared(factory, TRUE);
+    return TRUE;
+}
 
-        gst_rtsp_mount_points_add_factory(
-            mounts, groups[i], g_steal_pointer(&factory));
+static void
+sender_reload(Sender *sender) {
+    g_autoptr(GError) error = NULL;
 
-        publish = g_key_file_get_string(config, groups[i], "publish", NULL);
-        if (publish) {
-            mdns_publisher_add_stream(publisher, groups[i], publish);
-        }
+    if (!sender_load_config(sender, TRUE, &error)) {
+        g_warning("Could not reload %s: %s", sender->config_file, error->message);
     }
+}
 
-    return TRUE;
+static gboolean
+reload_timeout(void *user_data) {
+    Sender *sender = user_data;
+
+    sender->reload_source = 0;
+    sender_reload(sender);
+    return G_SOURCE_REMOVE;
+}
+
+// Stays installed, so every SIGHUP reloads
+static gboolean
+reload_signal(void *user_data) {
+    sender_reload(user_data);
+    return G_SOURCE_CONTINUE;
+}
+
+// Editors write and rename files in several steps, so wait for them
+// to settle.
+static void
+config_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+               GFileMonitorEvent event, void *user_data) {
+    Sender *sender = user_data;
+
+    if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED ||
+        event == G_FILE_MONITOR_EVENT_DELETED)
+        return;
+    if (sender->reload_source) {
+        g_source_remove(sender->reload_source);
+    }
+    sender->reload_source = g_timeout_add(RELOAD_DELAY_MS, reload_timeout, sender);
+}
+
+static gboolean
+log_stats(void *user_data) {
+    GHashTable *mounts = user_data;
+    GHashTableIter iter;
+    Mount *mount;
+
+    g_hash_table_iter_init(&iter, mounts);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&mount)) {
+        mount_log_stats(mount);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static Mount *
+client_get_mount(GstRTSPClient *client, GstRTSPContext *ctx) {
+    g_autoptr(GstRTSPMountPoints) mount_points = NULL;
+    g_autoptr(GstRTSPMediaFactory) factory = NULL;
+
+    mount_points = gst_rtsp_client_get_mount_points(client);
+    if (mount_points == NULL || ctx->uri == NULL)
+        return NULL;
+    factory = gst_rtsp_mount_points_match(mount_points, ctx->uri->abspath, NULL);
+    return factory ? mount_from_factory(factory) : NULL;
+}
+
+static void
+client_play(GstRTSPClient *client, GstRTSPContext *ctx, void *user_data) {
+    g_autoptr(Mount) mount = client_get_mount(client, ctx);
+
+    if (mount) {
+        mount_add_client(mount, client);
+    }
 }
 
 static GstRTSPStatusCode
 client_set_parameter(GstRTSPClient *client, GstRTSPContext *ctx,
                      void *user_data) {
-    static const char param_prefix[] = "obs-active: ";
-    const guint param_prefix_len = sizeof(param_prefix) - 1;
+    g_autofree char *text = NULL;
+    g_auto(GStrv) lines = NULL;
     const char *uri;
     guint8 *body;
     guint size;
-    gboolean active;
+    int i;
 
     uri = ctx->request->type_data.request.uri;
     gst_rtsp_message_get_body(ctx->request, &body, &size);
-
-    if (!(size > param_prefix_len && !strncmp((const char *)body, param_prefix, param_prefix_len))) {
+    if (size == 0) {
         return GST_RTSP_STS_OK;
     }
 
-    active = !strncmp("true", (const char *)body+param_prefix_len, size-param_prefix_len);
-    g_message("Stream '%s' is %s", uri, active ? "active" : "inactive");
+    // A text/parameters body has one "name: value" pair per line
+    text = g_strndup((const char *)body, size);
+    lines = g_strsplit(text, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++) {
+        char *value = strchr(lines[i], ':');
+
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        g_strstrip(lines[i]);
+        g_strstrip(value);
+
+        if (!strcmp(lines[i], "obs-active")) {
+            gboolean active = !strcmp(value, "true");
+
+            g_message("Stream '%s' is %s", uri, active ? "active" : "inactive");
+        } else if (!strcmp(lines[i], "obs-view")) {
+            g_autoptr(Mount) mount = client_get_mount(client, ctx);
+
+            if (mount) {
+                mount_set_client_view(mount, client, value);
+            }
+        }
+    }
 
     // We zero out the request body to trigger the code path that will
     // send a "200 OK" response.  More details in this bug report:
@@ -111,6 +372,7 @@ client_connected(GstRTSPServer *server, GstRTSPClient *client) {
     GstRTSPConnection *conn = gst_rtsp_client_get_connection(client);
 
     g_signal_connect(client, "pre-set-parameter-request", G_CALLBACK(client_set_parameter), NULL);
+    g_signal_connect(client, "play-request", G_CALLBACK(client_play), NULL);
     g_signal_connect(client, "closed", G_CALLBACK(client_closed), NULL);
     g_message("Received connection from %s", gst_rtsp_connection_get_ip(conn));
 }
@@ -121,32 +383,88 @@ main(int argc, char **argv) {
     g_autoptr(GMainLoop) main_loop = NULL;
     g_autoptr(GstRTSPServer) server = NULL;
     g_autoptr(MdnsPublisher) publisher = NULL;
-    g_autoptr(GKeyFile) config = NULL;
-    int port;
+    g_autoptr(GstClock) clock = NULL;
+    g_autoptr(Metrics) metrics = NULL;
+    g_autoptr(GHashTable) mounts = NULL;
+    g_autoptr(GHashTable) sections = NULL;
+    g_autoptr(GFile) config_file = NULL;
+    g_autoptr(GFileMonitor) monitor = NULL;
+    Options opts;
+    Sender sender = { 0 };
     g_autofree char *port_str = NULL;
 
-    if (!parse_options(&argc, &argv, &port, &config, &error)) {
+    if (!parse_options(&argc, &argv, &opts, &error)) {
         g_printerr("Error parsing options: %s\n", error->message);
         return 1;
     }
 
     main_loop = g_main_loop_new(NULL, FALSE);
     server = gst_rtsp_server_new();
-    port_str = g_strdup_printf("%d", port);
+    port_str = g_strdup_printf("%d", opts.port);
     g_object_set(server, "service", port_str, NULL);
     g_signal_connect(server, "client-connected", G_CALLBACK(client_connected), NULL);
+    if (opts.server_cpus || opts.server_sched) {
+        g_autoptr(ThreadPolicy) policy = NULL;
+        g_autoptr(GstRTSPThreadPool) pool = NULL;
+
+        policy = thread_policy_new("server", opts.server_cpus, opts.server_sched, &error);
+        if (!policy) {
+            g_printerr("Error setting up server threads: %s\n", error->message);
+            return 1;
+        }
+        pool = thread_policy_new_rtsp_pool(policy);
+        gst_rtsp_server_set_thread_pool(server, pool);
+    }
 
-    publisher = mdns_publisher_new(port, &error);
+    publisher = mdns_publisher_new(opts.port, &error);
     if (!publisher) {
         g_printerr("Error setting up Avahi publisher: %s\n", error->message);
         return 1;
     }
 
-    if (!setup_streams(server, publisher, config, &error)) {
+    clock = net_clock_new(opts.clock, &error);
+    if (!clock) {
+        g_printerr("Error setting up clock: %s\n", error->message);
+        return 1;
+    }
+
+    metrics = metrics_new();
+    if (opts.metrics_port > 0 &&
+        !metrics_listen(metrics, opts.metrics_port, &error)) {
+        g_printerr("Error setting up metrics server: %s\n", error->message);
+        return 1;
+    }
+
+    mounts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                   sender_drop_mount);
+    sections = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    sender.config_file = opts.config_file;
+    sender.server = server;
+    sender.publisher = publisher;
+    sender.clock = clock;
+    sender.metrics = metrics;
+    sender.mounts = mounts;
+    sender.sections = sections;
+    if (!sender_load_config(&sender, FALSE, &error)) {
         g_printerr("Error setting up streams: %s\n", error->message);
         return 1;
     }
 
+    // Reload the configuration when it changes, or on SIGHUP
+    g_unix_signal_add(SIGHUP, reload_signal, &sender);
+    config_file = g_file_new_for_path(opts.config_file);
+    monitor = g_file_monitor_file(config_file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (monitor) {
+        g_signal_connect(monitor, "changed", G_CALLBACK(config_changed), &sender);
+    } else {
+        g_warning("Not watching %s: %s", opts.config_file, error->message);
+        g_clear_error(&error);
+    }
+
+    if (opts.stats_interval > 0) {
+        g_timeout_add_seconds(opts.stats_interval, log_stats, mounts);
+    }
+
     if (!gst_rtsp_server_attach(server, NULL)) {
         g_printerr("Could not attach server: %s\n", error->message);
         return 1;
@@ -47,6 +47,7 @@ service_free(Service *service) {
     g_clear_pointer(&service->path, g_free);
     g_clear_pointer(&service->name, g_free);
     g_clear_pointer(&service->group, avahi_entry_group_free);
+    g_free(service);
 }
 
 static void entry_group_callback(AvahiEntryGroup *g,
@@ -244,3 +245,9 @@ mdns_publisher_add_stream(MdnsPublisher *publisher, const char *path, const char
     if (avahi_client_get_state(publisher->client) == AVAHI_CLIENT_S_RUNNING)
         service_register(service);
 }
+
+void
+mdns_publisher_remove_stream(MdnsPublisher *publisher, const char *path) {
+    // Freeing the service's entry group withdraws it
+    g_hash_table_remove(publisher->services, path);
+}
@@ -11,5 +11,7 @@ void mdns_publisher_free(MdnsPublisher *publisher);
 void mdns_publisher_add_stream(MdnsPublisher *publisher,
                                const char *path,
                                const char *name);
+void mdns_publisher_remove_stream(MdnsPublisher *publisher,
+                                  const char *path);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(MdnsPublisher, mdns_publisher_free);
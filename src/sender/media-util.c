@@ -0,0 +1,233 @@
+#include "media-util.h"
+
+#include <string.h>
+
+#define SYNC_HANDLERS_QUARK sync_handlers_quark()
+G_DEFINE_QUARK(media-util-sync-handlers, sync_handlers);
+
+// Refcounted, so a dispatch can go on using one that is removed
+typedef struct {
+    MediaSyncFunc func;
+    void *user_data;
+    GDestroyNotify destroy;
+} SyncHandler;
+
+typedef struct {
+    GMutex lock;
+    GPtrArray *handlers;
+} SyncHandlers;
+
+typedef struct {
+    MediaRtpbinFunc func;
+    void *user_data;
+    GDestroyNotify destroy;
+} RtpbinClosure;
+
+static void
+rtpbin_closure_free(void *data, GClosure *closure) {
+    RtpbinClosure *rc = data;
+
+    if (rc->destroy) rc->destroy(rc->user_data);
+    g_free(rc);
+}
+
+GstElement *
+media_util_get_pipeline(GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+
+    return GST_ELEMENT(gst_object_get_parent(GST_OBJECT(element)));
+}
+
+GstElement *
+media_util_find_capture_source(GstElement *bin) {
+    g_autoptr(GstIterator) iter = NULL;
+    GValue item = G_VALUE_INIT;
+    GstElement *source = NULL;
+
+    if (!GST_IS_BIN(bin)) {
+        return gst_object_ref(bin);
+    }
+
+    iter = gst_bin_iterate_sources(GST_BIN(bin));
+    while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        GstElement *element = g_value_get_object(&item);
+
+        // Recurse into nested bins to find the real producer
+        source = media_util_find_capture_source(element);
+        g_value_reset(&item);
+        if (source) break;
+    }
+    g_value_unset(&item);
+
+    return source;
+}
+
+GstElement *
+media_util_find_upstream_source(GstElement *element) {
+    g_autoptr(GstElement) current = gst_object_ref(element);
+
+    for (;;) {
+        g_autoptr(GstIterator) iter = gst_element_iterate_sink_pads(current);
+        GValue item = G_VALUE_INIT;
+        g_autoptr(GstPad) peer = NULL;
+
+        if (gst_iterator_next(iter, &item) != GST_ITERATOR_OK) {
+            // Nothing further upstream: a source, or a bin holding one
+            return media_util_find_capture_source(current);
+        }
+        peer = gst_pad_get_peer(g_value_get_object(&item));
+        g_value_unset(&item);
+        if (peer == NULL)
+            return NULL;
+
+        g_clear_object(&current);
+        current = gst_pad_get_parent_element(peer);
+        if (current == NULL)
+            return NULL;
+    }
+}
+
+GstElement *
+media_util_find_video_encoder(GstElement *bin) {
+    g_autoptr(GstIterator) iter = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+    GstElement *encoder = NULL;
+
+    while (encoder == NULL && gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        GstElement *element = g_value_get_object(&item);
+        GstElementFactory *factory = gst_element_get_factory(element);
+        const char *klass = NULL;
+
+        if (factory) {
+            klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+        }
+        if (klass && strstr(klass, "Encoder") && strstr(klass, "Video")) {
+            encoder = gst_object_ref(element);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+
+    return encoder;
+}
+
+static void
+pipeline_element_added(GstBin *pipeline, GstElement *element,
+                       RtpbinClosure *rc) {
+    GstElementFactory *factory = gst_element_get_factory(element);
+
+    if (factory && !g_strcmp0(GST_OBJECT_NAME(factory), "rtpbin")) {
+        rc->func(element, rc->user_data);
+    }
+}
+
+void
+media_util_on_rtpbin(GstRTSPMedia *media, MediaRtpbinFunc func,
+                     void *user_data, GDestroyNotify destroy) {
+    g_autoptr(GstElement) pipeline = media_util_get_pipeline(media);
+    RtpbinClosure *rc = g_new0(RtpbinClosure, 1);
+
+    rc->func = func;
+    rc->user_data = user_data;
+    rc->destroy = destroy;
+    g_signal_connect_data(pipeline, "element-added",
+                          G_CALLBACK(pipeline_element_added), rc,
+                          rtpbin_closure_free, 0);
+}
+
+static void
+sync_handler_clear(SyncHandler *handler) {
+    if (handler->destroy) handler->destroy(handler->user_data);
+}
+
+static void
+sync_handler_unref(SyncHandler *handler) {
+    g_atomic_rc_box_release_full(handler, (GDestroyNotify)sync_handler_clear);
+}
+
+static void
+sync_handlers_free(SyncHandlers *sh) {
+    g_ptr_array_unref(sh->handlers);
+    g_mutex_clear(&sh->lock);
+    g_free(sh);
+}
+
+static GstBusSyncReply
+dispatch_sync_message(GstBus *bus, GstMessage *message, void *user_data) {
+    SyncHandlers *sh = user_data;
+    g_autoptr(GPtrArray) handlers = NULL;
+    GstBusSyncReply reply = GST_BUS_PASS;
+    guint i;
+
+    // Handlers run unlocked, as they may add or remove handlers
+    // themselves, and may block while streaming threads post messages.
+    g_mutex_lock(&sh->lock);
+    handlers = g_ptr_array_new_full(sh->handlers->len, (GDestroyNotify)sync_handler_unref);
+    for (i = 0; i < sh->handlers->len; i++) {
+        g_ptr_array_add(handlers, g_atomic_rc_box_acquire(g_ptr_array_index(sh->handlers, i)));
+    }
+    g_mutex_unlock(&sh->lock);
+
+    for (i = 0; i < handlers->len && reply == GST_BUS_PASS; i++) {
+        SyncHandler *handler = g_ptr_array_index(handlers, i);
+
+        reply = handler->func(message, handler->user_data);
+    }
+
+    return reply;
+}
+
+void
+media_util_add_sync_handler(GstRTSPMedia *media, MediaSyncFunc func,
+                            void *user_data, GDestroyNotify destroy) {
+    g_autoptr(GstElement) pipeline = media_util_get_pipeline(media);
+    SyncHandler *handler = g_atomic_rc_box_new0(SyncHandler);
+    SyncHandlers *sh;
+
+    handler->func = func;
+    handler->user_data = user_data;
+    handler->destroy = destroy;
+
+    sh = g_object_get_qdata(G_OBJECT(pipeline), SYNC_HANDLERS_QUARK);
+    if (sh == NULL) {
+        g_autoptr(GstBus) bus = gst_element_get_bus(pipeline);
+
+        sh = g_new0(SyncHandlers, 1);
+        g_mutex_init(&sh->lock);
+        sh->handlers = g_ptr_array_new_with_free_func((GDestroyNotify)sync_handler_unref);
+        g_object_set_qdata_full(G_OBJECT(pipeline), SYNC_HANDLERS_QUARK, sh,
+                                (GDestroyNotify)sync_handlers_free);
+        gst_bus_set_sync_handler(bus, dispatch_sync_message, sh, NULL);
+    }
+
+    g_mutex_lock(&sh->lock);
+    g_ptr_array_add(sh->handlers, handler);
+    g_mutex_unlock(&sh->lock);
+}
+
+void
+media_util_remove_sync_handler(GstRTSPMedia *media, MediaSyncFunc func,
+                               void *user_data) {
+    g_autoptr(GstElement) pipeline = media_util_get_pipeline(media);
+    SyncHandler *removed = NULL;
+    SyncHandlers *sh;
+    guint i;
+
+    sh = g_object_get_qdata(G_OBJECT(pipeline), SYNC_HANDLERS_QUARK);
+    if (sh == NULL)
+        return;
+
+    g_mutex_lock(&sh->lock);
+    for (i = 0; i < sh->handlers->len; i++) {
+        SyncHandler *handler = g_ptr_array_index(sh->handlers, i);
+
+        if (handler->func == func && handler->user_data == user_data) {
+            removed = g_ptr_array_steal_index(sh->handlers, i);
+            break;
+        }
+    }
+    g_mutex_unlock(&sh->lock);
+
+    // Freed once any dispatch still running it is done
+    g_clear_pointer(&removed, sync_handler_unref);
+}
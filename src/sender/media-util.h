@@ -0,0 +1,37 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef void (*MediaRtpbinFunc)(GstElement *rtpbin, void *user_data);
+typedef GstBusSyncReply (*MediaSyncFunc)(GstMessage *message, void *user_data);
+
+// The pipeline the media's element has been added to
+GstElement *media_util_get_pipeline(GstRTSPMedia *media);
+
+// The element producing frames: the first source element in the
+// configured pipeline.
+GstElement *media_util_find_capture_source(GstElement *bin);
+
+// The source feeding element, following its first sink pad upstream.
+// NULL if the chain isn't linked yet, e.g. through dynamic pads.
+GstElement *media_util_find_upstream_source(GstElement *element);
+
+// The first element in the bin classed as a video encoder
+GstElement *media_util_find_video_encoder(GstElement *bin);
+
+// The rtpbin is only created when the media is prepared, after
+// "media-configure" has been emitted.  Call func once it is added to
+// the pipeline.
+void media_util_on_rtpbin(GstRTSPMedia *media, MediaRtpbinFunc func,
+                          void *user_data, GDestroyNotify destroy);
+
+// A bus has a single sync handler, so handlers for the media's pipeline
+// are chained through here.  The first to return GST_BUS_DROP stops a
+// message reaching the rest, and the media's bus watch.  A removed
+// handler may still be running on another thread: destroy is called
+// once it has finished.
+void media_util_add_sync_handler(GstRTSPMedia *media, MediaSyncFunc func,
+                                 void *user_data, GDestroyNotify destroy);
+void media_util_remove_sync_handler(GstRTSPMedia *media, MediaSyncFunc func,
+                                    void *user_data);
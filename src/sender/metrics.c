@@ -0,0 +1,146 @@
+#include "metrics.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+struct _Metrics {
+    GSocketService *service;
+
+    GMutex lock;
+    guint next_id;
+    GList *collectors;
+};
+
+typedef struct {
+    guint id;
+    MetricsCollectFunc func;
+    void *user_data;
+} Collector;
+
+static gboolean
+metrics_run(GThreadedSocketService *service, GSocketConnection *conn,
+            GObject *source_object, void *user_data) {
+    Metrics *metrics = user_data;
+    g_autoptr(GError) error = NULL;
+    g_autofree char *body = NULL;
+    g_autofree char *response = NULL;
+    char request[4096];
+    GInputStream *istream;
+    GOutputStream *ostream;
+
+    istream = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+    ostream = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+
+    // We serve the same document whatever was asked for, so just
+    // consume the request headers.
+    if (g_input_stream_read(istream, request, sizeof(request), NULL, &error) < 0) {
+        g_warning("Could not read metrics request: %s", error->message);
+        return FALSE;
+    }
+
+    body = metrics_collect(metrics);
+    response = g_strdup_printf(
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "%s", (int)strlen(body), body);
+
+    if (!g_output_stream_write_all(ostream, response, strlen(response), NULL, NULL, &error)) {
+        g_warning("Could not write metrics response: %s", error->message);
+    }
+
+    return FALSE;
+}
+
+Metrics *
+metrics_new(void) {
+    Metrics *metrics = g_new0(Metrics, 1);
+
+    g_mutex_init(&metrics->lock);
+    metrics->next_id = 1;
+
+    return metrics;
+}
+
+void
+metrics_free(Metrics *metrics) {
+    if (metrics == NULL) return;
+
+    if (metrics->service) {
+        g_socket_service_stop(metrics->service);
+        g_socket_listener_close(G_SOCKET_LISTENER(metrics->service));
+    }
+    g_clear_object(&metrics->service);
+    g_list_free_full(metrics->collectors, g_free);
+    g_mutex_clear(&metrics->lock);
+    g_free(metrics);
+}
+
+gboolean
+metrics_listen(Metrics *metrics, int port, GError **error) {
+    g_return_val_if_fail(metrics->service == NULL, FALSE);
+
+    metrics->service = g_threaded_socket_service_new(2);
+    if (!g_socket_listener_add_inet_port(G_SOCKET_LISTENER(metrics->service),
+                                         port, NULL, error)) {
+        g_clear_object(&metrics->service);
+        return FALSE;
+    }
+    g_signal_connect(metrics->service, "run", G_CALLBACK(metrics_run), metrics);
+    g_socket_service_start(metrics->service);
+
+    return TRUE;
+}
+
+guint
+metrics_add_collector(Metrics *metrics, MetricsCollectFunc func,
+                      void *user_data) {
+    Collector *collector = g_new0(Collector, 1);
+    guint id;
+
+    g_mutex_lock(&metrics->lock);
+    id = collector->id = metrics->next_id++;
+    collector->func = func;
+    collector->user_data = user_data;
+    metrics->collectors = g_list_append(metrics->collectors, collector);
+    g_mutex_unlock(&metrics->lock);
+
+    return id;
+}
+
+void
+metrics_remove_collector(Metrics *metrics, guint id) {
+    GList *l;
+
+    // Taking the lock also waits for any collection in progress, so
+    // user_data may be freed once this returns.
+    g_mutex_lock(&metrics->lock);
+    for (l = metrics->collectors; l != NULL; l = l->next) {
+        Collector *collector = l->data;
+
+        if (collector->id == id) {
+            metrics->collectors = g_list_delete_link(metrics->collectors, l);
+            g_free(collector);
+            break;
+        }
+    }
+    g_mutex_unlock(&metrics->lock);
+}
+
+char *
+metrics_collect(Metrics *metrics) {
+    GString *out = g_string_new(NULL);
+    GList *l;
+
+    g_mutex_lock(&metrics->lock);
+    for (l = metrics->collectors; l != NULL; l = l->next) {
+        Collector *collector = l->data;
+
+        collector->func(out, collector->user_data);
+    }
+    g_mutex_unlock(&metrics->lock);
+
+    return g_string_free(out, FALSE);
+}
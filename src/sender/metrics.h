@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glib.h>
+
+typedef struct _Metrics Metrics;
+
+// Collectors append lines in the Prometheus text exposition format.
+// They may be called from the HTTP server's worker thread.
+typedef void (*MetricsCollectFunc)(GString *out, void *user_data);
+
+Metrics *metrics_new(void);
+void metrics_free(Metrics *metrics);
+
+gboolean metrics_listen(Metrics *metrics, int port, GError **error);
+
+guint metrics_add_collector(Metrics *metrics, MetricsCollectFunc func,
+                            void *user_data);
+void metrics_remove_collector(Metrics *metrics, guint id);
+
+char *metrics_collect(Metrics *metrics);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Metrics, metrics_free);
@@ -0,0 +1,402 @@
+#include "mount.h"
+
+#include "capture-stamp.h"
+#include "capture-watchdog.h"
+#include "media-util.h"
+#include "packet-pacer.h"
+#include "recorder.h"
+#include "replay-buffer.h"
+#include "stage-tracer.h"
+#include "static-skip.h"
+#include "thread-policy.h"
+#include "view-adapt.h"
+
+#define DEFAULT_REPLAY_MEMORY 128
+#define DEFAULT_RECORD_SEGMENT 300
+// About ten full-size packets
+#define DEFAULT_PACE_BURST 15000
+#define DEFAULT_STATIC_KEEPALIVE 1000
+
+#define MOUNT_QUARK mount_quark()
+G_DEFINE_QUARK(rtsp-sender-mount, mount);
+
+struct _Mount {
+    char *path;
+    char *publish;
+    gboolean timestamps;
+    gboolean sync_clock;
+    GstRTSPMediaFactory *factory;
+
+    Metrics *metrics;
+    StageTracer *tracer;
+    guint tracer_collector;
+    ViewAdapt *adapt;
+    ReplayBuffer *replay;
+    guint replay_collector;
+    Recorder *recorder;
+    guint recorder_collector;
+    CaptureWatchdog *watchdog;
+    guint watchdog_collector;
+    ThreadPolicy *threads;
+    PacketPacer *pacer;
+    guint pacer_collector;
+    StaticSkip *skip;
+    guint skip_collector;
+};
+
+static void
+mount_clear(Mount *mount) {
+    if (mount->tracer_collector)
+        metrics_remove_collector(mount->metrics, mount->tracer_collector);
+    g_clear_pointer(&mount->tracer, stage_tracer_unref);
+    if (mount->replay_collector)
+        metrics_remove_collector(mount->metrics, mount->replay_collector);
+    g_clear_pointer(&mount->replay, replay_buffer_unref);
+    if (mount->recorder_collector)
+        metrics_remove_collector(mount->metrics, mount->recorder_collector);
+    g_clear_pointer(&mount->recorder, recorder_unref);
+    if (mount->watchdog_collector)
+        metrics_remove_collector(mount->metrics, mount->watchdog_collector);
+    g_clear_pointer(&mount->watchdog, capture_watchdog_unref);
+    g_clear_pointer(&mount->threads, thread_policy_unref);
+    if (mount->pacer_collector)
+        metrics_remove_collector(mount->metrics, mount->pacer_collector);
+    g_clear_pointer(&mount->pacer, packet_pacer_unref);
+    if (mount->skip_collector)
+        metrics_remove_collector(mount->metrics, mount->skip_collector);
+    g_clear_pointer(&mount->skip, static_skip_unref);
+    g_clear_pointer(&mount->adapt, view_adapt_unref);
+    if (mount->factory) {
+        g_signal_handlers_disconnect_by_data(mount->factory, mount);
+    }
+    g_clear_object(&mount->factory);
+    g_clear_pointer(&mount->publish, g_free);
+    g_clear_pointer(&mount->path, g_free);
+}
+
+// Encoders and payloaders for the audio-codec key, fed raw audio
+static const struct {
+    const char *name;
+    const char *launch;
+} audio_codecs[] = {
+    { "opus", "opusenc ! rtpopuspay" },
+    { "aac", "avenc_aac ! aacparse ! rtpmp4gpay" },
+    { "l16", "audio/x-raw,format=S16BE ! rtpL16pay" },
+};
+
+// The media's launch line: the configured pipeline, plus an encoded
+// audio stream as pay1 if the section has an audio source.
+static char *
+mount_build_launch(GKeyFile *config, const char *path, const char *pipeline,
+                   GError **error) {
+    g_autofree char *audio = NULL;
+    g_autofree char *codec = NULL;
+    gsize i;
+
+    audio = g_key_file_get_string(config, path, "audio", NULL);
+    if (audio == NULL)
+        return g_strconcat("( ", pipeline, " )", NULL);
+
+    codec = g_key_file_get_string(config, path, "audio-codec", NULL);
+    for (i = 0; i < G_N_ELEMENTS(audio_codecs); i++) {
+        if (!g_strcmp0(codec ? codec : "opus", audio_codecs[i].name)) {
+            return g_strdup_printf(
+                "( %s %s ! queue ! audioconvert ! audioresample ! %s name=pay1 pt=97 )",
+                pipeline, audio, audio_codecs[i].launch);
+        }
+    }
+
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                "Unknown audio-codec '%s' for '%s': expected opus, aac or l16",
+                codec, path);
+    return NULL;
+}
+
+// Values of GstRtpNtpTimeSource
+enum {
+    NTP_TIME_SOURCE_CLOCK_TIME = 3,
+};
+
+static void
+rtpbin_added(GstElement *rtpbin, void *user_data) {
+    // Report the pipeline clock's time in RTCP sender reports, so
+    // receivers on the same clock can synchronise playout.
+    g_object_set(rtpbin,
+                 "ntp-time-source", NTP_TIME_SOURCE_CLOCK_TIME,
+                 "rtcp-sync-send-time", FALSE,
+                 NULL);
+}
+
+static void
+media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media,
+                Mount *mount) {
+    if (mount->threads) {
+        thread_policy_attach(mount->threads, media);
+    }
+    if (mount->sync_clock) {
+        media_util_on_rtpbin(media, rtpbin_added, NULL, NULL);
+    }
+    if (mount->tracer) {
+        stage_tracer_attach(mount->tracer, media);
+    }
+    if (mount->timestamps) {
+        capture_stamp_attach(media, mount->path);
+    }
+    if (mount->adapt) {
+        view_adapt_attach(mount->adapt, media);
+    }
+    if (mount->replay) {
+        replay_buffer_attach(mount->replay, media);
+    }
+    if (mount->recorder) {
+        recorder_attach(mount->recorder, media);
+    }
+    if (mount->watchdog) {
+        capture_watchdog_attach(mount->watchdog, media);
+    }
+    if (mount->pacer) {
+        packet_pacer_attach(mount->pacer, media);
+    }
+    if (mount->skip) {
+        static_skip_attach(mount->skip, media);
+    }
+}
+
+// Look up an optional boolean key, leaving value untouched if missing
+static gboolean
+get_optional_boolean(GKeyFile *config, const char *group, const char *key,
+                     gboolean *value, GError **error) {
+    g_autoptr(GError) local_error = NULL;
+    gboolean result;
+
+    result = g_key_file_get_boolean(config, group, key, &local_error);
+    if (local_error) {
+        if (g_error_matches(local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+            return TRUE;
+        g_propagate_error(error, g_steal_pointer(&local_error));
+        return FALSE;
+    }
+
+    *value = result;
+    return TRUE;
+}
+
+// As above, for a non-negative integer
+static gboolean
+get_optional_uint(GKeyFile *config, const char *group, const char *key,
+                  guint *value, GError **error) {
+    g_autoptr(GError) local_error = NULL;
+    int result;
+
+    result = g_key_file_get_integer(config, group, key, &local_error);
+    if (local_error) {
+        if (g_error_matches(local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+            return TRUE;
+        g_propagate_error(error, g_steal_pointer(&local_error));
+        return FALSE;
+    }
+    if (result < 0) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Key '%s' in '%s' can't be negative", key, group);
+        return FALSE;
+    }
+
+    *value = (guint)result;
+    return TRUE;
+}
+
+Mount *
+mount_new(const char *path, GKeyFile *config, GstClock *clock,
+          Metrics *metrics, GError **error) {
+    g_autoptr(Mount) mount = g_atomic_rc_box_new0(Mount);
+    g_autofree char *pipeline = NULL;
+    g_autofree char *launch = NULL;
+    gboolean trace = FALSE;
+    gboolean adapt_view = FALSE;
+    guint replay = 0;
+    guint replay_memory = DEFAULT_REPLAY_MEMORY;
+    g_autofree char *record = NULL;
+    g_autofree char *record_format = NULL;
+    g_autofree char *record_element = NULL;
+    guint record_segment = DEFAULT_RECORD_SEGMENT;
+    guint watchdog = 0;
+    guint pace = 0;
+    guint pace_burst = DEFAULT_PACE_BURST;
+    gboolean skip_static = FALSE;
+    guint static_keepalive = DEFAULT_STATIC_KEEPALIVE;
+    g_autofree char *cpus = NULL;
+    g_autofree char *sched = NULL;
+
+    mount->path = g_strdup(path);
+    mount->metrics = metrics;
+    mount->sync_clock = TRUE;
+
+    pipeline = g_key_file_get_string(config, path, "pipeline", error);
+    if (!pipeline)
+        return NULL;
+
+    mount->publish = g_key_file_get_string(config, path, "publish", NULL);
+
+    if (!get_optional_boolean(config, path, "trace", &trace, error) ||
+        !get_optional_boolean(config, path, "timestamps", &mount->timestamps, error) ||
+        !get_optional_boolean(config, path, "sync-clock", &mount->sync_clock, error) ||
+        !get_optional_boolean(config, path, "adapt-view", &adapt_view, error) ||
+        !get_optional_uint(config, path, "replay", &replay, error) ||
+        !get_optional_uint(config, path, "replay-memory", &replay_memory, error) ||
+        !get_optional_uint(config, path, "record-segment", &record_segment, error) ||
+        !get_optional_uint(config, path, "watchdog", &watchdog, error) ||
+        !get_optional_uint(config, path, "pace", &pace, error) ||
+        !get_optional_uint(config, path, "pace-burst", &pace_burst, error) ||
+        !get_optional_boolean(config, path, "skip-static", &skip_static, error) ||
+        !get_optional_uint(config, path, "static-keepalive", &static_keepalive, error))
+        return NULL;
+
+    // Capture timestamps are read from the pipeline clock
+    if (mount->timestamps && !mount->sync_clock) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Key 'timestamps' in '%s' needs 'sync-clock'", path);
+        return NULL;
+    }
+
+    if (trace) {
+        mount->tracer = stage_tracer_new(path);
+        mount->tracer_collector = metrics_add_collector(
+            metrics, stage_tracer_collect, mount->tracer);
+    }
+    if (adapt_view) {
+        mount->adapt = view_adapt_new(path);
+    }
+    if (replay > 0) {
+        mount->replay = replay_buffer_new(path, replay, (gsize)replay_memory << 20);
+        mount->replay_collector = metrics_add_collector(
+            metrics, replay_buffer_collect, mount->replay);
+        if (mount->sync_clock) {
+            gst_rtsp_media_factory_set_clock(replay_buffer_get_factory(mount->replay), clock);
+        }
+    }
+    if (pace > 0) {
+        mount->pacer = packet_pacer_new(path, pace, pace_burst);
+        mount->pacer_collector = metrics_add_collector(
+            metrics, packet_pacer_collect, mount->pacer);
+    }
+    if (skip_static) {
+        mount->skip = static_skip_new(path, static_keepalive);
+        mount->skip_collector = metrics_add_collector(
+            metrics, static_skip_collect, mount->skip);
+    }
+    cpus = g_key_file_get_string(config, path, "cpus", NULL);
+    sched = g_key_file_get_string(config, path, "sched", NULL);
+    if (cpus || sched) {
+        mount->threads = thread_policy_new(path, cpus, sched, error);
+        if (!mount->threads)
+            return NULL;
+    }
+    if (watchdog > 0) {
+        mount->watchdog = capture_watchdog_new(path, watchdog);
+        mount->watchdog_collector = metrics_add_collector(
+            metrics, capture_watchdog_collect, mount->watchdog);
+    }
+    record = g_key_file_get_string(config, path, "record", NULL);
+    if (record) {
+        record_format = g_key_file_get_string(config, path, "record-format", NULL);
+        record_element = g_key_file_get_string(config, path, "record-element", NULL);
+        mount->recorder = recorder_new(path, record, record_format ? record_format : "mkv",
+                                       MAX(record_segment, 1),
+                                       record_element ? record_element : "pay0", error);
+        if (!mount->recorder)
+            return NULL;
+        mount->recorder_collector = metrics_add_collector(
+            metrics, recorder_collect, mount->recorder);
+    }
+
+    launch = mount_build_launch(config, path, pipeline, error);
+    if (!launch)
+        return NULL;
+
+    mount->factory = gst_rtsp_media_factory_new();
+    gst_rtsp_media_factory_set_launch(mount->factory, launch);
+    gst_rtsp_media_factory_set_shared(mount->factory, TRUE);
+    if (mount->sync_clock) {
+        gst_rtsp_media_factory_set_clock(mount->factory, clock);
+    }
+    // Receivers use RTCP feedback to ask for a keyframe when they
+    // switch over from another sender.
+    gst_rtsp_media_factory_set_profiles(
+        mount->factory, GST_RTSP_PROFILE_AVP | GST_RTSP_PROFILE_AVPF);
+
+    g_signal_connect(mount->factory, "media-configure",
+                     G_CALLBACK(media_configure), mount);
+    // Client requests find the mount through its factory, and may still
+    // be using it after a reload has replaced it, so the factory holds
+    // a reference until mount_close().
+    g_object_set_qdata_full(G_OBJECT(mount->factory), MOUNT_QUARK,
+                            mount_ref(mount), (GDestroyNotify)mount_unref);
+
+    return g_steal_pointer(&mount);
+}
+
+Mount *
+mount_ref(Mount *mount) {
+    return g_atomic_rc_box_acquire(mount);
+}
+
+void
+mount_unref(Mount *mount) {
+    g_atomic_rc_box_release_full(mount, (GDestroyNotify)mount_clear);
+}
+
+const char *
+mount_get_path(Mount *mount) {
+    return mount->path;
+}
+
+const char *
+mount_get_publish(Mount *mount) {
+    return mount->publish;
+}
+
+GstRTSPMediaFactory *
+mount_get_factory(Mount *mount) {
+    return mount->factory;
+}
+
+GstRTSPMediaFactory *
+mount_get_replay_factory(Mount *mount) {
+    return mount->replay ? replay_buffer_get_factory(mount->replay) : NULL;
+}
+
+void
+mount_close(Mount *mount) {
+    g_object_set_qdata(G_OBJECT(mount->factory), MOUNT_QUARK, NULL);
+}
+
+static void *
+dup_mount(void *mount, void *user_data) {
+    return mount ? mount_ref(mount) : NULL;
+}
+
+Mount *
+mount_from_factory(GstRTSPMediaFactory *factory) {
+    return g_object_dup_qdata(G_OBJECT(factory), MOUNT_QUARK, dup_mount, NULL);
+}
+
+void
+mount_add_client(Mount *mount, GstRTSPClient *client) {
+    if (mount->adapt) {
+        view_adapt_add_client(mount->adapt, client);
+    }
+}
+
+void
+mount_set_client_view(Mount *mount, GstRTSPClient *client, const char *view) {
+    if (mount->adapt && !view_adapt_set_view(mount->adapt, client, view)) {
+        g_warning("Ignoring invalid view '%s' for '%s'", view, mount->path);
+    }
+}
+
+void
+mount_log_stats(Mount *mount) {
+    if (mount->tracer) {
+        stage_tracer_log(mount->tracer);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+#include "metrics.h"
+
+typedef struct _Mount Mount;
+
+// A mount is one section of the configuration file: a path on the
+// RTSP server together with the media factory serving it.
+Mount *mount_new(const char *path, GKeyFile *config, GstClock *clock,
+                 Metrics *metrics, GError **error);
+Mount *mount_ref(Mount *mount);
+void mount_unref(Mount *mount);
+// Detach the mount from its factory, which otherwise keeps it alive
+void mount_close(Mount *mount);
+
+const char *mount_get_path(Mount *mount);
+const char *mount_get_publish(Mount *mount);
+GstRTSPMediaFactory *mount_get_factory(Mount *mount);
+// Serves the mount's replay buffer, or NULL if it doesn't keep one
+GstRTSPMediaFactory *mount_get_replay_factory(Mount *mount);
+// A new reference to the mount serving a factory, or NULL
+Mount *mount_from_factory(GstRTSPMediaFactory *factory);
+
+// Track what a playing client shows of the stream, for mounts that
+// adapt to it.
+void mount_add_client(Mount *mount, GstRTSPClient *client);
+void mount_set_client_view(Mount *mount, GstRTSPClient *client, const char *view);
+
+void mount_log_stats(Mount *mount);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Mount, mount_unref);
@@ -0,0 +1,226 @@
+#include "packet-pacer.h"
+
+#include "histogram.h"
+
+// If the stream outruns the rate, packets are held no longer than
+// this rather than falling further and further behind.
+#define MAX_DELAY_US 100000
+
+struct _PacketPacer {
+    char *path;
+    // Bytes per microsecond
+    double rate;
+    double burst;
+
+    GMutex lock;
+    double tokens;
+    gint64 last_refill;
+    gboolean warned;
+    guint64 held;
+
+    // Time each packet was held, in microseconds
+    Histogram *delay;
+};
+
+// Set while a list's packets are pushed one at a time, so they aren't
+// paced twice.
+static GPrivate repushing;
+
+// How long to hold a packet of size bytes
+static gint64
+packet_pacer_take(PacketPacer *pacer, gsize size) {
+    gint64 now = g_get_monotonic_time();
+    gint64 delay = 0;
+
+    g_mutex_lock(&pacer->lock);
+    if (pacer->last_refill == 0) {
+        pacer->tokens = pacer->burst;
+    } else {
+        pacer->tokens = MIN(pacer->burst,
+                            pacer->tokens + (now - pacer->last_refill) * pacer->rate);
+    }
+    pacer->last_refill = now;
+
+    // Going into debt holds this packet until the bucket refills, and
+    // the next one after it.
+    pacer->tokens -= size;
+    if (pacer->tokens < 0) {
+        delay = (gint64)(-pacer->tokens / pacer->rate);
+        if (delay > MAX_DELAY_US) {
+            delay = MAX_DELAY_US;
+            pacer->tokens = -MAX_DELAY_US * pacer->rate;
+            if (!pacer->warned) {
+                g_warning("Stream '%s' is faster than its pacing rate", pacer->path);
+                pacer->warned = TRUE;
+            }
+        }
+        pacer->held++;
+    }
+    g_mutex_unlock(&pacer->lock);
+
+    histogram_add(pacer->delay, delay);
+    return delay;
+}
+
+static void
+packet_pacer_wait(PacketPacer *pacer, GstBuffer *buffer) {
+    gint64 delay = packet_pacer_take(pacer, gst_buffer_get_size(buffer));
+
+    if (delay > 0) {
+        g_usleep(delay);
+    }
+}
+
+static GstPadProbeReturn
+pace_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    PacketPacer *pacer = user_data;
+    GstBufferList *list;
+    GstFlowReturn ret = GST_FLOW_OK;
+    guint i, n;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        if (!g_private_get(&repushing)) {
+            packet_pacer_wait(pacer, GST_PAD_PROBE_INFO_BUFFER(info));
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Payloaders push a frame's packets as one list, which would go
+    // out as a burst.  Push them one at a time instead.
+    list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    n = gst_buffer_list_length(list);
+    g_private_set(&repushing, GINT_TO_POINTER(TRUE));
+    for (i = 0; i < n && ret == GST_FLOW_OK; i++) {
+        GstBuffer *buffer = gst_buffer_list_get(list, i);
+
+        packet_pacer_wait(pacer, buffer);
+        ret = gst_pad_push(pad, gst_buffer_ref(buffer));
+    }
+    g_private_set(&repushing, NULL);
+    gst_buffer_list_unref(list);
+
+    GST_PAD_PROBE_INFO_FLOW_RETURN(info) = ret;
+    return GST_PAD_PROBE_HANDLED;
+}
+
+// Holding packets blocks the thread pushing into pay0, so give it a
+// queue of its own unless it already has one, to keep capture and
+// encoding running meanwhile.
+static void
+packet_pacer_add_queue(PacketPacer *pacer, GstElement *pay) {
+    g_autoptr(GstPad) pay_sink = gst_element_get_static_pad(pay, "sink");
+    g_autoptr(GstPad) upstream = NULL;
+    g_autoptr(GstElement) previous = NULL;
+    g_autoptr(GstObject) parent = NULL;
+    g_autoptr(GstPad) pad = NULL;
+    GstElementFactory *factory;
+    GstElement *queue;
+
+    upstream = pay_sink ? gst_pad_get_peer(pay_sink) : NULL;
+    previous = upstream ? gst_pad_get_parent_element(upstream) : NULL;
+    parent = gst_object_get_parent(GST_OBJECT(pay));
+    if (previous == NULL || parent == NULL) {
+        g_warning("Cannot add a queue for pacing '%s': pay0 is not linked",
+                  pacer->path);
+        return;
+    }
+    factory = gst_element_get_factory(previous);
+    if (factory && !g_strcmp0(GST_OBJECT_NAME(factory), "queue"))
+        return;
+
+    queue = gst_element_factory_make("queue", NULL);
+    if (queue == NULL) {
+        g_warning("Cannot add a queue for pacing '%s': missing GStreamer elements",
+                  pacer->path);
+        return;
+    }
+
+    gst_pad_unlink(upstream, pay_sink);
+    gst_bin_add(GST_BIN(parent), queue);
+    pad = gst_element_get_static_pad(queue, "sink");
+    if (gst_pad_link(upstream, pad) != GST_PAD_LINK_OK ||
+        !gst_element_link(queue, pay)) {
+        g_warning("Cannot add a queue for pacing '%s': could not link elements",
+                  pacer->path);
+        gst_bin_remove(GST_BIN(parent), queue);
+        if (gst_pad_link(upstream, pay_sink) != GST_PAD_LINK_OK) {
+            g_warning("Could not relink pay0 of '%s'", pacer->path);
+        }
+    }
+}
+
+void
+packet_pacer_attach(PacketPacer *pacer, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstPad) pad = NULL;
+
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    if (pay) {
+        pad = gst_element_get_static_pad(pay, "src");
+    }
+    if (pad == NULL) {
+        g_warning("Cannot pace '%s': no pay0 element", pacer->path);
+        return;
+    }
+    packet_pacer_add_queue(pacer, pay);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                      pace_probe, packet_pacer_ref(pacer),
+                      (GDestroyNotify)packet_pacer_unref);
+}
+
+static void
+packet_pacer_clear(PacketPacer *pacer) {
+    g_clear_pointer(&pacer->delay, histogram_free);
+    g_clear_pointer(&pacer->path, g_free);
+    g_mutex_clear(&pacer->lock);
+}
+
+PacketPacer *
+packet_pacer_new(const char *path, guint rate_kbps, guint burst_bytes) {
+    PacketPacer *pacer = g_atomic_rc_box_new0(PacketPacer);
+
+    pacer->path = g_strdup(path);
+    pacer->rate = rate_kbps * 1000.0 / 8 / G_USEC_PER_SEC;
+    pacer->burst = burst_bytes;
+    g_mutex_init(&pacer->lock);
+    pacer->delay = histogram_new();
+
+    return pacer;
+}
+
+PacketPacer *
+packet_pacer_ref(PacketPacer *pacer) {
+    return g_atomic_rc_box_acquire(pacer);
+}
+
+void
+packet_pacer_unref(PacketPacer *pacer) {
+    g_atomic_rc_box_release_full(pacer, (GDestroyNotify)packet_pacer_clear);
+}
+
+void
+packet_pacer_collect(GString *out, void *user_data) {
+    PacketPacer *pacer = user_data;
+    static const double quantiles[] = { 0.5, 0.95, 0.99 };
+    guint64 held;
+    guint q;
+
+    for (q = 0; q < G_N_ELEMENTS(quantiles); q++) {
+        g_string_append_printf(
+            out, "rtsp_sender_pacing_delay_seconds{mount=\"%s\",quantile=\"%g\"} %g\n",
+            pacer->path, quantiles[q],
+            histogram_get_percentile(pacer->delay, quantiles[q]) / (double)G_USEC_PER_SEC);
+    }
+    g_string_append_printf(
+        out, "rtsp_sender_pacing_delay_seconds_count{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        pacer->path, histogram_get_count(pacer->delay));
+
+    g_mutex_lock(&pacer->lock);
+    held = pacer->held;
+    g_mutex_unlock(&pacer->lock);
+    g_string_append_printf(
+        out, "rtsp_sender_pacing_held_packets_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        pacer->path, held);
+}
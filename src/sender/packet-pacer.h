@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _PacketPacer PacketPacer;
+
+// Spaces out the RTP packets leaving a mount's pay0 with a token
+// bucket filling at rate_kbps, so a keyframe goes out over several
+// milliseconds instead of as one burst.  Up to burst_bytes may be sent
+// back to back.  The pacing happens before the packets are copied to
+// each client, so it applies to them all at once.  It runs on the
+// payloader's thread, so a queue is added before pay0 if there isn't
+// one already.
+PacketPacer *packet_pacer_new(const char *path, guint rate_kbps, guint burst_bytes);
+PacketPacer *packet_pacer_ref(PacketPacer *pacer);
+void packet_pacer_unref(PacketPacer *pacer);
+
+void packet_pacer_attach(PacketPacer *pacer, GstRTSPMedia *media);
+
+void packet_pacer_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(PacketPacer, packet_pacer_unref);
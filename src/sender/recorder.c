@@ -0,0 +1,926 @@
+#include "recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/base/gstbasesink.h>
+#include <string.h>
+#include <unistd.h>
+
+// Files are written a chunk at a time from an aligned buffer, and
+// synced every few chunks rather than on every write.
+#define WRITE_CHUNK (4 << 20)
+#define WRITE_ALIGN 4096
+#define SYNC_BYTES (64 << 20)
+
+// Muxed data waiting for the writer.  Past this the muxer waits, and
+// frames back up in the recording pipeline's appsrc instead.
+#define MAX_QUEUED (32 << 20)
+// Encoded data waiting to be muxed or written, past which live frames
+// are dropped.
+#define MAX_BACKLOG (64 << 20)
+
+#define FINISH_TIMEOUT (5 * GST_SECOND)
+
+static const struct {
+    const char *name;
+    const char *muxer;
+} formats[] = {
+    { "mkv", "matroskamux" },
+    { "mp4", "mp4mux" },
+};
+
+// ----- Writer: a thread doing all the file I/O for one recorder
+
+typedef enum {
+    WRITE_OPEN,
+    WRITE_DATA,
+    WRITE_SEEK,
+    WRITE_CLOSE,
+    WRITE_QUIT,
+} WriteType;
+
+typedef struct {
+    WriteType type;
+    char *location;
+    GstBuffer *buffer;
+    guint64 offset;
+} WriteOp;
+
+typedef struct {
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    GQueue ops;
+    gsize queued;
+
+    // Totals, under the lock
+    guint64 written;
+    guint64 syncs;
+    gint64 busy_us;
+    guint64 errors;
+    guint64 discarded;
+
+    // Only used from the writer thread
+    int fd;
+    gboolean warned_closed;
+    guint8 *chunk;
+    gsize chunk_len;
+    gsize unsynced;
+} Writer;
+
+static void
+write_op_free(WriteOp *op) {
+    g_free(op->location);
+    if (op->buffer) {
+        gst_buffer_unref(op->buffer);
+    }
+    g_free(op);
+}
+
+static void
+writer_push(Writer *writer, WriteOp *op) {
+    gsize size = op->buffer ? gst_buffer_get_size(op->buffer) : 0;
+
+    g_mutex_lock(&writer->lock);
+    while (size > 0 && writer->queued >= MAX_QUEUED) {
+        g_cond_wait(&writer->cond, &writer->lock);
+    }
+    g_queue_push_tail(&writer->ops, op);
+    writer->queued += size;
+    g_cond_broadcast(&writer->cond);
+    g_mutex_unlock(&writer->lock);
+}
+
+static void
+writer_push_simple(Writer *writer, WriteType type) {
+    WriteOp *op = g_new0(WriteOp, 1);
+
+    op->type = type;
+    writer_push(writer, op);
+}
+
+static gsize
+writer_get_queued(Writer *writer) {
+    gsize queued;
+
+    g_mutex_lock(&writer->lock);
+    queued = writer->queued;
+    g_mutex_unlock(&writer->lock);
+
+    return queued;
+}
+
+static void
+writer_account(Writer *writer, gsize written, gboolean synced, gint64 busy_us,
+               gboolean failed) {
+    g_mutex_lock(&writer->lock);
+    writer->written += written;
+    writer->syncs += synced;
+    writer->busy_us += busy_us;
+    writer->errors += failed;
+    g_mutex_unlock(&writer->lock);
+}
+
+static void
+writer_flush(Writer *writer, gboolean sync) {
+    gint64 start = g_get_monotonic_time();
+    gsize done = 0;
+    gboolean failed = FALSE;
+
+    // The file couldn't be created, or the muxer wrote outside one
+    if (writer->fd < 0) {
+        if (writer->chunk_len == 0)
+            return;
+        if (!writer->warned_closed) {
+            g_warning("Discarding recorded data with no file open");
+            writer->warned_closed = TRUE;
+        }
+        g_mutex_lock(&writer->lock);
+        writer->discarded += writer->chunk_len;
+        g_mutex_unlock(&writer->lock);
+        writer->chunk_len = 0;
+        return;
+    }
+    while (done < writer->chunk_len) {
+        gssize n = write(writer->fd, writer->chunk + done, writer->chunk_len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            g_warning("Could not write recording: %s", g_strerror(errno));
+            failed = TRUE;
+            break;
+        }
+        done += n;
+    }
+    writer->unsynced += done;
+    writer->chunk_len = 0;
+
+    sync = sync || writer->unsynced >= SYNC_BYTES;
+    if (sync && writer->unsynced > 0) {
+        if (fdatasync(writer->fd) < 0) {
+            g_warning("Could not sync recording: %s", g_strerror(errno));
+            failed = TRUE;
+        }
+        writer->unsynced = 0;
+    }
+    writer_account(writer, done, sync, g_get_monotonic_time() - start, failed);
+}
+
+static void
+writer_append(Writer *writer, GstBuffer *buffer) {
+    GstMapInfo map;
+    gsize done = 0;
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return;
+    while (done < map.size) {
+        gsize n = MIN(map.size - done, WRITE_CHUNK - writer->chunk_len);
+
+        memcpy(writer->chunk + writer->chunk_len, map.data + done, n);
+        writer->chunk_len += n;
+        done += n;
+        if (writer->chunk_len == WRITE_CHUNK) {
+            writer_flush(writer, FALSE);
+        }
+    }
+    gst_buffer_unmap(buffer, &map);
+}
+
+static void
+writer_close(Writer *writer) {
+    if (writer->fd < 0)
+        return;
+    writer_flush(writer, TRUE);
+    close(writer->fd);
+    writer->fd = -1;
+}
+
+static void *
+writer_thread(void *user_data) {
+    Writer *writer = user_data;
+    gboolean running = TRUE;
+
+    while (running) {
+        WriteOp *op;
+
+        g_mutex_lock(&writer->lock);
+        while (g_queue_is_empty(&writer->ops)) {
+            g_cond_wait(&writer->cond, &writer->lock);
+        }
+        op = g_queue_pop_head(&writer->ops);
+        g_mutex_unlock(&writer->lock);
+
+        switch (op->type) {
+        case WRITE_OPEN:
+            writer_close(writer);
+            writer->fd = open(op->location, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (writer->fd < 0) {
+                g_warning("Could not create %s: %s", op->location, g_strerror(errno));
+                writer_account(writer, 0, FALSE, 0, TRUE);
+            }
+            writer->warned_closed = FALSE;
+            break;
+        case WRITE_DATA:
+            writer_append(writer, op->buffer);
+            break;
+        case WRITE_SEEK:
+            // The muxer rewriting a header
+            writer_flush(writer, FALSE);
+            if (writer->fd >= 0 && lseek(writer->fd, (off_t)op->offset, SEEK_SET) < 0) {
+                g_warning("Could not seek in recording: %s", g_strerror(errno));
+            }
+            break;
+        case WRITE_CLOSE:
+            writer_close(writer);
+            break;
+        case WRITE_QUIT:
+            writer_close(writer);
+            running = FALSE;
+            break;
+        }
+
+        g_mutex_lock(&writer->lock);
+        if (op->buffer) {
+            writer->queued -= gst_buffer_get_size(op->buffer);
+        }
+        g_cond_broadcast(&writer->cond);
+        g_mutex_unlock(&writer->lock);
+        write_op_free(op);
+    }
+
+    return NULL;
+}
+
+static Writer *
+writer_new(void) {
+    Writer *writer = g_new0(Writer, 1);
+
+    g_mutex_init(&writer->lock);
+    g_cond_init(&writer->cond);
+    g_queue_init(&writer->ops);
+    writer->fd = -1;
+    writer->chunk = g_aligned_alloc(WRITE_CHUNK, 1, WRITE_ALIGN);
+    writer->thread = g_thread_new("record-writer", writer_thread, writer);
+
+    return writer;
+}
+
+static void
+writer_free(Writer *writer) {
+    writer_push_simple(writer, WRITE_QUIT);
+    g_thread_join(writer->thread);
+    g_queue_clear_full(&writer->ops, (GDestroyNotify)write_op_free);
+    g_aligned_free(writer->chunk);
+    g_cond_clear(&writer->cond);
+    g_mutex_clear(&writer->lock);
+    g_free(writer);
+}
+
+// ----- RecordSink: hands splitmuxsink's output to the writer
+
+typedef struct {
+    GstBaseSink parent;
+    char *location;
+    Writer *writer;
+} RecordSink;
+
+typedef struct {
+    GstBaseSinkClass parent_class;
+} RecordSinkClass;
+
+enum {
+    PROP_0,
+    PROP_LOCATION,
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+GType record_sink_get_type(void);
+G_DEFINE_TYPE(RecordSink, record_sink, GST_TYPE_BASE_SINK);
+
+static void
+record_sink_set_property(GObject *object, guint prop_id, const GValue *value,
+                         GParamSpec *pspec) {
+    RecordSink *sink = (RecordSink *)object;
+
+    switch (prop_id) {
+    case PROP_LOCATION:
+        g_free(sink->location);
+        sink->location = g_value_dup_string(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+record_sink_get_property(GObject *object, guint prop_id, GValue *value,
+                         GParamSpec *pspec) {
+    RecordSink *sink = (RecordSink *)object;
+
+    switch (prop_id) {
+    case PROP_LOCATION:
+        g_value_set_string(value, sink->location);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+record_sink_finalize(GObject *object) {
+    RecordSink *sink = (RecordSink *)object;
+
+    g_free(sink->location);
+    G_OBJECT_CLASS(record_sink_parent_class)->finalize(object);
+}
+
+static gboolean
+record_sink_start(GstBaseSink *base) {
+    RecordSink *sink = (RecordSink *)base;
+    WriteOp *op = g_new0(WriteOp, 1);
+
+    op->type = WRITE_OPEN;
+    op->location = g_strdup(sink->location);
+    writer_push(sink->writer, op);
+    return TRUE;
+}
+
+static gboolean
+record_sink_stop(GstBaseSink *base) {
+    RecordSink *sink = (RecordSink *)base;
+
+    writer_push_simple(sink->writer, WRITE_CLOSE);
+    return TRUE;
+}
+
+static GstFlowReturn
+record_sink_render(GstBaseSink *base, GstBuffer *buffer) {
+    RecordSink *sink = (RecordSink *)base;
+    WriteOp *op = g_new0(WriteOp, 1);
+
+    op->type = WRITE_DATA;
+    op->buffer = gst_buffer_ref(buffer);
+    writer_push(sink->writer, op);
+    return GST_FLOW_OK;
+}
+
+static gboolean
+record_sink_event(GstBaseSink *base, GstEvent *event) {
+    RecordSink *sink = (RecordSink *)base;
+
+    // Muxers seek back with a byte segment to finish off headers
+    if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+        const GstSegment *segment;
+
+        gst_event_parse_segment(event, &segment);
+        if (segment->format == GST_FORMAT_BYTES) {
+            WriteOp *op = g_new0(WriteOp, 1);
+
+            op->type = WRITE_SEEK;
+            op->offset = segment->start;
+            writer_push(sink->writer, op);
+        }
+    }
+    return GST_BASE_SINK_CLASS(record_sink_parent_class)->event(base, event);
+}
+
+static gboolean
+record_sink_query(GstBaseSink *base, GstQuery *query) {
+    GstFormat format;
+
+    // mp4mux only writes a seekable file if it can seek back
+    if (GST_QUERY_TYPE(query) == GST_QUERY_SEEKING) {
+        gst_query_parse_seeking(query, &format, NULL, NULL, NULL);
+        if (format == GST_FORMAT_BYTES) {
+            gst_query_set_seeking(query, GST_FORMAT_BYTES, TRUE, 0, -1);
+            return TRUE;
+        }
+    }
+    return GST_BASE_SINK_CLASS(record_sink_parent_class)->query(base, query);
+}
+
+static void
+record_sink_class_init(RecordSinkClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSinkClass *sink_class = GST_BASE_SINK_CLASS(klass);
+
+    object_class->set_property = record_sink_set_property;
+    object_class->get_property = record_sink_get_property;
+    object_class->finalize = record_sink_finalize;
+    sink_class->start = record_sink_start;
+    sink_class->stop = record_sink_stop;
+    sink_class->render = record_sink_render;
+    sink_class->event = record_sink_event;
+    sink_class->query = record_sink_query;
+
+    // splitmuxsink sets the location of each file
+    g_object_class_install_property(
+        object_class, PROP_LOCATION,
+        g_param_spec_string("location", "Location", "File to write",
+                            NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+    gst_element_class_set_static_metadata(
+        element_class, "Recording sink", "Sink/File",
+        "Writes files from a separate thread", "obs-rtsp-source");
+}
+
+static void
+record_sink_init(RecordSink *sink) {
+    g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+}
+
+// ----- Recorder
+
+// Shared by a recording pipeline's bus handler and the recorder, so
+// that neither keeps the other alive.
+typedef struct {
+    char *path;
+    gint failed;
+} PipelineStatus;
+
+static PipelineStatus *
+pipeline_status_new(const char *path) {
+    PipelineStatus *status = g_atomic_rc_box_new0(PipelineStatus);
+
+    status->path = g_strdup(path);
+    return status;
+}
+
+static PipelineStatus *
+pipeline_status_ref(PipelineStatus *status) {
+    return g_atomic_rc_box_acquire(status);
+}
+
+static void
+pipeline_status_clear(PipelineStatus *status) {
+    g_free(status->path);
+}
+
+static void
+pipeline_status_unref(PipelineStatus *status) {
+    g_atomic_rc_box_release_full(status, (GDestroyNotify)pipeline_status_clear);
+}
+
+// Nothing else reads the bus, so keep only what
+// recorder_finish_pipeline() waits for.
+static GstBusSyncReply
+pipeline_bus_message(GstBus *bus, GstMessage *message, void *user_data) {
+    PipelineStatus *status = user_data;
+    g_autoptr(GError) error = NULL;
+
+    switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR:
+        if (!g_atomic_int_compare_and_exchange(&status->failed, FALSE, TRUE))
+            return GST_BUS_DROP;
+        gst_message_parse_error(message, &error, NULL);
+        g_warning("Error recording '%s', restarting at the next keyframe: %s",
+                  status->path, error->message);
+        return GST_BUS_PASS;
+    case GST_MESSAGE_EOS:
+        return GST_BUS_PASS;
+    default:
+        return GST_BUS_DROP;
+    }
+}
+
+struct _Recorder {
+    char *path;
+    char *directory;
+    char *element;
+    const char *format;
+    const char *muxer;
+    GstClockTime segment_length;
+    Writer *writer;
+
+    GMutex lock;
+    GstCaps *caps;
+    GstElement *pipeline;
+    GstElement *src;
+    PipelineStatus *status;
+    // The format changed or the pipeline failed, so a new pipeline
+    // starts at the next keyframe
+    gboolean restart;
+    // A new pipeline is being set up, and frames wait in pending
+    gboolean starting;
+    GQueue pending;
+    gsize pending_bytes;
+    gboolean dropping;
+    GstClockTime base;
+    guint64 frames;
+    guint64 dropped;
+};
+
+static void
+recorder_finish_pipeline(GstElement *pipeline) {
+    g_autoptr(GstElement) src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_autoptr(GstBus) bus = gst_element_get_bus(pipeline);
+    g_autoptr(GstMessage) message = NULL;
+
+    // Let the muxer finish the file before shutting down
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    message = gst_bus_timed_pop_filtered(bus, FINISH_TIMEOUT,
+                                         GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+}
+
+static GstElement *
+make_parser(GstCaps *caps) {
+    GList *factories, *matching;
+    GstElement *parser;
+
+    // Muxers need parsed, and for H.264 length-prefixed, input
+    factories = gst_element_factory_list_get_elements(
+        GST_ELEMENT_FACTORY_TYPE_PARSER, GST_RANK_MARGINAL);
+    factories = g_list_sort(factories, gst_plugin_feature_rank_compare_func);
+    matching = gst_element_factory_list_filter(factories, caps, GST_PAD_SINK, FALSE);
+    parser = matching ? gst_element_factory_create(matching->data, NULL)
+        : gst_element_factory_make("identity", NULL);
+    gst_plugin_feature_list_free(matching);
+    gst_plugin_feature_list_free(factories);
+
+    return parser;
+}
+
+static GstElement *
+recorder_create_pipeline(Recorder *recorder, GstCaps *caps, PipelineStatus *status) {
+    g_autoptr(GstElement) pipeline = NULL;
+    g_autoptr(GstBus) bus = NULL;
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    g_autofree char *stamp = NULL;
+    g_autofree char *name = NULL;
+    g_autofree char *location = NULL;
+    GstElement *src, *parse, *mux;
+    RecordSink *sink;
+
+    pipeline = gst_object_ref_sink(gst_pipeline_new(NULL));
+    src = gst_element_factory_make("appsrc", "src");
+    parse = make_parser(caps);
+    mux = gst_element_factory_make("splitmuxsink", NULL);
+    if (!src || !parse || !mux) {
+        g_warning("Missing GStreamer elements needed to record '%s'", recorder->path);
+        g_clear_object(&src);
+        g_clear_object(&parse);
+        g_clear_object(&mux);
+        return NULL;
+    }
+    gst_bin_add_many(GST_BIN(pipeline), src, parse, mux, NULL);
+    bus = gst_element_get_bus(pipeline);
+    gst_bus_set_sync_handler(bus, pipeline_bus_message, pipeline_status_ref(status),
+                             (GDestroyNotify)pipeline_status_unref);
+
+    sink = g_object_new(record_sink_get_type(), NULL);
+    sink->writer = recorder->writer;
+
+    // e.g. video-20240101-120000-00000.mkv
+    name = g_strdelimit(g_strdup(recorder->path + (recorder->path[0] == '/')), "/", '-');
+    stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    location = g_strdup_printf("%s/%s-%s-%%05d.%s", recorder->directory, name,
+                               stamp, recorder->format);
+
+    g_object_set(src,
+                 "caps", caps,
+                 "format", GST_FORMAT_TIME,
+                 "is-live", TRUE,
+                 "block", FALSE,
+                 "max-bytes", (guint64)MAX_BACKLOG,
+                 NULL);
+    g_object_set(mux,
+                 "location", location,
+                 "max-size-time", recorder->segment_length,
+                 "muxer-factory", recorder->muxer,
+                 "sink", sink,
+                 NULL);
+
+    if (!gst_element_link_many(src, parse, mux, NULL)) {
+        g_warning("Cannot record '%s' as %s", recorder->path, recorder->format);
+        return NULL;
+    }
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_warning("Could not start recording '%s'", recorder->path);
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        return NULL;
+    }
+    g_message("Recording '%s' to %s", recorder->path, location);
+
+    return g_steal_pointer(&pipeline);
+}
+
+typedef struct {
+    Recorder *recorder;
+    GstElement *old;
+    GstCaps *caps;
+} Start;
+
+// Replaces the recording pipeline away from the live streaming thread
+static void *
+start_thread(void *user_data) {
+    Start *start = user_data;
+    Recorder *recorder = start->recorder;
+    PipelineStatus *status = pipeline_status_new(recorder->path);
+    GstElement *pipeline;
+    GstBuffer *buffer;
+
+    // The pipelines share the writer, so the old file has to be
+    // finished and closed before the new one is opened.
+    if (start->old) {
+        recorder_finish_pipeline(start->old);
+    }
+    pipeline = recorder_create_pipeline(recorder, start->caps, status);
+
+    g_mutex_lock(&recorder->lock);
+    recorder->pipeline = pipeline;
+    g_clear_pointer(&recorder->status, pipeline_status_unref);
+    recorder->status = status;
+    if (pipeline) {
+        recorder->src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+        gst_object_unref(recorder->src);
+    }
+    while ((buffer = g_queue_pop_head(&recorder->pending))) {
+        if (recorder->src) {
+            gst_app_src_push_buffer(GST_APP_SRC(recorder->src), buffer);
+        } else {
+            gst_buffer_unref(buffer);
+        }
+    }
+    recorder->pending_bytes = 0;
+    recorder->starting = FALSE;
+    g_mutex_unlock(&recorder->lock);
+
+    gst_caps_unref(start->caps);
+    recorder_unref(recorder);
+    g_free(start);
+
+    return NULL;
+}
+
+static void
+recorder_set_caps(Recorder *recorder, GstCaps *caps) {
+    g_mutex_lock(&recorder->lock);
+    if (recorder->caps == NULL || !gst_caps_is_equal(caps, recorder->caps)) {
+        gst_caps_replace(&recorder->caps, caps);
+        recorder->restart = TRUE;
+    }
+    g_mutex_unlock(&recorder->lock);
+}
+
+static GstClockTime
+rebase(GstClockTime time, GstClockTime base) {
+    if (!GST_CLOCK_TIME_IS_VALID(time))
+        return GST_CLOCK_TIME_NONE;
+    return time > base ? time - base : 0;
+}
+
+// Called from the live streaming thread, so must never wait on the
+// recording.
+static void
+recorder_add(Recorder *recorder, GstBuffer *buffer) {
+    gboolean keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    Start *start = NULL;
+    GstBuffer *out;
+    guint64 backlog;
+
+    g_mutex_lock(&recorder->lock);
+    if (!recorder->starting && recorder->status &&
+        g_atomic_int_get(&recorder->status->failed)) {
+        recorder->restart = TRUE;
+    }
+    if (recorder->restart) {
+        // Restart at a keyframe, once any earlier restart has finished
+        if (!keyframe || recorder->starting || recorder->caps == NULL) {
+            g_mutex_unlock(&recorder->lock);
+            return;
+        }
+        start = g_new0(Start, 1);
+        start->recorder = recorder_ref(recorder);
+        start->old = g_steal_pointer(&recorder->pipeline);
+        start->caps = gst_caps_ref(recorder->caps);
+        recorder->src = NULL;
+        recorder->restart = FALSE;
+        recorder->starting = TRUE;
+        recorder->dropping = FALSE;
+        recorder->base = GST_BUFFER_DTS_IS_VALID(buffer)
+            ? GST_BUFFER_DTS(buffer) : GST_BUFFER_PTS(buffer);
+    }
+
+    if (recorder->starting) {
+        backlog = recorder->pending_bytes;
+    } else if (recorder->src) {
+        backlog = gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder->src)) +
+            writer_get_queued(recorder->writer);
+    } else {
+        // The pipeline couldn't be created
+        g_mutex_unlock(&recorder->lock);
+        return;
+    }
+    if (backlog > MAX_BACKLOG) {
+        recorder->dropping = TRUE;
+    }
+    if (recorder->dropping && (!keyframe || backlog > MAX_BACKLOG)) {
+        recorder->dropped++;
+        g_mutex_unlock(&recorder->lock);
+        goto done;
+    }
+    recorder->dropping = FALSE;
+
+    // Pooled buffers, like v4l2src's, have to go back to the device
+    out = buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_copy(buffer);
+    GST_BUFFER_PTS(out) = rebase(GST_BUFFER_PTS(buffer), recorder->base);
+    GST_BUFFER_DTS(out) = rebase(GST_BUFFER_DTS(buffer), recorder->base);
+    if (recorder->starting) {
+        g_queue_push_tail(&recorder->pending, out);
+        recorder->pending_bytes += gst_buffer_get_size(out);
+    } else {
+        gst_app_src_push_buffer(GST_APP_SRC(recorder->src), out);
+    }
+    recorder->frames++;
+    g_mutex_unlock(&recorder->lock);
+
+done:
+    // Building and starting a pipeline, and finishing the old one's
+    // file, take far too long for the streaming thread.
+    if (start) {
+        g_thread_unref(g_thread_new("record-start", start_thread, start));
+    }
+}
+
+static GstPadProbeReturn
+record_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    Recorder *recorder = user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        recorder_add(recorder, GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+        GstCaps *caps;
+
+        gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+        recorder_set_caps(recorder, caps);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+void
+recorder_attach(Recorder *recorder, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) target = NULL;
+    g_autoptr(GstPad) pad = NULL;
+
+    target = gst_bin_get_by_name(GST_BIN(element), recorder->element);
+    if (target) {
+        pad = gst_element_get_static_pad(target, "sink");
+    }
+    if (pad == NULL) {
+        g_warning("Cannot record '%s': no %s element with a sink pad",
+                  recorder->path, recorder->element);
+        return;
+    }
+
+    // A new media starts its timestamps again, so needs a new file
+    g_mutex_lock(&recorder->lock);
+    recorder->restart = TRUE;
+    g_mutex_unlock(&recorder->lock);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      record_probe, recorder_ref(recorder),
+                      (GDestroyNotify)recorder_unref);
+}
+
+typedef struct {
+    GstElement *pipeline;
+    Writer *writer;
+} Finish;
+
+static void *
+finish_thread(void *user_data) {
+    Finish *finish = user_data;
+
+    recorder_finish_pipeline(finish->pipeline);
+    writer_free(finish->writer);
+    g_free(finish);
+
+    return NULL;
+}
+
+static void
+recorder_clear(Recorder *recorder) {
+    // The last reference is often dropped on the main loop, by a
+    // reload, which can't wait for the file to be finished.  The
+    // pipeline's sink writes through the writer until then.
+    if (recorder->pipeline) {
+        Finish *finish = g_new0(Finish, 1);
+
+        finish->pipeline = g_steal_pointer(&recorder->pipeline);
+        finish->writer = g_steal_pointer(&recorder->writer);
+        g_thread_unref(g_thread_new("record-finish", finish_thread, finish));
+    }
+    g_clear_pointer(&recorder->status, pipeline_status_unref);
+    g_queue_clear_full(&recorder->pending, (GDestroyNotify)gst_buffer_unref);
+    g_clear_pointer(&recorder->writer, writer_free);
+    gst_clear_caps(&recorder->caps);
+    g_clear_pointer(&recorder->path, g_free);
+    g_clear_pointer(&recorder->directory, g_free);
+    g_clear_pointer(&recorder->element, g_free);
+    g_mutex_clear(&recorder->lock);
+}
+
+Recorder *
+recorder_new(const char *path, const char *directory, const char *format,
+             guint segment_seconds, const char *element, GError **error) {
+    g_autoptr(Recorder) recorder = NULL;
+    gsize i;
+
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+        if (!g_strcmp0(format, formats[i].name))
+            break;
+    }
+    if (i == G_N_ELEMENTS(formats)) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Unknown record-format '%s' for '%s': expected mkv or mp4",
+                    format, path);
+        return NULL;
+    }
+    if (g_mkdir_with_parents(directory, 0755) < 0) {
+        int saved_errno = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                    "Could not create '%s': %s", directory, g_strerror(saved_errno));
+        return NULL;
+    }
+
+    recorder = g_atomic_rc_box_new0(Recorder);
+    recorder->path = g_strdup(path);
+    recorder->directory = g_strdup(directory);
+    recorder->element = g_strdup(element);
+    recorder->format = formats[i].name;
+    recorder->muxer = formats[i].muxer;
+    recorder->segment_length = segment_seconds * GST_SECOND;
+    g_mutex_init(&recorder->lock);
+    g_queue_init(&recorder->pending);
+    recorder->writer = writer_new();
+
+    return g_steal_pointer(&recorder);
+}
+
+Recorder *
+recorder_ref(Recorder *recorder) {
+    return g_atomic_rc_box_acquire(recorder);
+}
+
+void
+recorder_unref(Recorder *recorder) {
+    g_atomic_rc_box_release_full(recorder, (GDestroyNotify)recorder_clear);
+}
+
+void
+recorder_collect(GString *out, void *user_data) {
+    Recorder *recorder = user_data;
+    Writer *writer = recorder->writer;
+    guint64 level = 0, frames, dropped;
+
+    g_mutex_lock(&recorder->lock);
+    if (recorder->starting) {
+        level = recorder->pending_bytes;
+    } else if (recorder->src) {
+        level = gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder->src));
+    }
+    frames = recorder->frames;
+    dropped = recorder->dropped;
+    g_mutex_unlock(&recorder->lock);
+
+    g_mutex_lock(&writer->lock);
+    g_string_append_printf(
+        out, "rtsp_sender_record_backlog_bytes{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, level + writer->queued);
+    g_string_append_printf(
+        out, "rtsp_sender_record_written_bytes_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, writer->written);
+    g_string_append_printf(
+        out, "rtsp_sender_record_write_seconds_total{mount=\"%s\"} %g\n",
+        recorder->path, writer->busy_us / (double)G_USEC_PER_SEC);
+    g_string_append_printf(
+        out, "rtsp_sender_record_syncs_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, writer->syncs);
+    g_string_append_printf(
+        out, "rtsp_sender_record_errors_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, writer->errors);
+    g_string_append_printf(
+        out, "rtsp_sender_record_discarded_bytes_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, writer->discarded);
+    g_mutex_unlock(&writer->lock);
+
+    g_string_append_printf(
+        out, "rtsp_sender_record_frames_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, frames);
+    g_string_append_printf(
+        out, "rtsp_sender_record_dropped_frames_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        recorder->path, dropped);
+}
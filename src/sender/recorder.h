@@ -0,0 +1,26 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _Recorder Recorder;
+
+// Records the encoded stream entering a mount's element (normally
+// pay0) to a series of files in directory, starting a new one at the
+// first keyframe after each segment_seconds.  format is "mkv" or
+// "mp4".  Muxing and writing happen on their own threads: if they fall
+// behind, frames are dropped up to the next keyframe rather than
+// holding up the live stream.  If recording fails, a new file is
+// started at the next keyframe.  Frames are only seen while the
+// mount's media is playing, so only while it has at least one client.
+Recorder *recorder_new(const char *path, const char *directory,
+                       const char *format, guint segment_seconds,
+                       const char *element, GError **error);
+Recorder *recorder_ref(Recorder *recorder);
+void recorder_unref(Recorder *recorder);
+
+void recorder_attach(Recorder *recorder, GstRTSPMedia *media);
+
+void recorder_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(Recorder, recorder_unref);
@@ -0,0 +1,501 @@
+#include "replay-buffer.h"
+
+#include <gst/app/gstappsrc.h>
+
+// Timestamps further back than this are a restarted pipeline rather
+// than reordered frames.
+#define MAX_REORDER (1 * GST_SECOND)
+
+typedef struct {
+    GstClockTime start;
+    GPtrArray *frames;
+    gsize bytes;
+} Gop;
+
+// Bytes held by clients' snapshots, which can outlive the buffer
+typedef struct {
+    GMutex lock;
+    gsize max_bytes;
+    gsize bytes;
+    guint clients;
+} SnapshotBudget;
+
+typedef struct _ReplayFactory ReplayFactory;
+
+struct _ReplayBuffer {
+    char *path;
+    GstClockTime max_duration;
+    gsize max_bytes;
+    ReplayFactory *factory;
+    SnapshotBudget *budget;
+
+    GMutex lock;
+    GstCaps *caps;
+    GQueue gops;
+    GstClockTime end;
+    gsize bytes;
+    guint n_frames;
+};
+
+// What one replay client plays: the buffer's frames when it connected
+typedef struct {
+    GstCaps *caps;
+    GPtrArray *frames;
+    // Indexes of keyframes in frames
+    GArray *keyframes;
+    GstClockTime start;
+    GstClockTime duration;
+    SnapshotBudget *budget;
+    gsize bytes;
+
+    // Only used from the appsrc's streaming thread
+    guint next;
+    GstClockTimeDiff offset;
+} ReplayClip;
+
+static void
+snapshot_budget_clear(SnapshotBudget *budget) {
+    g_mutex_clear(&budget->lock);
+}
+
+static void
+snapshot_budget_unref(SnapshotBudget *budget) {
+    g_atomic_rc_box_release_full(budget, (GDestroyNotify)snapshot_budget_clear);
+}
+
+static Gop *
+gop_new(GstClockTime start) {
+    Gop *gop = g_new0(Gop, 1);
+
+    gop->start = start;
+    gop->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+    return gop;
+}
+
+static void
+gop_free(Gop *gop) {
+    g_ptr_array_unref(gop->frames);
+    g_free(gop);
+}
+
+static void
+replay_buffer_drop_oldest(ReplayBuffer *replay) {
+    Gop *gop = g_queue_pop_head(&replay->gops);
+
+    replay->bytes -= gop->bytes;
+    replay->n_frames -= gop->frames->len;
+    gop_free(gop);
+}
+
+static void
+replay_buffer_reset(ReplayBuffer *replay) {
+    while (!g_queue_is_empty(&replay->gops)) {
+        replay_buffer_drop_oldest(replay);
+    }
+    replay->end = 0;
+}
+
+static void replay_factory_detach(ReplayFactory *factory);
+
+static void
+replay_buffer_clear(ReplayBuffer *replay) {
+    if (replay->factory) {
+        replay_factory_detach(replay->factory);
+    }
+    g_clear_object(&replay->factory);
+    g_clear_pointer(&replay->budget, snapshot_budget_unref);
+    replay_buffer_reset(replay);
+    gst_clear_caps(&replay->caps);
+    g_clear_pointer(&replay->path, g_free);
+    g_mutex_clear(&replay->lock);
+}
+
+static void
+replay_clip_free(ReplayClip *clip) {
+    g_mutex_lock(&clip->budget->lock);
+    clip->budget->bytes -= clip->bytes;
+    clip->budget->clients--;
+    g_mutex_unlock(&clip->budget->lock);
+    snapshot_budget_unref(clip->budget);
+
+    gst_clear_caps(&clip->caps);
+    g_ptr_array_unref(clip->frames);
+    g_array_unref(clip->keyframes);
+    g_free(clip);
+}
+
+// Returns NULL if there is nothing to replay, or no room for another
+// client's snapshot.
+static ReplayClip *
+replay_buffer_snapshot(ReplayBuffer *replay) {
+    SnapshotBudget *budget = replay->budget;
+    ReplayClip *clip;
+    GList *first = NULL, *l;
+    gsize available, bytes = 0;
+    guint i;
+
+    g_mutex_lock(&replay->lock);
+    if (g_queue_is_empty(&replay->gops)) {
+        g_mutex_unlock(&replay->lock);
+        g_message("No replay of '%s' yet", replay->path);
+        return NULL;
+    }
+
+    // Snapshots keep frames alive after the buffer drops them, so all
+    // of them together are held to max_bytes.  Take as many of the
+    // newest groups as fit.
+    g_mutex_lock(&budget->lock);
+    available = budget->max_bytes - budget->bytes;
+    for (l = replay->gops.tail; l != NULL; l = l->prev) {
+        Gop *gop = l->data;
+
+        if (bytes + gop->bytes > available)
+            break;
+        bytes += gop->bytes;
+        first = l;
+    }
+    if (first == NULL) {
+        g_message("Refusing a replay of '%s': %u clients already hold %" G_GSIZE_FORMAT " bytes",
+                  replay->path, budget->clients, budget->bytes);
+        g_mutex_unlock(&budget->lock);
+        g_mutex_unlock(&replay->lock);
+        return NULL;
+    }
+    budget->bytes += bytes;
+    budget->clients++;
+    g_mutex_unlock(&budget->lock);
+
+    clip = g_new0(ReplayClip, 1);
+    clip->budget = g_atomic_rc_box_acquire(budget);
+    clip->bytes = bytes;
+    clip->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+    clip->keyframes = g_array_new(FALSE, FALSE, sizeof(guint));
+    clip->caps = replay->caps ? gst_caps_ref(replay->caps) : NULL;
+    for (l = first; l != NULL; l = l->next) {
+        Gop *gop = l->data;
+
+        g_array_append_val(clip->keyframes, clip->frames->len);
+        for (i = 0; i < gop->frames->len; i++) {
+            g_ptr_array_add(clip->frames, gst_buffer_ref(g_ptr_array_index(gop->frames, i)));
+        }
+    }
+    clip->start = ((Gop *)first->data)->start;
+    clip->duration = replay->end - clip->start;
+    g_mutex_unlock(&replay->lock);
+
+    clip->offset = -(GstClockTimeDiff)clip->start;
+    return clip;
+}
+
+static void
+replay_buffer_set_caps(ReplayBuffer *replay, GstCaps *caps) {
+    g_mutex_lock(&replay->lock);
+    // Frames in another format can't be played out together
+    if (replay->caps == NULL || !gst_caps_is_equal(caps, replay->caps)) {
+        replay_buffer_reset(replay);
+        gst_caps_replace(&replay->caps, caps);
+    }
+    g_mutex_unlock(&replay->lock);
+}
+
+static void
+replay_buffer_add(ReplayBuffer *replay, GstBuffer *buffer) {
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    gboolean keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    gsize size = gst_buffer_get_size(buffer);
+    Gop *gop;
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return;
+
+    g_mutex_lock(&replay->lock);
+    gop = g_queue_peek_tail(&replay->gops);
+    if (gop && pts + MAX_REORDER < gop->start) {
+        replay_buffer_reset(replay);
+        gop = NULL;
+    }
+    if (keyframe) {
+        gop = gop_new(pts);
+        g_queue_push_tail(&replay->gops, gop);
+    }
+    // Nothing can be decoded before the first keyframe
+    if (gop == NULL) {
+        g_mutex_unlock(&replay->lock);
+        return;
+    }
+
+    // Pooled buffers, like v4l2src's, have to go back to the device
+    g_ptr_array_add(gop->frames, buffer->pool ? gst_buffer_copy_deep(buffer)
+                    : gst_buffer_ref(buffer));
+    gop->bytes += size;
+    replay->bytes += size;
+    replay->n_frames++;
+    if (GST_BUFFER_DURATION_IS_VALID(buffer))
+        pts += GST_BUFFER_DURATION(buffer);
+    replay->end = MAX(replay->end, pts);
+
+    // Keep whole groups, as long as the rest still covers the duration
+    while (replay->gops.length > 1) {
+        Gop *next = g_queue_peek_nth(&replay->gops, 1);
+
+        if (replay->end - next->start < replay->max_duration &&
+            replay->bytes <= replay->max_bytes)
+            break;
+        replay_buffer_drop_oldest(replay);
+    }
+    g_mutex_unlock(&replay->lock);
+}
+
+static GstPadProbeReturn
+capture_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    ReplayBuffer *replay = user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        replay_buffer_add(replay, GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) {
+        GstCaps *caps;
+
+        gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+        replay_buffer_set_caps(replay, caps);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+void
+replay_buffer_attach(ReplayBuffer *replay, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstPad) pad = NULL;
+    g_autofree char *launch = NULL;
+
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    if (pay == NULL) {
+        g_warning("Cannot keep a replay of '%s': no pay0 element", replay->path);
+        return;
+    }
+
+    // Replays are payloaded the same way as the live stream
+    launch = g_strdup_printf("( appsrc name=src ! %s name=pay0 )",
+                             GST_OBJECT_NAME(gst_element_get_factory(pay)));
+    gst_rtsp_media_factory_set_launch(GST_RTSP_MEDIA_FACTORY(replay->factory), launch);
+
+    pad = gst_element_get_static_pad(pay, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      capture_probe, replay_buffer_ref(replay),
+                      (GDestroyNotify)replay_buffer_unref);
+}
+
+static void
+clip_need_data(GstAppSrc *src, guint length, void *user_data) {
+    ReplayClip *clip = user_data;
+    GstBuffer *frame, *out;
+    GstClockTimeDiff pts, dts;
+
+    if (clip->next >= clip->frames->len) {
+        gst_app_src_end_of_stream(src);
+        return;
+    }
+    frame = g_ptr_array_index(clip->frames, clip->next++);
+
+    // Only the metadata is copied
+    out = gst_buffer_copy(frame);
+    pts = (GstClockTimeDiff)GST_BUFFER_PTS(frame) + clip->offset;
+    GST_BUFFER_PTS(out) = (GstClockTime)MAX(pts, 0);
+    dts = GST_BUFFER_DTS_IS_VALID(frame)
+        ? (GstClockTimeDiff)GST_BUFFER_DTS(frame) + clip->offset : -1;
+    GST_BUFFER_DTS(out) = dts >= 0 ? (GstClockTime)dts : GST_CLOCK_TIME_NONE;
+    gst_app_src_push_buffer(src, out);
+}
+
+static gboolean
+clip_seek_data(GstAppSrc *src, guint64 position, void *user_data) {
+    ReplayClip *clip = user_data;
+    GstClockTime keyframe_pts = clip->start;
+    guint i, index = 0;
+
+    // Start from the last keyframe at or before the position, shown at
+    // the position itself so nothing is clipped.
+    for (i = 0; i < clip->keyframes->len; i++) {
+        guint k = g_array_index(clip->keyframes, guint, i);
+        GstClockTime pts = GST_BUFFER_PTS((GstBuffer *)g_ptr_array_index(clip->frames, k));
+
+        if (i > 0 && pts - clip->start > position)
+            break;
+        index = k;
+        keyframe_pts = pts;
+    }
+    clip->next = index;
+    clip->offset = (GstClockTimeDiff)position - (GstClockTimeDiff)keyframe_pts;
+    return TRUE;
+}
+
+// ----- ReplayFactory: builds each client's media around a snapshot
+
+struct _ReplayFactory {
+    GstRTSPMediaFactory parent;
+
+    // Cleared when the buffer is freed, as clients can still hold
+    // the factory.
+    GMutex lock;
+    ReplayBuffer *replay;
+};
+
+typedef struct {
+    GstRTSPMediaFactoryClass parent_class;
+} ReplayFactoryClass;
+
+GType replay_factory_get_type(void);
+G_DEFINE_TYPE(ReplayFactory, replay_factory, GST_TYPE_RTSP_MEDIA_FACTORY);
+
+static void
+replay_factory_detach(ReplayFactory *factory) {
+    g_mutex_lock(&factory->lock);
+    factory->replay = NULL;
+    g_mutex_unlock(&factory->lock);
+}
+
+static void
+replay_factory_setup(GstElement *element, ReplayClip *clip) {
+    g_autoptr(GstElement) src = NULL;
+    g_autoptr(GstElement) pay = NULL;
+    GstAppSrcCallbacks callbacks = { NULL };
+
+    src = gst_bin_get_by_name(GST_BIN(element), "src");
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    if (src == NULL || pay == NULL) {
+        replay_clip_free(clip);
+        return;
+    }
+
+    g_object_set(src,
+                 "caps", clip->caps,
+                 "format", GST_FORMAT_TIME,
+                 "stream-type", GST_APP_STREAM_TYPE_SEEKABLE,
+                 "duration", clip->duration,
+                 NULL);
+    // Parameter sets must come with every keyframe a seek can land on
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(pay), "config-interval")) {
+        g_object_set(pay, "config-interval", -1, NULL);
+    }
+
+    callbacks.need_data = clip_need_data;
+    callbacks.seek_data = clip_seek_data;
+    gst_app_src_set_callbacks(GST_APP_SRC(src), &callbacks, clip,
+                              (GDestroyNotify)replay_clip_free);
+}
+
+static GstElement *
+replay_factory_create_element(GstRTSPMediaFactory *base, const GstRTSPUrl *url) {
+    ReplayFactory *factory = (ReplayFactory *)base;
+    ReplayClip *clip = NULL;
+    GstElement *element;
+
+    g_mutex_lock(&factory->lock);
+    if (factory->replay) {
+        clip = replay_buffer_snapshot(factory->replay);
+    }
+    g_mutex_unlock(&factory->lock);
+    // The client is answered 503 Service Unavailable
+    if (clip == NULL)
+        return NULL;
+
+    element = GST_RTSP_MEDIA_FACTORY_CLASS(replay_factory_parent_class)->create_element(base, url);
+    if (element == NULL) {
+        replay_clip_free(clip);
+        return NULL;
+    }
+    replay_factory_setup(element, clip);
+    return element;
+}
+
+static void
+replay_factory_finalize(GObject *object) {
+    ReplayFactory *factory = (ReplayFactory *)object;
+
+    g_mutex_clear(&factory->lock);
+    G_OBJECT_CLASS(replay_factory_parent_class)->finalize(object);
+}
+
+static void
+replay_factory_class_init(ReplayFactoryClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GstRTSPMediaFactoryClass *factory_class = GST_RTSP_MEDIA_FACTORY_CLASS(klass);
+
+    object_class->finalize = replay_factory_finalize;
+    factory_class->create_element = replay_factory_create_element;
+}
+
+static void
+replay_factory_init(ReplayFactory *factory) {
+    g_mutex_init(&factory->lock);
+}
+
+ReplayBuffer *
+replay_buffer_new(const char *path, guint seconds, gsize max_bytes) {
+    ReplayBuffer *replay = g_atomic_rc_box_new0(ReplayBuffer);
+
+    replay->path = g_strdup(path);
+    replay->max_duration = seconds * GST_SECOND;
+    replay->max_bytes = max_bytes;
+    g_mutex_init(&replay->lock);
+    g_queue_init(&replay->gops);
+    replay->budget = g_atomic_rc_box_new0(SnapshotBudget);
+    replay->budget->max_bytes = max_bytes;
+    g_mutex_init(&replay->budget->lock);
+
+    // Each client gets its own snapshot, so nothing is shared
+    replay->factory = g_object_new(replay_factory_get_type(), NULL);
+    replay->factory->replay = replay;
+    gst_rtsp_media_factory_set_profiles(
+        GST_RTSP_MEDIA_FACTORY(replay->factory), GST_RTSP_PROFILE_AVP | GST_RTSP_PROFILE_AVPF);
+
+    return replay;
+}
+
+ReplayBuffer *
+replay_buffer_ref(ReplayBuffer *replay) {
+    return g_atomic_rc_box_acquire(replay);
+}
+
+void
+replay_buffer_unref(ReplayBuffer *replay) {
+    g_atomic_rc_box_release_full(replay, (GDestroyNotify)replay_buffer_clear);
+}
+
+GstRTSPMediaFactory *
+replay_buffer_get_factory(ReplayBuffer *replay) {
+    return GST_RTSP_MEDIA_FACTORY(replay->factory);
+}
+
+void
+replay_buffer_collect(GString *out, void *user_data) {
+    ReplayBuffer *replay = user_data;
+    GstClockTime duration = 0;
+    Gop *oldest;
+
+    g_mutex_lock(&replay->lock);
+    oldest = g_queue_peek_head(&replay->gops);
+    if (oldest) {
+        duration = replay->end - oldest->start;
+    }
+    g_string_append_printf(
+        out, "rtsp_sender_replay_bytes{mount=\"%s\"} %" G_GSIZE_FORMAT "\n",
+        replay->path, replay->bytes);
+    g_string_append_printf(
+        out, "rtsp_sender_replay_frames{mount=\"%s\"} %u\n",
+        replay->path, replay->n_frames);
+    g_string_append_printf(
+        out, "rtsp_sender_replay_seconds{mount=\"%s\"} %g\n",
+        replay->path, duration / (double)GST_SECOND);
+    g_mutex_unlock(&replay->lock);
+
+    g_mutex_lock(&replay->budget->lock);
+    g_string_append_printf(
+        out, "rtsp_sender_replay_snapshot_bytes{mount=\"%s\"} %" G_GSIZE_FORMAT "\n",
+        replay->path, replay->budget->bytes);
+    g_string_append_printf(
+        out, "rtsp_sender_replay_clients{mount=\"%s\"} %u\n",
+        replay->path, replay->budget->clients);
+    g_mutex_unlock(&replay->budget->lock);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _ReplayBuffer ReplayBuffer;
+
+// Keeps the last few seconds of a mount's encoded video, as it enters
+// pay0, in groups starting at each keyframe.  Frames are referenced
+// rather than copied, and are dropped a group at a time once there
+// are more than seconds of them or they take more than max_bytes.
+ReplayBuffer *replay_buffer_new(const char *path, guint seconds, gsize max_bytes);
+ReplayBuffer *replay_buffer_ref(ReplayBuffer *replay);
+void replay_buffer_unref(ReplayBuffer *replay);
+
+// Start capturing from the live media's pay0
+void replay_buffer_attach(ReplayBuffer *replay, GstRTSPMedia *media);
+
+// Serves each client a snapshot of the buffer, starting from its
+// oldest keyframe.  Range seeks go to the keyframe before the
+// requested time, and a Scale or Speed above 1 plays faster than real
+// time.  All the snapshots together are held to max_bytes, leaving
+// out their oldest groups if need be.  Clients are refused while the
+// buffer is empty or there is no room for a snapshot.
+GstRTSPMediaFactory *replay_buffer_get_factory(ReplayBuffer *replay);
+
+void replay_buffer_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(ReplayBuffer, replay_buffer_unref);
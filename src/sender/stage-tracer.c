@@ -0,0 +1,305 @@
+#include "stage-tracer.h"
+
+#include "histogram.h"
+#include "media-util.h"
+
+#include <string.h>
+
+#define N_FRAMES 64
+
+typedef enum {
+    POINT_CAPTURE,
+    POINT_ENCODED,
+    POINT_PAYLOADED,
+    POINT_SENT,
+    N_POINTS
+} Point;
+
+typedef enum {
+    STAGE_DEVICE,
+    STAGE_ENCODE,
+    STAGE_PAYLOAD,
+    STAGE_SEND,
+    STAGE_TOTAL,
+    N_STAGES
+} Stage;
+
+static const char *stage_names[N_STAGES] = {
+    "device", "encode", "payload", "send", "total",
+};
+
+typedef struct {
+    GstClockTime pts;
+    gint64 device_latency;
+    gint64 times[N_POINTS];
+} FrameTrace;
+
+struct _StageTracer {
+    char *path;
+
+    GMutex lock;
+    FrameTrace frames[N_FRAMES];
+    guint next_frame;
+
+    // Cumulative for the metrics, and since the last periodic log
+    Histogram *stages[N_STAGES];
+    Histogram *interval[N_STAGES];
+};
+
+typedef struct {
+    StageTracer *tracer;
+    Point point;
+} ProbeData;
+
+static void
+stage_tracer_clear(StageTracer *tracer) {
+    int i;
+
+    g_clear_pointer(&tracer->path, g_free);
+    for (i = 0; i < N_STAGES; i++) {
+        g_clear_pointer(&tracer->stages[i], histogram_free);
+        g_clear_pointer(&tracer->interval[i], histogram_free);
+    }
+    g_mutex_clear(&tracer->lock);
+}
+
+StageTracer *
+stage_tracer_new(const char *path) {
+    StageTracer *tracer = g_atomic_rc_box_new0(StageTracer);
+    int i;
+
+    tracer->path = g_strdup(path);
+    g_mutex_init(&tracer->lock);
+    for (i = 0; i < N_STAGES; i++) {
+        tracer->stages[i] = histogram_new();
+        tracer->interval[i] = histogram_new();
+    }
+
+    return tracer;
+}
+
+StageTracer *
+stage_tracer_ref(StageTracer *tracer) {
+    return g_atomic_rc_box_acquire(tracer);
+}
+
+void
+stage_tracer_unref(StageTracer *tracer) {
+    g_atomic_rc_box_release_full(tracer, (GDestroyNotify)stage_tracer_clear);
+}
+
+static FrameTrace *
+find_frame(StageTracer *tracer, GstClockTime pts) {
+    guint i;
+
+    // Search from the most recently captured frame backwards
+    for (i = 1; i <= N_FRAMES; i++) {
+        FrameTrace *frame = &tracer->frames[(tracer->next_frame - i) % N_FRAMES];
+
+        if (frame->times[POINT_CAPTURE] != 0 && frame->pts == pts)
+            return frame;
+    }
+    return NULL;
+}
+
+static void
+add_latency(StageTracer *tracer, Stage stage, gint64 latency) {
+    histogram_add(tracer->stages[stage], latency);
+    histogram_add(tracer->interval[stage], latency);
+}
+
+static void
+record_capture(StageTracer *tracer, GstElement *element, GstClockTime pts) {
+    g_autoptr(GstClock) clock = NULL;
+    gint64 device_latency = 0;
+    FrameTrace *frame;
+
+    clock = gst_element_get_clock(element);
+    if (clock) {
+        GstClockTime now = gst_clock_get_time(clock);
+        GstClockTime base_time = gst_element_get_base_time(element);
+
+        if (now > base_time + pts) {
+            device_latency = (now - base_time - pts) / GST_USECOND;
+        }
+    }
+
+    g_mutex_lock(&tracer->lock);
+    frame = &tracer->frames[tracer->next_frame % N_FRAMES];
+    tracer->next_frame++;
+    memset(frame, 0, sizeof(*frame));
+    frame->pts = pts;
+    frame->device_latency = device_latency;
+    frame->times[POINT_CAPTURE] = g_get_monotonic_time();
+    g_mutex_unlock(&tracer->lock);
+
+    add_latency(tracer, STAGE_DEVICE, device_latency);
+}
+
+static void
+record_point(StageTracer *tracer, Point point, GstClockTime pts) {
+    gint64 now = g_get_monotonic_time();
+    gint64 stage_latency = -1, total_latency = -1;
+    FrameTrace *frame;
+
+    g_mutex_lock(&tracer->lock);
+    frame = find_frame(tracer, pts);
+    // Only the first packet of each frame counts
+    if (frame && frame->times[point] == 0 && frame->times[point - 1] != 0) {
+        frame->times[point] = now;
+        stage_latency = now - frame->times[point - 1];
+        if (point == POINT_SENT) {
+            total_latency = frame->device_latency + now - frame->times[POINT_CAPTURE];
+        }
+    }
+    g_mutex_unlock(&tracer->lock);
+
+    // Each point ends the stage with the same index
+    if (stage_latency >= 0)
+        add_latency(tracer, (Stage)point, stage_latency);
+    if (total_latency >= 0)
+        add_latency(tracer, STAGE_TOTAL, total_latency);
+}
+
+static GstPadProbeReturn
+trace_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    ProbeData *data = user_data;
+    GstBuffer *buffer;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+
+        if (gst_buffer_list_length(list) == 0)
+            return GST_PAD_PROBE_OK;
+        buffer = gst_buffer_list_get(list, 0);
+    } else {
+        buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    }
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    if (data->point == POINT_CAPTURE) {
+        g_autoptr(GstElement) element = gst_pad_get_parent_element(pad);
+
+        record_capture(data->tracer, element, GST_BUFFER_PTS(buffer));
+    } else {
+        record_point(data->tracer, data->point, GST_BUFFER_PTS(buffer));
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+probe_data_free(ProbeData *data) {
+    stage_tracer_unref(data->tracer);
+    g_free(data);
+}
+
+static void
+add_probe(StageTracer *tracer, GstPad *pad, Point point) {
+    ProbeData *data = g_new0(ProbeData, 1);
+
+    data->tracer = stage_tracer_ref(tracer);
+    data->point = point;
+    gst_pad_add_probe(
+        pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+        trace_probe, data, (GDestroyNotify)probe_data_free);
+}
+
+static void
+rtpbin_pad_added(GstElement *rtpbin, GstPad *pad, StageTracer *tracer) {
+    if (g_str_has_prefix(GST_PAD_NAME(pad), "send_rtp_src_")) {
+        add_probe(tracer, pad, POINT_SENT);
+    }
+}
+
+static void
+rtpbin_added(GstElement *rtpbin, void *user_data) {
+    StageTracer *tracer = user_data;
+
+    g_signal_connect_data(rtpbin, "pad-added", G_CALLBACK(rtpbin_pad_added),
+                          stage_tracer_ref(tracer),
+                          (GClosureNotify)stage_tracer_unref, 0);
+}
+
+void
+stage_tracer_attach(StageTracer *tracer, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) source = NULL;
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstPad) pad = NULL;
+
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    // Following pay0 upstream skips any audio source
+    if (pay) {
+        source = media_util_find_upstream_source(pay);
+    }
+    if (source == NULL) {
+        source = media_util_find_capture_source(element);
+    }
+    if (source == NULL || pay == NULL) {
+        g_warning("Cannot trace '%s': no capture source or pay0 element", tracer->path);
+        return;
+    }
+
+    pad = gst_element_get_static_pad(source, "src");
+    if (pad) add_probe(tracer, pad, POINT_CAPTURE);
+    g_clear_object(&pad);
+
+    pad = gst_element_get_static_pad(pay, "sink");
+    add_probe(tracer, pad, POINT_ENCODED);
+    g_clear_object(&pad);
+
+    pad = gst_element_get_static_pad(pay, "src");
+    add_probe(tracer, pad, POINT_PAYLOADED);
+
+    media_util_on_rtpbin(media, rtpbin_added, stage_tracer_ref(tracer),
+                         (GDestroyNotify)stage_tracer_unref);
+}
+
+void
+stage_tracer_log(StageTracer *tracer) {
+    g_autoptr(GString) line = g_string_new(NULL);
+    int i;
+
+    if (histogram_get_count(tracer->interval[STAGE_TOTAL]) == 0)
+        return;
+
+    for (i = 0; i < N_STAGES; i++) {
+        Histogram *hist = tracer->interval[i];
+
+        g_string_append_printf(
+            line, "%s%s %.1f/%.1f/%.1f", i ? ", " : "", stage_names[i],
+            histogram_get_percentile(hist, 0.50) / 1000.0,
+            histogram_get_percentile(hist, 0.95) / 1000.0,
+            histogram_get_percentile(hist, 0.99) / 1000.0);
+    }
+    g_message("Stream '%s' latency p50/p95/p99 (ms): %s", tracer->path, line->str);
+
+    // Each log line covers only the frames since the last one
+    for (i = 0; i < N_STAGES; i++) {
+        histogram_reset(tracer->interval[i]);
+    }
+}
+
+void
+stage_tracer_collect(GString *out, void *user_data) {
+    StageTracer *tracer = user_data;
+    static const double quantiles[] = { 0.5, 0.95, 0.99 };
+    guint i, q;
+
+    for (i = 0; i < N_STAGES; i++) {
+        Histogram *hist = tracer->stages[i];
+
+        for (q = 0; q < G_N_ELEMENTS(quantiles); q++) {
+            g_string_append_printf(
+                out, "rtsp_sender_stage_latency_seconds{mount=\"%s\",stage=\"%s\",quantile=\"%g\"} %g\n",
+                tracer->path, stage_names[i], quantiles[q],
+                histogram_get_percentile(hist, quantiles[q]) / (double)G_USEC_PER_SEC);
+        }
+        g_string_append_printf(
+            out, "rtsp_sender_stage_latency_seconds_count{mount=\"%s\",stage=\"%s\"} %" G_GUINT64_FORMAT "\n",
+            tracer->path, stage_names[i], histogram_get_count(hist));
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _StageTracer StageTracer;
+
+StageTracer *stage_tracer_new(const char *path);
+StageTracer *stage_tracer_ref(StageTracer *tracer);
+void stage_tracer_unref(StageTracer *tracer);
+
+// Install probes timestamping buffers at capture, after encode, after
+// payloading and when handed to the transport.
+void stage_tracer_attach(StageTracer *tracer, GstRTSPMedia *media);
+
+void stage_tracer_log(StageTracer *tracer);
+void stage_tracer_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(StageTracer, stage_tracer_unref);
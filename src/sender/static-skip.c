@@ -0,0 +1,247 @@
+#include "static-skip.h"
+
+#include <gst/video/video.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "media-util.h"
+
+// Frames are compared with the last one passed in blocks of 16 bytes
+// by 16 rows of their first plane.  A block changes when the sum of
+// its absolute differences is more than an average of 2 levels a byte.
+#define BLOCK_BYTES 16
+#define BLOCK_ROWS 16
+#define BLOCK_THRESHOLD (2 * BLOCK_BYTES * BLOCK_ROWS)
+
+struct _StaticSkip {
+    char *path;
+    gint64 keepalive;
+
+    GMutex lock;
+    guint64 passed;
+    guint64 skipped;
+    gboolean still;
+};
+
+// The state for one media's encoder input
+typedef struct {
+    StaticSkip *skip;
+    GstVideoInfo info;
+    gboolean have_info;
+    gsize width;
+    guint height;
+    guint cols;
+    // First plane of the last frame passed, width bytes a row
+    guint8 *reference;
+    gboolean have_reference;
+    // Differences of one row of blocks
+    guint32 *sads;
+    gint64 last_passed;
+} SkipMedia;
+
+static void
+sad_row(const guint8 *row, const guint8 *ref, gsize width, guint cols,
+        guint32 *sads) {
+    guint col;
+
+    for (col = 0; col < cols; col++) {
+        // The last block overlaps its neighbour rather than miss the edge
+        gsize offset = MIN(col * BLOCK_BYTES, width - BLOCK_BYTES);
+#ifdef __SSE2__
+        __m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(row + offset)),
+                                   _mm_loadu_si128((const __m128i *)(ref + offset)));
+
+        sads[col] += _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+#else
+        guint32 sum = 0;
+        guint i;
+
+        for (i = 0; i < BLOCK_BYTES; i++) {
+            sum += ABS((int)row[offset + i] - (int)ref[offset + i]);
+        }
+        sads[col] += sum;
+#endif
+    }
+}
+
+// Whether any block differs from the reference, stopping at the first
+static gboolean
+skip_media_changed(SkipMedia *sm, const guint8 *data, gsize stride) {
+    guint y, top, col;
+
+    for (top = 0; top < sm->height; top += BLOCK_ROWS) {
+        memset(sm->sads, 0, sm->cols * sizeof(guint32));
+        for (y = top; y < MIN(top + BLOCK_ROWS, sm->height); y++) {
+            sad_row(data + y * stride, sm->reference + y * sm->width,
+                    sm->width, sm->cols, sm->sads);
+        }
+        for (col = 0; col < sm->cols; col++) {
+            if (sm->sads[col] > BLOCK_THRESHOLD)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+skip_media_set_reference(SkipMedia *sm, const guint8 *data, gsize stride) {
+    guint y;
+
+    for (y = 0; y < sm->height; y++) {
+        memcpy(sm->reference + y * sm->width, data + y * stride, sm->width);
+    }
+    sm->have_reference = TRUE;
+}
+
+static void
+skip_media_set_caps(SkipMedia *sm, GstCaps *caps) {
+    sm->have_info = gst_video_info_from_caps(&sm->info, caps);
+    sm->have_reference = FALSE;
+    g_clear_pointer(&sm->reference, g_free);
+    g_clear_pointer(&sm->sads, g_free);
+    if (!sm->have_info)
+        return;
+
+    // Packed formats interleave chroma with luma, which is no worse
+    // for spotting changes.
+    sm->width = (gsize)GST_VIDEO_INFO_COMP_WIDTH(&sm->info, 0) *
+        GST_VIDEO_INFO_COMP_PSTRIDE(&sm->info, 0);
+    sm->height = GST_VIDEO_INFO_COMP_HEIGHT(&sm->info, 0);
+    if (sm->width < BLOCK_BYTES) {
+        sm->have_info = FALSE;
+        return;
+    }
+    sm->cols = (sm->width + BLOCK_BYTES - 1) / BLOCK_BYTES;
+    sm->reference = g_malloc(sm->width * sm->height);
+    sm->sads = g_new0(guint32, sm->cols);
+}
+
+static void
+static_skip_count(StaticSkip *skip, gboolean passed, gboolean still) {
+    g_mutex_lock(&skip->lock);
+    if (passed) {
+        skip->passed++;
+    } else {
+        skip->skipped++;
+    }
+    skip->still = still;
+    g_mutex_unlock(&skip->lock);
+}
+
+static GstPadProbeReturn
+encoder_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    SkipMedia *sm = user_data;
+    GstVideoFrame frame;
+    const guint8 *data;
+    gsize stride;
+    gboolean changed;
+    gint64 now;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+
+            gst_event_parse_caps(event, &caps);
+            skip_media_set_caps(sm, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (!sm->have_info ||
+        !gst_video_frame_map(&frame, &sm->info, GST_PAD_PROBE_INFO_BUFFER(info), GST_MAP_READ))
+        return GST_PAD_PROBE_OK;
+    data = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+    stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+
+    now = g_get_monotonic_time();
+    changed = !sm->have_reference || skip_media_changed(sm, data, stride);
+    if (!changed && now - sm->last_passed < sm->skip->keepalive) {
+        gst_video_frame_unmap(&frame);
+        static_skip_count(sm->skip, FALSE, TRUE);
+        return GST_PAD_PROBE_DROP;
+    }
+
+    // Compare later frames with this one, so slow changes add up
+    skip_media_set_reference(sm, data, stride);
+    gst_video_frame_unmap(&frame);
+    sm->last_passed = now;
+    static_skip_count(sm->skip, TRUE, !changed);
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+skip_media_free(SkipMedia *sm) {
+    static_skip_unref(sm->skip);
+    g_free(sm->reference);
+    g_free(sm->sads);
+    g_free(sm);
+}
+
+void
+static_skip_attach(StaticSkip *skip, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) encoder = NULL;
+    g_autoptr(GstPad) pad = NULL;
+    SkipMedia *sm;
+
+    encoder = media_util_find_video_encoder(element);
+    if (encoder) {
+        pad = gst_element_get_static_pad(encoder, "sink");
+    }
+    if (pad == NULL) {
+        g_warning("Cannot skip static frames of '%s': no video encoder", skip->path);
+        return;
+    }
+
+    sm = g_new0(SkipMedia, 1);
+    sm->skip = static_skip_ref(skip);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                      encoder_probe, sm, (GDestroyNotify)skip_media_free);
+}
+
+static void
+static_skip_clear(StaticSkip *skip) {
+    g_clear_pointer(&skip->path, g_free);
+    g_mutex_clear(&skip->lock);
+}
+
+StaticSkip *
+static_skip_new(const char *path, guint keepalive_ms) {
+    StaticSkip *skip = g_atomic_rc_box_new0(StaticSkip);
+
+    skip->path = g_strdup(path);
+    skip->keepalive = (gint64)keepalive_ms * 1000;
+    g_mutex_init(&skip->lock);
+
+    return skip;
+}
+
+StaticSkip *
+static_skip_ref(StaticSkip *skip) {
+    return g_atomic_rc_box_acquire(skip);
+}
+
+void
+static_skip_unref(StaticSkip *skip) {
+    g_atomic_rc_box_release_full(skip, (GDestroyNotify)static_skip_clear);
+}
+
+void
+static_skip_collect(GString *out, void *user_data) {
+    StaticSkip *skip = user_data;
+
+    g_mutex_lock(&skip->lock);
+    g_string_append_printf(
+        out, "rtsp_sender_static_frames_passed_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        skip->path, skip->passed);
+    g_string_append_printf(
+        out, "rtsp_sender_static_frames_skipped_total{mount=\"%s\"} %" G_GUINT64_FORMAT "\n",
+        skip->path, skip->skipped);
+    g_string_append_printf(
+        out, "rtsp_sender_static{mount=\"%s\"} %d\n", skip->path, skip->still ? 1 : 0);
+    g_mutex_unlock(&skip->lock);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _StaticSkip StaticSkip;
+
+// Drops frames on their way into a mount's video encoder while the
+// picture is unchanged since the last frame encoded, letting one
+// through every keepalive_ms.  The first changed frame is always
+// passed straight through.
+StaticSkip *static_skip_new(const char *path, guint keepalive_ms);
+StaticSkip *static_skip_ref(StaticSkip *skip);
+void static_skip_unref(StaticSkip *skip);
+
+void static_skip_attach(StaticSkip *skip, GstRTSPMedia *media);
+
+void static_skip_collect(GString *out, void *user_data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(StaticSkip, static_skip_unref);
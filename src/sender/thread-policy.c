@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include "thread-policy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "media-util.h"
+
+struct _ThreadPolicy {
+    char *name;
+    gboolean has_cpus;
+    cpu_set_t cpus;
+    gboolean has_sched;
+    int sched;
+    gboolean has_priority;
+    int priority;
+    gint warned;
+};
+
+static const struct {
+    const char *name;
+    int sched;
+} sched_names[] = {
+    { "other", SCHED_OTHER },
+    { "batch", SCHED_BATCH },
+    { "idle", SCHED_IDLE },
+    { "fifo", SCHED_FIFO },
+    { "rr", SCHED_RR },
+};
+
+static gboolean
+is_realtime(int sched) {
+    return sched == SCHED_FIFO || sched == SCHED_RR;
+}
+
+static const char *
+sched_name(int sched) {
+    gsize i;
+
+    for (i = 0; i < G_N_ELEMENTS(sched_names); i++) {
+        if (sched_names[i].sched == sched)
+            return sched_names[i].name;
+    }
+    return "unknown";
+}
+
+static gboolean
+parse_cpus(const char *text, cpu_set_t *cpus) {
+    g_auto(GStrv) parts = g_strsplit(text, ",", -1);
+    gsize i;
+
+    CPU_ZERO(cpus);
+    for (i = 0; parts[i] != NULL; i++) {
+        g_auto(GStrv) range = g_strsplit(g_strstrip(parts[i]), "-", 2);
+        guint64 first, last, cpu;
+
+        if (!g_ascii_string_to_unsigned(range[0], 10, 0, CPU_SETSIZE - 1, &first, NULL))
+            return FALSE;
+        last = first;
+        if (range[1] &&
+            !g_ascii_string_to_unsigned(range[1], 10, first, CPU_SETSIZE - 1, &last, NULL))
+            return FALSE;
+        for (cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+static gboolean
+parse_sched(ThreadPolicy *policy, const char *text, GError **error) {
+    g_auto(GStrv) parts = g_strsplit(text, ":", 2);
+    gint64 min, max, priority;
+    gsize i;
+
+    for (i = 0; i < G_N_ELEMENTS(sched_names); i++) {
+        if (!g_strcmp0(parts[0], sched_names[i].name))
+            break;
+    }
+    if (i == G_N_ELEMENTS(sched_names)) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Unknown scheduling policy '%s' for '%s': expected other, "
+                    "batch, idle, fifo or rr", parts[0], policy->name);
+        return FALSE;
+    }
+    policy->has_sched = TRUE;
+    policy->sched = sched_names[i].sched;
+
+    if (is_realtime(policy->sched)) {
+        min = sched_get_priority_min(policy->sched);
+        max = sched_get_priority_max(policy->sched);
+        policy->has_priority = TRUE;
+        policy->priority = min;
+    } else {
+        // A nice value
+        min = -20;
+        max = 19;
+    }
+    if (parts[1] == NULL)
+        return TRUE;
+
+    if (!g_ascii_string_to_signed(parts[1], 10, min, max, &priority, NULL)) {
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Priority for '%s' must be from %" G_GINT64_FORMAT
+                    " to %" G_GINT64_FORMAT " with %s scheduling",
+                    policy->name, min, max, parts[0]);
+        return FALSE;
+    }
+    policy->has_priority = TRUE;
+    policy->priority = (int)priority;
+    return TRUE;
+}
+
+// Apply to the calling thread
+static void
+thread_policy_apply(ThreadPolicy *policy) {
+    int err = 0;
+
+    if (policy->has_cpus) {
+        err = pthread_setaffinity_np(pthread_self(), sizeof(policy->cpus), &policy->cpus);
+    }
+    if (!err && policy->has_sched) {
+        struct sched_param param = { 0 };
+
+        if (is_realtime(policy->sched)) {
+            param.sched_priority = policy->priority;
+        }
+        err = pthread_setschedparam(pthread_self(), policy->sched, &param);
+    }
+    if (!err && policy->has_priority && !is_realtime(policy->sched) &&
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), policy->priority) < 0) {
+        err = errno;
+    }
+
+    // Real-time scheduling usually needs CAP_SYS_NICE or an rtprio limit
+    if (err && g_atomic_int_compare_and_exchange(&policy->warned, FALSE, TRUE)) {
+        g_warning("Could not set thread policy for '%s': %s",
+                  policy->name, g_strerror(err));
+    }
+}
+
+// e.g. "CPUs 2,3, fifo 50"
+static char *
+describe_current_thread(void) {
+    GString *out = g_string_new("CPUs ");
+    struct sched_param param = { 0 };
+    cpu_set_t cpus;
+    int sched = SCHED_OTHER;
+    int cpu, n = 0;
+
+    CPU_ZERO(&cpus);
+    pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus)) {
+            g_string_append_printf(out, "%s%d", n++ ? "," : "", cpu);
+        }
+    }
+    pthread_getschedparam(pthread_self(), &sched, &param);
+    if (is_realtime(sched)) {
+        g_string_append_printf(out, ", %s %d", sched_name(sched), param.sched_priority);
+    } else {
+        g_string_append_printf(out, ", %s nice %d", sched_name(sched),
+                               getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid)));
+    }
+    return g_string_free(out, FALSE);
+}
+
+// ----- Task pool for a media's streaming threads
+
+typedef struct {
+    GstTaskPool parent;
+    ThreadPolicy *policy;
+} PolicyTaskPool;
+
+typedef struct {
+    GstTaskPoolClass parent_class;
+} PolicyTaskPoolClass;
+
+typedef struct {
+    ThreadPolicy *policy;
+    GstTaskPoolFunction func;
+    void *data;
+} PolicyTask;
+
+GType policy_task_pool_get_type(void);
+G_DEFINE_TYPE(PolicyTaskPool, policy_task_pool, GST_TYPE_TASK_POOL);
+
+static void *
+run_policy_task(void *user_data) {
+    PolicyTask *task = user_data;
+
+    thread_policy_apply(task->policy);
+    task->func(task->data);
+    thread_policy_unref(task->policy);
+    g_free(task);
+    return NULL;
+}
+
+// Each task runs on a thread of its own that exits with it.  The base
+// class's threads come from GLib's shared pool and would go on to run
+// other pipelines' tasks under this policy.
+static gpointer
+policy_task_pool_push(GstTaskPool *pool, GstTaskPoolFunction func,
+                      gpointer data, GError **error) {
+    PolicyTaskPool *self = (PolicyTaskPool *)pool;
+    PolicyTask *task = g_new0(PolicyTask, 1);
+    GThread *thread;
+
+    task->policy = thread_policy_ref(self->policy);
+    task->func = func;
+    task->data = data;
+    thread = g_thread_try_new(NULL, run_policy_task, task, error);
+    if (!thread) {
+        thread_policy_unref(task->policy);
+        g_free(task);
+    }
+    return thread;
+}
+
+static void
+policy_task_pool_join(GstTaskPool *pool, gpointer id) {
+    g_thread_join(id);
+}
+
+static void
+policy_task_pool_finalize(GObject *object) {
+    PolicyTaskPool *self = (PolicyTaskPool *)object;
+
+    g_clear_pointer(&self->policy, thread_policy_unref);
+    G_OBJECT_CLASS(policy_task_pool_parent_class)->finalize(object);
+}
+
+static void
+policy_task_pool_class_init(PolicyTaskPoolClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = policy_task_pool_finalize;
+    GST_TASK_POOL_CLASS(klass)->push = policy_task_pool_push;
+    GST_TASK_POOL_CLASS(klass)->join = policy_task_pool_join;
+}
+
+static void
+policy_task_pool_init(PolicyTaskPool *self) {
+}
+
+static GstBusSyncReply
+stream_status(GstMessage *message, void *user_data) {
+    PolicyTaskPool *pool = user_data;
+    GstStreamStatusType type;
+    GstElement *owner;
+
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+        return GST_BUS_PASS;
+
+    gst_message_parse_stream_status(message, &type, &owner);
+    if (type == GST_STREAM_STATUS_TYPE_CREATE) {
+        const GValue *value = gst_message_get_stream_status_object(message);
+
+        if (value && G_VALUE_HOLDS(value, GST_TYPE_TASK)) {
+            gst_task_set_pool(g_value_get_object(value), GST_TASK_POOL(pool));
+        }
+    } else if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+        // Posted from the new thread itself
+        g_autofree char *placement = describe_current_thread();
+
+        g_message("Stream '%s' thread for %s: %s",
+                  pool->policy->name, GST_ELEMENT_NAME(owner), placement);
+    }
+    return GST_BUS_PASS;
+}
+
+void
+thread_policy_attach(ThreadPolicy *policy, GstRTSPMedia *media) {
+    PolicyTaskPool *pool;
+
+    // Not prepared: it doesn't use the base class's GLib pool
+    pool = g_object_new(policy_task_pool_get_type(), NULL);
+    gst_object_ref_sink(pool);
+    pool->policy = thread_policy_ref(policy);
+
+    media_util_add_sync_handler(media, stream_status, pool, gst_object_unref);
+}
+
+// ----- Pool for the RTSP server's threads
+
+typedef struct {
+    GstRTSPThreadPool parent;
+    ThreadPolicy *policy;
+} PolicyRtspPool;
+
+typedef struct {
+    GstRTSPThreadPoolClass parent_class;
+} PolicyRtspPoolClass;
+
+GType policy_rtsp_pool_get_type(void);
+G_DEFINE_TYPE(PolicyRtspPool, policy_rtsp_pool, GST_TYPE_RTSP_THREAD_POOL);
+
+static void
+policy_rtsp_pool_thread_enter(GstRTSPThreadPool *pool, GstRTSPThread *thread) {
+    PolicyRtspPool *self = (PolicyRtspPool *)pool;
+    g_autofree char *placement = NULL;
+
+    thread_policy_apply(self->policy);
+    placement = describe_current_thread();
+    g_message("RTSP server thread: %s", placement);
+}
+
+static void
+policy_rtsp_pool_finalize(GObject *object) {
+    PolicyRtspPool *self = (PolicyRtspPool *)object;
+
+    g_clear_pointer(&self->policy, thread_policy_unref);
+    G_OBJECT_CLASS(policy_rtsp_pool_parent_class)->finalize(object);
+}
+
+static void
+policy_rtsp_pool_class_init(PolicyRtspPoolClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = policy_rtsp_pool_finalize;
+    GST_RTSP_THREAD_POOL_CLASS(klass)->thread_enter = policy_rtsp_pool_thread_enter;
+}
+
+static void
+policy_rtsp_pool_init(PolicyRtspPool *self) {
+}
+
+GstRTSPThreadPool *
+thread_policy_new_rtsp_pool(ThreadPolicy *policy) {
+    PolicyRtspPool *pool = g_object_new(policy_rtsp_pool_get_type(), NULL);
+
+    pool->policy = thread_policy_ref(policy);
+    return GST_RTSP_THREAD_POOL(pool);
+}
+
+// ----- ThreadPolicy
+
+static void
+thread_policy_clear(ThreadPolicy *policy) {
+    g_clear_pointer(&policy->name, g_free);
+}
+
+ThreadPolicy *
+thread_policy_new(const char *name, const char *cpus, const char *sched,
+                  GError **error) {
+    g_autoptr(ThreadPolicy) policy = g_atomic_rc_box_new0(ThreadPolicy);
+
+    policy->name = g_strdup(name);
+    if (cpus) {
+        if (!parse_cpus(cpus, &policy->cpus)) {
+            g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                        "Invalid CPU list '%s' for '%s'", cpus, name);
+            return NULL;
+        }
+        policy->has_cpus = TRUE;
+    }
+    if (sched && !parse_sched(policy, sched, error))
+        return NULL;
+
+    return g_steal_pointer(&policy);
+}
+
+ThreadPolicy *
+thread_policy_ref(ThreadPolicy *policy) {
+    return g_atomic_rc_box_acquire(policy);
+}
+
+void
+thread_policy_unref(ThreadPolicy *policy) {
+    g_atomic_rc_box_release_full(policy, (GDestroyNotify)thread_policy_clear);
+}
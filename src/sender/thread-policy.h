@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _ThreadPolicy ThreadPolicy;
+
+// Where and how a set of threads run.  cpus is a list of CPUs and
+// ranges such as "2-3" or "0,2".  sched is "other", "batch", "idle",
+// "fifo" or "rr", optionally followed by ":PRIORITY": the real-time
+// priority for fifo and rr, otherwise a nice value.  Either may be
+// NULL to leave it as inherited.
+ThreadPolicy *thread_policy_new(const char *name, const char *cpus,
+                                const char *sched, GError **error);
+ThreadPolicy *thread_policy_ref(ThreadPolicy *policy);
+void thread_policy_unref(ThreadPolicy *policy);
+
+// Run the media's streaming threads under the policy
+void thread_policy_attach(ThreadPolicy *policy, GstRTSPMedia *media);
+
+// A pool for the RTSP server's own threads
+GstRTSPThreadPool *thread_policy_new_rtsp_pool(ThreadPolicy *policy);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(ThreadPolicy, thread_policy_unref);
@@ -0,0 +1,482 @@
+#include "view-adapt.h"
+
+#include <gst/video/video.h>
+#include <math.h>
+#include <string.h>
+
+#include "media-util.h"
+#include "view-region.h"
+
+#define N_STAMPS 64
+#define MIN_SIZE 16
+
+// What one client is showing.  The crop corners are fractions of the
+// full picture.
+typedef struct {
+    double x0, y0, x1, y1;
+    // 0 for the full resolution
+    guint width, height;
+    // 0 for no limit
+    gint fps_n, fps_d;
+} View;
+
+// The union of every client's view
+typedef struct {
+    double x0, y0, x1, y1;
+    // Output pixels wanted across the full picture, or 0 for the
+    // full resolution.
+    double density_x, density_y;
+    // 0 for no limit
+    gint max_rate;
+} Target;
+
+typedef struct {
+    GstClockTime pts;
+    ViewRegion region;
+} Stamp;
+
+struct _ViewAdapt {
+    char *path;
+
+    GMutex lock;
+    GHashTable *views;
+    Target target;
+    guint generation;
+};
+
+// State for one media's copy of the adapting elements, used from its
+// streaming threads.
+typedef struct {
+    ViewAdapt *adapt;
+    GstElement *rate;
+    GstElement *crop;
+    GstElement *caps;
+
+    guint generation;
+    gint full_width, full_height;
+    ViewRegion region;
+
+    GMutex lock;
+    Stamp stamps[N_STAMPS];
+    guint next_stamp;
+} AdaptMedia;
+
+static const View full_view = { 0.0, 0.0, 1.0, 1.0, 0, 0, 0, 1 };
+
+static void client_closed(GstRTSPClient *client, ViewAdapt *adapt);
+
+static void
+view_adapt_clear(ViewAdapt *adapt) {
+    GHashTableIter iter;
+    GstRTSPClient *client;
+
+    g_hash_table_iter_init(&iter, adapt->views);
+    while (g_hash_table_iter_next(&iter, (void **)&client, NULL)) {
+        g_signal_handlers_disconnect_by_func(client, client_closed, adapt);
+    }
+    g_clear_pointer(&adapt->views, g_hash_table_unref);
+    g_clear_pointer(&adapt->path, g_free);
+    g_mutex_clear(&adapt->lock);
+}
+
+static void
+view_adapt_set_target(ViewAdapt *adapt, const Target *target) {
+    if (memcmp(target, &adapt->target, sizeof(*target)) != 0) {
+        adapt->target = *target;
+        adapt->generation++;
+    }
+}
+
+ViewAdapt *
+view_adapt_new(const char *path) {
+    ViewAdapt *adapt = g_atomic_rc_box_new0(ViewAdapt);
+    Target target = { 0.0, 0.0, 1.0, 1.0, 0.0, 0.0, 0 };
+
+    adapt->path = g_strdup(path);
+    g_mutex_init(&adapt->lock);
+    adapt->views = g_hash_table_new_full(NULL, NULL, g_object_unref, g_free);
+    view_adapt_set_target(adapt, &target);
+
+    return adapt;
+}
+
+ViewAdapt *
+view_adapt_ref(ViewAdapt *adapt) {
+    return g_atomic_rc_box_acquire(adapt);
+}
+
+void
+view_adapt_unref(ViewAdapt *adapt) {
+    g_atomic_rc_box_release_full(adapt, (GDestroyNotify)view_adapt_clear);
+}
+
+// Call with the lock held
+static void
+view_adapt_update_target(ViewAdapt *adapt) {
+    Target target = { 1.0, 1.0, 0.0, 0.0, 0.0, 0.0, 0 };
+    gboolean full_size = FALSE, any_rate = FALSE;
+    GHashTableIter iter;
+    View *view;
+
+    if (g_hash_table_size(adapt->views) == 0) {
+        target = (Target){ 0.0, 0.0, 1.0, 1.0, 0.0, 0.0, 0 };
+        view_adapt_set_target(adapt, &target);
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, adapt->views);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&view)) {
+        target.x0 = MIN(target.x0, view->x0);
+        target.y0 = MIN(target.y0, view->y0);
+        target.x1 = MAX(target.x1, view->x1);
+        target.y1 = MAX(target.y1, view->y1);
+
+        // Keep the pixel density of the most demanding client
+        if (view->width == 0 || view->height == 0) {
+            full_size = TRUE;
+        } else {
+            target.density_x = MAX(target.density_x, view->width / (view->x1 - view->x0));
+            target.density_y = MAX(target.density_y, view->height / (view->y1 - view->y0));
+        }
+        if (view->fps_n == 0) {
+            any_rate = TRUE;
+        } else {
+            target.max_rate = MAX(target.max_rate,
+                                  (gint)ceil((double)view->fps_n / view->fps_d));
+        }
+    }
+    if (full_size) {
+        target.density_x = target.density_y = 0.0;
+    }
+    if (any_rate) {
+        target.max_rate = 0;
+    }
+    view_adapt_set_target(adapt, &target);
+}
+
+static void
+client_closed(GstRTSPClient *client, ViewAdapt *adapt) {
+    g_signal_handlers_disconnect_by_func(client, client_closed, adapt);
+
+    g_mutex_lock(&adapt->lock);
+    g_hash_table_remove(adapt->views, client);
+    view_adapt_update_target(adapt);
+    g_mutex_unlock(&adapt->lock);
+}
+
+// Call with the lock held
+static View *
+view_adapt_lookup_client(ViewAdapt *adapt, GstRTSPClient *client) {
+    View *view = g_hash_table_lookup(adapt->views, client);
+
+    if (view == NULL) {
+        view = g_new(View, 1);
+        *view = full_view;
+        g_hash_table_insert(adapt->views, g_object_ref(client), view);
+        g_signal_connect(client, "closed", G_CALLBACK(client_closed), adapt);
+    }
+    return view;
+}
+
+void
+view_adapt_add_client(ViewAdapt *adapt, GstRTSPClient *client) {
+    g_mutex_lock(&adapt->lock);
+    view_adapt_lookup_client(adapt, client);
+    view_adapt_update_target(adapt);
+    g_mutex_unlock(&adapt->lock);
+}
+
+static gboolean
+parse_crop(const char *text, View *view) {
+    g_auto(GStrv) corners = g_strsplit(text, ",", -1);
+    double values[4];
+    char *end;
+    int i;
+
+    if (g_strv_length(corners) != 4)
+        return FALSE;
+    for (i = 0; i < 4; i++) {
+        values[i] = g_ascii_strtod(corners[i], &end);
+        if (end == corners[i] || *end != '\0' || values[i] < 0.0 || values[i] > 1.0)
+            return FALSE;
+    }
+    if (values[0] >= values[2] || values[1] >= values[3])
+        return FALSE;
+
+    view->x0 = values[0];
+    view->y0 = values[1];
+    view->x1 = values[2];
+    view->y1 = values[3];
+    return TRUE;
+}
+
+static gboolean
+parse_view(const char *text, View *view) {
+    g_auto(GStrv) fields = g_strsplit_set(text, " \t\r\n", -1);
+    int i;
+
+    *view = full_view;
+    for (i = 0; fields[i] != NULL; i++) {
+        const char *field = fields[i];
+
+        if (field[0] == '\0' || !strcmp(field, "none")) {
+            continue;
+        } else if (g_str_has_prefix(field, "size=")) {
+            if (sscanf(field + 5, "%ux%u", &view->width, &view->height) != 2)
+                return FALSE;
+        } else if (g_str_has_prefix(field, "crop=")) {
+            if (!parse_crop(field + 5, view))
+                return FALSE;
+        } else if (g_str_has_prefix(field, "fps=")) {
+            view->fps_d = 1;
+            if (sscanf(field + 4, "%d/%d", &view->fps_n, &view->fps_d) < 1 ||
+                view->fps_n < 0 || view->fps_d <= 0)
+                return FALSE;
+        }
+        // Ignore anything newer receivers might add
+    }
+    return TRUE;
+}
+
+gboolean
+view_adapt_set_view(ViewAdapt *adapt, GstRTSPClient *client,
+                    const char *text) {
+    View view;
+
+    if (!parse_view(text, &view))
+        return FALSE;
+
+    g_mutex_lock(&adapt->lock);
+    *view_adapt_lookup_client(adapt, client) = view;
+    view_adapt_update_target(adapt);
+    g_mutex_unlock(&adapt->lock);
+
+    return TRUE;
+}
+
+static AdaptMedia *
+adapt_media_ref(AdaptMedia *am) {
+    return g_atomic_rc_box_acquire(am);
+}
+
+static void
+adapt_media_clear(AdaptMedia *am) {
+    view_adapt_unref(am->adapt);
+    g_mutex_clear(&am->lock);
+}
+
+static void
+adapt_media_unref(AdaptMedia *am) {
+    g_atomic_rc_box_release_full(am, (GDestroyNotify)adapt_media_clear);
+}
+
+static guint
+round_even(double value) {
+    return ((guint)ceil(value) + 1) & ~1u;
+}
+
+static void
+adapt_media_apply(AdaptMedia *am, const Target *target) {
+    g_autoptr(GstCaps) caps = NULL;
+    gint width = am->full_width, height = am->full_height;
+    ViewRegion region;
+    double scale = 1.0;
+    guint out_width, out_height, right, bottom;
+
+    // Even offsets and sizes keep chroma subsampling aligned
+    region.full_width = width;
+    region.full_height = height;
+    region.x = (guint)(target->x0 * width) & ~1u;
+    region.y = (guint)(target->y0 * height) & ~1u;
+    right = MIN(round_even(target->x1 * width), (guint)width);
+    bottom = MIN(round_even(target->y1 * height), (guint)height);
+    region.width = MAX(right, region.x + MIN_SIZE) - region.x;
+    region.height = MAX(bottom, region.y + MIN_SIZE) - region.y;
+    region.width = MIN(region.width, width - region.x);
+    region.height = MIN(region.height, height - region.y);
+
+    // Scale both ways by the same amount, so pixels stay square
+    if (target->density_x > 0.0 && target->density_y > 0.0) {
+        scale = MAX(target->density_x / width, target->density_y / height);
+        scale = MIN(scale, 1.0);
+    }
+    out_width = CLAMP(round_even(region.width * scale), MIN(MIN_SIZE, region.width), region.width);
+    out_height = CLAMP(round_even(region.height * scale), MIN(MIN_SIZE, region.height), region.height);
+
+    g_object_set(am->rate, "max-rate", target->max_rate > 0 ? target->max_rate : G_MAXINT, NULL);
+    g_object_set(am->crop,
+                 "left", region.x,
+                 "top", region.y,
+                 "right", width - region.x - region.width,
+                 "bottom", height - region.y - region.height,
+                 NULL);
+    caps = gst_caps_new_simple("video/x-raw",
+                               "width", G_TYPE_INT, out_width,
+                               "height", G_TYPE_INT, out_height,
+                               NULL);
+    g_object_set(am->caps, "caps", caps, NULL);
+
+    if (memcmp(&region, &am->region, sizeof(region)) != 0) {
+        g_message("Sending '%s' as %ux%u from %ux%u+%u+%u of %dx%d",
+                  am->adapt->path, out_width, out_height, region.width,
+                  region.height, region.x, region.y, width, height);
+    }
+    am->region = region;
+}
+
+static GstPadProbeReturn
+crop_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    AdaptMedia *am = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    g_autoptr(GstCaps) caps = NULL;
+    GstVideoInfo vinfo;
+    Target target;
+    guint generation;
+    Stamp *stamp;
+
+    caps = gst_pad_get_current_caps(pad);
+    if (caps == NULL || !gst_video_info_from_caps(&vinfo, caps))
+        return GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&am->adapt->lock);
+    target = am->adapt->target;
+    generation = am->adapt->generation;
+    g_mutex_unlock(&am->adapt->lock);
+
+    // Changing the elements here affects this buffer onwards
+    if (generation != am->generation ||
+        GST_VIDEO_INFO_WIDTH(&vinfo) != am->full_width ||
+        GST_VIDEO_INFO_HEIGHT(&vinfo) != am->full_height) {
+        am->generation = generation;
+        am->full_width = GST_VIDEO_INFO_WIDTH(&vinfo);
+        am->full_height = GST_VIDEO_INFO_HEIGHT(&vinfo);
+        adapt_media_apply(am, &target);
+    }
+
+    // Encoders don't reliably copy metas, so remember the region by PTS
+    if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+        g_mutex_lock(&am->lock);
+        stamp = &am->stamps[am->next_stamp % N_STAMPS];
+        am->next_stamp++;
+        stamp->pts = GST_BUFFER_PTS(buffer);
+        stamp->region = am->region;
+        g_mutex_unlock(&am->lock);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+pay_probe(GstPad *pad, GstPadProbeInfo *info, void *user_data) {
+    AdaptMedia *am = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    ViewRegion region;
+    gboolean found = FALSE;
+    guint i;
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&am->lock);
+    for (i = 1; i <= N_STAMPS; i++) {
+        Stamp *stamp = &am->stamps[(am->next_stamp - i) % N_STAMPS];
+
+        if (stamp->region.width != 0 && stamp->pts == GST_BUFFER_PTS(buffer)) {
+            region = stamp->region;
+            found = TRUE;
+            break;
+        }
+    }
+    g_mutex_unlock(&am->lock);
+
+    if (found) {
+        buffer = gst_buffer_make_writable(buffer);
+        view_region_add_meta(buffer, &region);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+void
+view_adapt_attach(ViewAdapt *adapt, GstRTSPMedia *media) {
+    g_autoptr(GstElement) element = gst_rtsp_media_get_element(media);
+    g_autoptr(GstElement) encoder = NULL;
+    g_autoptr(GstElement) pay = NULL;
+    g_autoptr(GstObject) parent = NULL;
+    g_autoptr(GstPad) encoder_sink = NULL;
+    g_autoptr(GstPad) upstream = NULL;
+    g_autoptr(GstPad) pad = NULL;
+    g_autoptr(GstRTPHeaderExtension) ext = NULL;
+    GstElement *rate, *crop, *scale, *caps;
+    AdaptMedia *am;
+
+    encoder = media_util_find_video_encoder(element);
+    pay = gst_bin_get_by_name(GST_BIN(element), "pay0");
+    if (encoder == NULL || pay == NULL) {
+        g_warning("Cannot adapt '%s' to its view: no video encoder or pay0 element",
+                  adapt->path);
+        return;
+    }
+    encoder_sink = gst_element_get_static_pad(encoder, "sink");
+    upstream = encoder_sink ? gst_pad_get_peer(encoder_sink) : NULL;
+    parent = gst_object_get_parent(GST_OBJECT(encoder));
+    if (upstream == NULL || parent == NULL) {
+        g_warning("Cannot adapt '%s' to its view: video encoder is not linked",
+                  adapt->path);
+        return;
+    }
+
+    rate = gst_element_factory_make("videorate", NULL);
+    crop = gst_element_factory_make("videocrop", NULL);
+    scale = gst_element_factory_make("videoscale", NULL);
+    caps = gst_element_factory_make("capsfilter", NULL);
+    if (!rate || !crop || !scale || !caps) {
+        g_warning("Cannot adapt '%s' to its view: missing GStreamer elements",
+                  adapt->path);
+        g_clear_object(&rate);
+        g_clear_object(&crop);
+        g_clear_object(&scale);
+        g_clear_object(&caps);
+        return;
+    }
+
+    // Rate limit first, as videorate holds on to a frame
+    g_object_set(rate, "drop-only", TRUE, NULL);
+    gst_pad_unlink(upstream, encoder_sink);
+    gst_bin_add_many(GST_BIN(parent), rate, crop, scale, caps, NULL);
+    pad = gst_element_get_static_pad(rate, "sink");
+    if (gst_pad_link(upstream, pad) != GST_PAD_LINK_OK ||
+        !gst_element_link_many(rate, crop, scale, caps, encoder, NULL)) {
+        g_warning("Cannot adapt '%s' to its view: could not link elements",
+                  adapt->path);
+        // Removing the elements unlinks and frees them, then the
+        // encoder is fed directly again.
+        gst_bin_remove_many(GST_BIN(parent), rate, crop, scale, caps, NULL);
+        if (gst_pad_link(upstream, encoder_sink) != GST_PAD_LINK_OK) {
+            g_warning("Could not relink the video encoder of '%s'", adapt->path);
+        }
+        return;
+    }
+    g_clear_object(&pad);
+
+    am = g_atomic_rc_box_new0(AdaptMedia);
+    am->adapt = view_adapt_ref(adapt);
+    am->rate = rate;
+    am->crop = crop;
+    am->caps = caps;
+    g_mutex_init(&am->lock);
+
+    pad = gst_element_get_static_pad(crop, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, crop_probe,
+                      adapt_media_ref(am), (GDestroyNotify)adapt_media_unref);
+    g_clear_object(&pad);
+
+    ext = view_region_ext_new();
+    g_signal_emit_by_name(pay, "add-extension", ext);
+    pad = gst_element_get_static_pad(pay, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pay_probe,
+                      adapt_media_ref(am), (GDestroyNotify)adapt_media_unref);
+
+    adapt_media_unref(am);
+}
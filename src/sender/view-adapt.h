@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glib.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+typedef struct _ViewAdapt ViewAdapt;
+
+// Crops, scales and rate limits a mount's video before it is encoded,
+// to the most that any of its receivers is showing.  Frames carry the
+// region of the picture they hold in an RTP header extension.
+ViewAdapt *view_adapt_new(const char *path);
+ViewAdapt *view_adapt_ref(ViewAdapt *adapt);
+void view_adapt_unref(ViewAdapt *adapt);
+
+// Insert the adapting elements in front of the media's video encoder
+void view_adapt_attach(ViewAdapt *adapt, GstRTSPMedia *media);
+
+// Clients get the full picture until they say what they are showing
+void view_adapt_add_client(ViewAdapt *adapt, GstRTSPClient *client);
+
+// Parse an "obs-view" parameter: "size=WxH crop=X0,Y0,X1,Y1 fps=N/D",
+// where the crop corners are fractions of the full picture and every
+// field is optional.  "none" asks for the full picture.
+gboolean view_adapt_set_view(ViewAdapt *adapt, GstRTSPClient *client,
+                             const char *view);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(ViewAdapt, view_adapt_unref);